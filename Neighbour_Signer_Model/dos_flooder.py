@@ -5,6 +5,7 @@ import time
 import random
 import hmac
 import hashlib
+import os
 
 # --- Configuration ---
 VICTIM_HOST = "127.0.0.1"
@@ -15,7 +16,8 @@ MESSAGE_COUNT_PER_PROCESS = 1000
 PROCESS_COUNT = 10 
 
 AUTHORIZED_CLIENT_ID = "C8"
-HMAC_SECRET_KEY = b"4c1c4d7e2b9f7a0e8b6d3e5f1a2c7b4d"
+HMAC_SECRET_KEY = os.environ.get("TRUST_HMAC_KEY", "4c1c4d7e2b9f7a0e8b6d3e5f1a2c7b4d").encode()
+HMAC_KEY_ID = os.environ.get("TRUST_HMAC_KID")  # names the key in a "kid" field when set
 SIGNER_IDS = ["B0", "B1", "B2", "B3", "B5", "B6", "B7"]
 
 def flood_broker(process_id):
@@ -38,6 +40,8 @@ def flood_broker(process_id):
             "message": "dos",
             "S": signers_list
         }
+        if HMAC_KEY_ID:
+            payload_json["kid"] = HMAC_KEY_ID
         
         payload_str_no_hmac = json.dumps(payload_json, separators=(',', ':'))
         new_hmac = hmac.new(HMAC_SECRET_KEY, payload_str_no_hmac.encode(), hashlib.sha256).hexdigest()
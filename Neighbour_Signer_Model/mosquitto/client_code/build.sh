@@ -18,7 +18,7 @@ for i in {0..15}; do
     OUT="$BIN_DIR/c${i}"
     if [ -f "$SRC" ]; then
         echo "   -> Compiling c${i}.c"
-        gcc "$SRC" "$COMMON_DIR/client_common.c" -I"$INCLUDE_DIR" -L"$LIB_DIR" \
+        gcc "$SRC" "$COMMON_DIR/client_common.c" "$COMMON_DIR/trust_digest.c" "$COMMON_DIR/trust_hmac.c" "$COMMON_DIR/trust_sha256_mb.c" "$COMMON_DIR/trust_token.c" -I"$INCLUDE_DIR" -I"$COMMON_DIR" -L"$LIB_DIR" \
             -lmosquitto -lpthread -lssl -lcrypto -lcjson -o "$OUT"
         if [ $? -ne 0 ]; then echo "❌ Failed to compile c${i}.c"; fi
     fi
@@ -31,7 +31,7 @@ for i in 0 2 4 6; do
     OUT="$BIN_DIR/${FILE}"
     if [ -f "$SRC" ]; then
         echo "   -> Compiling ${FILE}.c"
-        gcc "$SRC" "$COMMON_DIR/client_common.c" -I"$INCLUDE_DIR" -L"$LIB_DIR" \
+        gcc "$SRC" "$COMMON_DIR/client_common.c" "$COMMON_DIR/trust_digest.c" "$COMMON_DIR/trust_hmac.c" "$COMMON_DIR/trust_sha256_mb.c" "$COMMON_DIR/trust_token.c" -I"$INCLUDE_DIR" -I"$COMMON_DIR" -L"$LIB_DIR" \
             -lmosquitto -lpthread -lssl -lcrypto -lcjson -o "$OUT"
         if [ $? -ne 0 ]; then echo "❌ Failed to compile ${FILE}.c"; fi
     fi
@@ -44,7 +44,7 @@ for i in {0..7}; do
     OUT="$BIN_DIR/${FILE}"
     if [ -f "$SRC" ]; then
         echo "   -> Compiling ${FILE}.c"
-        gcc "$SRC" -I"$INCLUDE_DIR" -L"$LIB_DIR" \
+        gcc "$SRC" "$COMMON_DIR/trust_digest.c" -I"$INCLUDE_DIR" -I"$COMMON_DIR" -L"$LIB_DIR" \
             -lmosquitto -lpthread -lssl -lcrypto -lcjson -o "$OUT"
         if [ $? -ne 0 ]; then echo "❌ Failed to compile ${FILE}.c"; fi
     fi
@@ -56,7 +56,7 @@ SRC="$CLIENT_CODE_DIR/${FILE}.c"
 OUT="$BIN_DIR/${FILE}"
 if [ -f "$SRC" ]; then
     echo "   -> Compiling ${FILE}.c"
-    gcc "$SRC" -I"$INCLUDE_DIR" -L"$LIB_DIR" \
+    gcc "$SRC" "$COMMON_DIR/trust_digest.c" -I"$INCLUDE_DIR" -I"$COMMON_DIR" -L"$LIB_DIR" \
         -lmosquitto -lpthread -lssl -lcrypto -lcjson -o "$OUT"
     if [ $? -ne 0 ]; then echo "❌ Failed to compile ${FILE}.c"; fi
 fi
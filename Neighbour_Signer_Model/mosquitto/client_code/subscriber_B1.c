@@ -4,6 +4,8 @@
 #include <unistd.h>
 #include <time.h> 
 #include "mosquitto.h"
+#include "mqtt_protocol.h"
+#include "trust_digest.h"
 #include <cjson/cJSON.h> 
 
 #define FEEDBACK_TOPIC "internal/feedback"
@@ -76,6 +78,17 @@ void on_message(struct mosquitto *mosq, void *obj, const struct mosquitto_messag
     printf("----------------------------------------\n");
     cJSON_Delete(root);
 }
+// Property tokens arrive as v5 user properties. A pd that no longer matches
+// the payload means it was swapped after the origin broker checked it.
+void on_message_v5(struct mosquitto *mosq, void *obj, const struct mosquitto_message *msg,
+                   const mosquitto_property *props)
+{
+    if (!trust_digest_props_ok(props, msg->payload, (size_t)msg->payloadlen)) {
+        printf("Error: payload on topic %s does not match its pd. Dropping it.\n", msg->topic);
+        return;
+    }
+    on_message(mosq, obj, msg);
+}
 int main() {
     struct mosquitto *mosq;
     int rc;
@@ -83,9 +96,10 @@ int main() {
     mosquitto_lib_init();
     
     mosq = mosquitto_new("interactive-subscriberB1", true, NULL);
+    mosquitto_int_option(mosq, MOSQ_OPT_PROTOCOL_VERSION, MQTT_PROTOCOL_V5);
     
     mosquitto_connect_callback_set(mosq, on_connect);
-    mosquitto_message_callback_set(mosq, on_message);
+    mosquitto_message_v5_callback_set(mosq, on_message_v5);
 
     // Make sure this port corresponds to your subscriber's local broker
     rc = mosquitto_connect(mosq, "localhost", 1884, 60);
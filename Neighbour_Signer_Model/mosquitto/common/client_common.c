@@ -5,14 +5,25 @@
 #include <openssl/hmac.h>
 #include <openssl/evp.h>
 #include "../include/mosquitto.h"
+#include "../include/mqtt_protocol.h"
 #include "client_common.h"
+#include "trust_digest.h"
+#include "trust_hmac.h"
+#include "trust_token.h"
 #include <cjson/cJSON.h>
 
 #define MSG_ID_FILE "msg_id.txt"
 
 // ---- HMAC Key ----
+// TRUST_HMAC_KEY overrides the built-in key. With TRUST_HMAC_KID set, tokens
+// name their key in a "kid" field, which brokers look up in their keyring.
 #define HMAC_KEY "4c1c4d7e2b9f7a0e8b6d3e5f1a2c7b4d"  // Must match broker/plugin
 
+static const char *hmac_kid(void) {
+    const char *kid = getenv("TRUST_HMAC_KID");
+    return kid && kid[0] ? kid : NULL;
+}
+
 // ---- HMAC helpers ----
 void hex_encode(const unsigned char *in, size_t len, char *out) {
     static const char hex_digits[] = "0123456789abcdef";
@@ -23,10 +34,22 @@ void hex_encode(const unsigned char *in, size_t len, char *out) {
     out[len*2] = '\0';
 }
 
+// The key's pad blocks are hashed once, on first use, and reused for every token.
+unsigned int compute_hmac_raw(const void *data, size_t data_len, unsigned char *hmac_out) {
+    static bool hmac_ready = false;
+    if (!hmac_ready) {
+        const char *key = getenv("TRUST_HMAC_KEY");
+        if (!key || !key[0]) key = HMAC_KEY;
+        hmac_ready = trust_hmac_init(key, strlen(key));
+        if (!hmac_ready) return 0;
+    }
+    hmac_span_t span = { data, data_len };
+    return (unsigned int)trust_hmac(&span, 1, hmac_out);
+}
+
 void compute_hmac(const char *data, size_t data_len, char *hmac_hex_out) {
     unsigned char hmac[EVP_MAX_MD_SIZE];
-    unsigned int hmac_len = 0;
-    HMAC(EVP_sha256(), HMAC_KEY, strlen(HMAC_KEY), (const unsigned char*)data, data_len, hmac, &hmac_len);
+    unsigned int hmac_len = compute_hmac_raw(data, data_len, hmac);
     hex_encode(hmac, hmac_len, hmac_hex_out);
 }
 
@@ -66,6 +89,20 @@ void on_message(struct mosquitto *mosq, void *obj, const struct mosquitto_messag
            cli->client_id, msg->topic, (char *)msg->payload);
 }
 
+// MQTT v5 clients see the token properties the broker forwarded, so a
+// payload whose pd no longer matches is dropped before it is printed.
+void on_message_v5(struct mosquitto *mosq, void *obj, const struct mosquitto_message *msg,
+                   const mosquitto_property *props)
+{
+    struct client *cli = (struct client *) obj;
+    if (!trust_digest_props_ok(props, msg->payload, (size_t)msg->payloadlen)) {
+        fprintf(stderr, "Client %s dropped message on topic %s: payload does not match pd\n",
+                cli->client_id, msg->topic);
+        return;
+    }
+    on_message(mosq, obj, msg);
+}
+
 // Load last used msg_id from file, default to 1
 int load_last_msg_id() {
     FILE *fp = fopen(MSG_ID_FILE, "r");
@@ -116,6 +153,7 @@ char* generate_at(struct client *cli)
 
     cJSON_AddStringToObject(root, "msg", cli->message);
     cJSON_AddNumberToObject(root, "msg_id", msg_id);
+    if (hmac_kid()) cJSON_AddStringToObject(root, "kid", hmac_kid());
 
     // 2. Serialize without hmac
     char *json_no_hmac = cJSON_PrintUnformatted(root);
@@ -144,6 +182,83 @@ char* generate_at(struct client *cli)
     return at_with_hmac;
 }
 
+// ---- Binary AT Generation ----
+// Same content as generate_at(), in the compact binary layout from trust_token.h.
+// The returned buffer is static; its length is written to *len.
+unsigned char* generate_at_bin(struct client *cli, size_t *len)
+{
+    static unsigned char at_bin[2200];
+    int msg_id = load_last_msg_id();
+
+    size_t at_len = at_bin_encode(at_bin, sizeof(at_bin), cli->issuer_broker, cli->client_id,
+                                  cli->publish_topic, cli->subscribe_topic, cli->message, (uint32_t)msg_id, hmac_kid());
+    if (at_len == 0) {
+        fprintf(stderr, "Binary AT does not fit in %zu bytes\n", sizeof(at_bin));
+        return NULL;
+    }
+    compute_hmac_raw(at_bin, at_len - AT_BIN_MAC_LEN, at_bin + at_len - AT_BIN_MAC_LEN);
+
+    printf("AT Payload Sent: binary v%d, %zu bytes\n", at_bin[0] & 0x0F, at_len);
+    printf("🆔 msg_id = %d\n", msg_id);
+
+    save_msg_id(msg_id + 1);
+
+    *len = at_len;
+    return at_bin;
+}
+
+// ---- Property AT Generation ----
+// Carries the token as MQTT v5 user properties so the payload is sent as-is.
+// The MAC covers b, c, msg_id, the publish topic, kid (empty if unset), pd
+// (hex SHA-256 of the payload) and S, each NUL-terminated, matching the
+// plugin's property token mode.
+mosquitto_property* generate_at_props(struct client *cli)
+{
+    mosquitto_property *props = NULL;
+    char pd_hex[TRUST_DIGEST_HEX_LEN+1];
+    char hmac_hex[EVP_MAX_MD_SIZE*2+1];
+    char msg_id_str[16];
+    int msg_id = load_last_msg_id();
+
+    if (!trust_digest_hex(cli->message, strlen(cli->message), pd_hex)) {
+        return NULL;
+    }
+    snprintf(msg_id_str, sizeof(msg_id_str), "%d", msg_id);
+
+    const char *fields[] = { cli->issuer_broker, cli->client_id, msg_id_str, cli->publish_topic,
+                             hmac_kid() ? hmac_kid() : "", pd_hex, cli->issuer_broker };
+    size_t field_count = sizeof(fields) / sizeof(fields[0]);
+    size_t mac_len = 0;
+    for (size_t i = 0; i < field_count; i++) mac_len += strlen(fields[i]) + 1;
+    char *mac_input = malloc(mac_len);
+    if (!mac_input) return NULL;
+    size_t pos = 0;
+    for (size_t i = 0; i < field_count; i++) {
+        size_t len = strlen(fields[i]) + 1;
+        memcpy(mac_input + pos, fields[i], len);
+        pos += len;
+    }
+    compute_hmac(mac_input, mac_len, hmac_hex);
+    free(mac_input);
+
+    if (mosquitto_property_add_string_pair(&props, MQTT_PROP_USER_PROPERTY, "b", cli->issuer_broker)
+            || mosquitto_property_add_string_pair(&props, MQTT_PROP_USER_PROPERTY, "c", cli->client_id)
+            || mosquitto_property_add_string_pair(&props, MQTT_PROP_USER_PROPERTY, "msg_id", msg_id_str)
+            || mosquitto_property_add_string_pair(&props, MQTT_PROP_USER_PROPERTY, "pd", pd_hex)
+            || mosquitto_property_add_string_pair(&props, MQTT_PROP_USER_PROPERTY, "S", cli->issuer_broker)
+            || (hmac_kid() && mosquitto_property_add_string_pair(&props, MQTT_PROP_USER_PROPERTY, "kid", hmac_kid()))
+            || mosquitto_property_add_string_pair(&props, MQTT_PROP_USER_PROPERTY, "hmac", hmac_hex)) {
+        mosquitto_property_free_all(&props);
+        return NULL;
+    }
+
+    printf("AT Properties Sent: b=%s c=%s pd=%s hmac=%s\n", cli->issuer_broker, cli->client_id, pd_hex, hmac_hex);
+    printf("🆔 msg_id = %d\n", msg_id);
+
+    save_msg_id(msg_id + 1);
+    return props;
+}
+
 // ---- Main Client Runner ----
 void run_client(struct client *cli) {
     int rc;
@@ -194,10 +309,22 @@ void run_client(struct client *cli) {
         return;
     }
 
+    // AT_FORMAT=binary selects the compact binary token instead of JSON,
+    // AT_FORMAT=properties sends the token as MQTT v5 user properties.
+    const char *at_format = getenv("AT_FORMAT");
+    bool use_props = at_format && strcmp(at_format, "properties") == 0;
+    if (use_props) {
+        mosquitto_int_option(cli->mosq, MOSQ_OPT_PROTOCOL_VERSION, MQTT_PROTOCOL_V5);
+    }
+
     // Set the callback functions
     mosquitto_connect_callback_set(cli->mosq, on_connect);
     mosquitto_publish_callback_set(cli->mosq, on_publish);
-    mosquitto_message_callback_set(cli->mosq, on_message);
+    if (use_props) {
+        mosquitto_message_v5_callback_set(cli->mosq, on_message_v5);
+    } else {
+        mosquitto_message_callback_set(cli->mosq, on_message);
+    }
 
     // Connect to the broker with the appropriate address and port
     rc = mosquitto_connect(cli->mosq, broker_address, broker_port, 60);
@@ -214,11 +341,30 @@ void run_client(struct client *cli) {
     // Wait for a short time to let the subscription happen
     sleep(1);
 
-    // Generate the Authorization Token (AT) with HMAC
-    char *at = generate_at(cli);
+    // Generate the Authorization Token (AT) with HMAC.
+    void *at;
+    size_t at_len = 0;
+    mosquitto_property *at_props = NULL;
+    if (use_props) {
+        at_props = generate_at_props(cli);
+        at = at_props ? cli->message : NULL;
+        at_len = strlen(cli->message);
+    } else if (at_format && strcmp(at_format, "binary") == 0) {
+        at = generate_at_bin(cli, &at_len);
+    } else {
+        at = generate_at(cli);
+        at_len = strlen(at);
+    }
+    if (!at) {
+        mosquitto_loop_stop(cli->mosq, true);
+        mosquitto_destroy(cli->mosq);
+        mosquitto_lib_cleanup();
+        return;
+    }
 
     // Publish a message with the AT
-    rc = mosquitto_publish(cli->mosq, NULL, cli->publish_topic, strlen(at), at, 0, false);
+    rc = mosquitto_publish_v5(cli->mosq, NULL, cli->publish_topic, (int)at_len, at, 0, false, at_props);
+    mosquitto_property_free_all(&at_props);
         // [NEW] Print timestamp immediately after publishing
     // [MODIFIED] Use high-precision timer for more accurate logging
     if (rc == MOSQ_ERR_SUCCESS) {
@@ -3,6 +3,7 @@
 #ifndef CLIENT_COMMON_H
 #define CLIENT_COMMON_H
 
+#include <stddef.h>
 #include <mosquitto.h>
 
 // Define the client structure to hold all client-specific information
@@ -19,7 +20,11 @@ struct client {
 void on_connect(struct mosquitto *mosq, void *obj, int rc);
 void on_publish(struct mosquitto *mosq, void *obj, int mid);
 void on_message(struct mosquitto *mosq, void *obj, const struct mosquitto_message *msg);
+void on_message_v5(struct mosquitto *mosq, void *obj, const struct mosquitto_message *msg,
+                   const mosquitto_property *props);
 char* generate_at(struct client *cli);
+unsigned char* generate_at_bin(struct client *cli, size_t *len);
+mosquitto_property* generate_at_props(struct client *cli);
 void run_client(struct client *cli);
 
 #endif // CLIENT_COMMON_H
@@ -0,0 +1,46 @@
+// trust_digest.c - payload digest of property tokens (see trust_digest.h)
+
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/evp.h>
+#include <mqtt_protocol.h>
+#include "trust_digest.h"
+
+bool trust_digest_hex(const void *payload, size_t len, char *hex_out) {
+    static const char hex_digits[] = "0123456789abcdef";
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    if (!EVP_Digest(payload, len, digest, &digest_len, EVP_sha256(), NULL) || digest_len * 2 != TRUST_DIGEST_HEX_LEN) {
+        return false;
+    }
+    for (unsigned int i = 0; i < digest_len; i++) {
+        hex_out[i * 2] = hex_digits[digest[i] >> 4];
+        hex_out[i * 2 + 1] = hex_digits[digest[i] & 0xF];
+    }
+    hex_out[TRUST_DIGEST_HEX_LEN] = '\0';
+    return true;
+}
+
+bool trust_digest_matches(const void *payload, size_t len, const char *pd_hex) {
+    char computed[TRUST_DIGEST_HEX_LEN + 1];
+    return strlen(pd_hex) == TRUST_DIGEST_HEX_LEN && trust_digest_hex(payload, len, computed)
+        && memcmp(computed, pd_hex, TRUST_DIGEST_HEX_LEN) == 0;
+}
+
+bool trust_digest_props_ok(const mosquitto_property *props, const void *payload, size_t len) {
+    char *name = NULL, *value = NULL;
+    const mosquitto_property *p = mosquitto_property_read_string_pair(props, MQTT_PROP_USER_PROPERTY, &name, &value, false);
+    while (p) {
+        bool is_pd = strcmp(name, "pd") == 0;
+        free(name);
+        if (is_pd) {
+            bool ok = trust_digest_matches(payload, len, value);
+            free(value);
+            return ok;
+        }
+        free(value);
+        name = value = NULL;
+        p = mosquitto_property_read_string_pair(p, MQTT_PROP_USER_PROPERTY, &name, &value, true);
+    }
+    return true;
+}
@@ -0,0 +1,24 @@
+// trust_digest.h
+//
+// Payload digest ("pd") carried by property tokens: the lowercase hex SHA-256
+// of the message payload. The publisher computes it once, the origin broker
+// and the subscribers check it; hops in between only MAC the hex string.
+
+#ifndef TRUST_DIGEST_H
+#define TRUST_DIGEST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <mosquitto.h>
+
+#define TRUST_DIGEST_HEX_LEN 64
+
+// `hex_out` receives TRUST_DIGEST_HEX_LEN characters and a NUL.
+bool trust_digest_hex(const void *payload, size_t len, char *hex_out);
+bool trust_digest_matches(const void *payload, size_t len, const char *pd_hex);
+
+// Checks the payload against the "pd" user property. Messages without one
+// pass, since they carry no property token.
+bool trust_digest_props_ok(const mosquitto_property *props, const void *payload, size_t len);
+
+#endif // TRUST_DIGEST_H
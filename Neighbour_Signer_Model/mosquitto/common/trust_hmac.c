@@ -0,0 +1,198 @@
+// trust_hmac.c - pre-keyed HMAC-SHA256 (see trust_hmac.h)
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include "trust_hmac.h"
+#include "trust_sha256_mb.h"
+
+// Midstates after absorbing (key ^ ipad) and (key ^ opad), as EVP contexts and
+// as raw SHA-256 chaining values for trust_hmac_batch(). Read-only once built.
+struct trust_hmac_key {
+    EVP_MD_CTX *inner_template;
+    EVP_MD_CTX *outer_template;
+    uint32_t inner_midstate[8];
+    uint32_t outer_midstate[8];
+};
+
+// The key set by trust_hmac_init().
+static trust_hmac_key_t *default_key = NULL;
+
+// Per-thread scratch contexts the templates are copied into for each MAC.
+static __thread EVP_MD_CTX *inner_work = NULL;
+static __thread EVP_MD_CTX *outer_work = NULL;
+
+// Per-thread padded copies of a batch's inputs, grown as needed.
+static __thread unsigned char *batch_blocks = NULL;
+static __thread size_t batch_blocks_cap = 0;
+static __thread sha256_lane_t *batch_lanes = NULL;
+static __thread int batch_lanes_cap = 0;
+
+trust_hmac_key_t *trust_hmac_key_new(const void *key, size_t key_len) {
+    unsigned char block[SHA256_BLOCK_LEN] = {0};
+    unsigned char pad[SHA256_BLOCK_LEN];
+    unsigned int digest_len = 0;
+    bool ok = false;
+
+    if (key_len > SHA256_BLOCK_LEN) {
+        if (!EVP_Digest(key, key_len, block, &digest_len, EVP_sha256(), NULL)) return NULL;
+    } else {
+        memcpy(block, key, key_len);
+    }
+
+    trust_hmac_key_t *k = calloc(1, sizeof(*k));
+    if (k) {
+        k->inner_template = EVP_MD_CTX_new();
+        k->outer_template = EVP_MD_CTX_new();
+    }
+    if (k && k->inner_template && k->outer_template) {
+        for (int i = 0; i < SHA256_BLOCK_LEN; i++) pad[i] = block[i] ^ 0x36;
+        ok = EVP_DigestInit_ex(k->inner_template, EVP_sha256(), NULL) && EVP_DigestUpdate(k->inner_template, pad, sizeof(pad));
+        memcpy(k->inner_midstate, sha256_initial_state, sizeof(k->inner_midstate));
+        sha256_compress(k->inner_midstate, pad, 1);
+        for (int i = 0; i < SHA256_BLOCK_LEN; i++) pad[i] = block[i] ^ 0x5c;
+        ok = ok && EVP_DigestInit_ex(k->outer_template, EVP_sha256(), NULL) && EVP_DigestUpdate(k->outer_template, pad, sizeof(pad));
+        memcpy(k->outer_midstate, sha256_initial_state, sizeof(k->outer_midstate));
+        sha256_compress(k->outer_midstate, pad, 1);
+        sha256_mb_kernel(); // pick the kernel now rather than racing on first use
+    }
+    OPENSSL_cleanse(block, sizeof(block));
+    OPENSSL_cleanse(pad, sizeof(pad));
+    if (!ok) {
+        trust_hmac_key_free(k);
+        return NULL;
+    }
+    return k;
+}
+
+void trust_hmac_key_free(trust_hmac_key_t *key) {
+    if (!key) return;
+    EVP_MD_CTX_free(key->inner_template);
+    EVP_MD_CTX_free(key->outer_template);
+    OPENSSL_cleanse(key, sizeof(*key));
+    free(key);
+}
+
+bool trust_hmac_init(const void *key, size_t key_len) {
+    trust_hmac_cleanup();
+    default_key = trust_hmac_key_new(key, key_len);
+    return default_key != NULL;
+}
+
+void trust_hmac_cleanup(void) {
+    trust_hmac_key_free(default_key);
+    default_key = NULL;
+}
+
+size_t trust_hmac(const hmac_span_t *spans, int span_count, unsigned char *mac_out) {
+    return trust_hmac_keyed(default_key, spans, span_count, mac_out);
+}
+
+size_t trust_hmac_keyed(const trust_hmac_key_t *key, const hmac_span_t *spans, int span_count, unsigned char *mac_out) {
+    unsigned char inner_hash[TRUST_HMAC_LEN];
+    unsigned int len = 0;
+
+    if (!key) return 0;
+    if (!inner_work) inner_work = EVP_MD_CTX_new();
+    if (!outer_work) outer_work = EVP_MD_CTX_new();
+    if (!inner_work || !outer_work) return 0;
+
+    if (!EVP_MD_CTX_copy_ex(inner_work, key->inner_template)) return 0;
+    for (int i = 0; i < span_count; i++) {
+        EVP_DigestUpdate(inner_work, spans[i].data, spans[i].len);
+    }
+    EVP_DigestFinal_ex(inner_work, inner_hash, &len);
+
+    if (!EVP_MD_CTX_copy_ex(outer_work, key->outer_template)) return 0;
+    EVP_DigestUpdate(outer_work, inner_hash, len);
+    EVP_DigestFinal_ex(outer_work, mac_out, &len);
+    return len;
+}
+
+static size_t padded_blocks(size_t len) {
+    return (len + 9 + SHA256_BLOCK_LEN - 1) / SHA256_BLOCK_LEN;
+}
+
+// Ends a message of `len` bytes (after the 64-byte pad block) whose padded
+// blocks start at `blocks`: 0x80, zeros, then the bit length big-endian.
+static void pad_message(unsigned char *blocks, size_t len) {
+    size_t total = padded_blocks(len) * SHA256_BLOCK_LEN;
+    uint64_t bits = (uint64_t)(SHA256_BLOCK_LEN + len) * 8;
+    blocks[len] = 0x80;
+    memset(blocks + len + 1, 0, total - len - 1);
+    for (size_t i = 0; i < 8; i++) blocks[total - 1 - i] = (unsigned char)(bits >> (8 * i));
+}
+
+static void store_be32(unsigned char *out, const uint32_t *words, int count) {
+    for (int i = 0; i < count; i++) {
+        out[4 * i] = (unsigned char)(words[i] >> 24);
+        out[4 * i + 1] = (unsigned char)(words[i] >> 16);
+        out[4 * i + 2] = (unsigned char)(words[i] >> 8);
+        out[4 * i + 3] = (unsigned char)words[i];
+    }
+}
+
+/**
+ * HMAC-SHA256 of every job, two multi-buffer passes in all: the inner hashes
+ * of all inputs side by side, then the outer hashes, which are always a single
+ * block each. Jobs may use different keys. Returns false if a job has no key
+ * or scratch space ran out.
+ */
+bool trust_hmac_batch(const hmac_job_t *jobs, int job_count) {
+    for (int j = 0; j < job_count; j++) {
+        if (!jobs[j].key && !default_key) return false;
+    }
+    if (job_count <= 0) return true;
+
+    size_t total = 0;
+    for (int j = 0; j < job_count; j++) {
+        size_t len = 0;
+        for (int i = 0; i < jobs[j].span_count; i++) len += jobs[j].spans[i].len;
+        total += padded_blocks(len) * SHA256_BLOCK_LEN;
+    }
+    if (total > batch_blocks_cap) {
+        unsigned char *grown = realloc(batch_blocks, total);
+        if (!grown) return false;
+        batch_blocks = grown;
+        batch_blocks_cap = total;
+    }
+    if (job_count > batch_lanes_cap) {
+        sha256_lane_t *grown = realloc(batch_lanes, (size_t)job_count * sizeof(*grown));
+        if (!grown) return false;
+        batch_lanes = grown;
+        batch_lanes_cap = job_count;
+    }
+
+    unsigned char *p = batch_blocks;
+    for (int j = 0; j < job_count; j++) {
+        size_t len = 0;
+        for (int i = 0; i < jobs[j].span_count; i++) {
+            memcpy(p + len, jobs[j].spans[i].data, jobs[j].spans[i].len);
+            len += jobs[j].spans[i].len;
+        }
+        pad_message(p, len);
+        const trust_hmac_key_t *key = jobs[j].key ? jobs[j].key : default_key;
+        memcpy(batch_lanes[j].state, key->inner_midstate, sizeof(key->inner_midstate));
+        batch_lanes[j].data = p;
+        batch_lanes[j].blocks = padded_blocks(len);
+        p += batch_lanes[j].blocks * SHA256_BLOCK_LEN;
+    }
+    sha256_mb(batch_lanes, job_count);
+
+    // Every inner input took at least one block, so the outer blocks fit.
+    for (int j = 0; j < job_count; j++) {
+        unsigned char *block = batch_blocks + (size_t)j * SHA256_BLOCK_LEN;
+        store_be32(block, batch_lanes[j].state, 8);
+        pad_message(block, TRUST_HMAC_LEN);
+        const trust_hmac_key_t *key = jobs[j].key ? jobs[j].key : default_key;
+        memcpy(batch_lanes[j].state, key->outer_midstate, sizeof(key->outer_midstate));
+        batch_lanes[j].data = block;
+        batch_lanes[j].blocks = 1;
+    }
+    sha256_mb(batch_lanes, job_count);
+
+    for (int j = 0; j < job_count; j++) store_be32(jobs[j].mac_out, batch_lanes[j].state, 8);
+    return true;
+}
@@ -0,0 +1,45 @@
+// trust_hmac.h
+//
+// Pre-keyed HMAC-SHA256 shared by the clients and the trust plugin.
+// The key's inner and outer pad blocks are hashed once in trust_hmac_init();
+// every MAC then starts from copies of those SHA-256 midstates instead of
+// re-deriving them from the key. trust_hmac_key_new() prepares further keys the
+// same way; a prepared key is read-only and can be shared between threads.
+//
+// trust_hmac_batch() MACs several independent inputs at once through the
+// multi-buffer SHA-256 kernels in trust_sha256_mb.c.
+
+#ifndef TRUST_HMAC_H
+#define TRUST_HMAC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define TRUST_HMAC_LEN 32
+
+// One contiguous piece of MAC input; a MAC covers the spans back to back.
+typedef struct { const void *data; size_t len; } hmac_span_t;
+
+typedef struct trust_hmac_key trust_hmac_key_t;
+
+trust_hmac_key_t *trust_hmac_key_new(const void *key, size_t key_len);
+void trust_hmac_key_free(trust_hmac_key_t *key);
+size_t trust_hmac_keyed(const trust_hmac_key_t *key, const hmac_span_t *spans, int span_count, unsigned char *mac_out);
+
+// The process-wide default key, for callers that only ever use one.
+bool trust_hmac_init(const void *key, size_t key_len);
+void trust_hmac_cleanup(void);
+size_t trust_hmac(const hmac_span_t *spans, int span_count, unsigned char *mac_out);
+
+// One input of a batch; mac_out receives TRUST_HMAC_LEN bytes. A NULL key
+// means the trust_hmac_init() key.
+typedef struct {
+    const hmac_span_t *spans;
+    int span_count;
+    unsigned char *mac_out;
+    const trust_hmac_key_t *key;
+} hmac_job_t;
+
+bool trust_hmac_batch(const hmac_job_t *jobs, int job_count);
+
+#endif // TRUST_HMAC_H
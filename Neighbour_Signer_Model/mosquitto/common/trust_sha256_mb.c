@@ -0,0 +1,245 @@
+// trust_sha256_mb.c - multi-buffer SHA-256 compression (see trust_sha256_mb.h)
+//
+// The wide kernels keep lane i of every vector for message i, so one pass of
+// the 64 rounds advances 8 or 16 messages at once. Messages of different
+// lengths share the pass: a lane that has run out of blocks keeps its previous
+// state through a mask. All kernels share the round code below, written once
+// over GCC vector extensions so the same text compiles to scalar, AVX2 or
+// AVX-512 instructions depending on the lane type.
+
+#include <string.h>
+
+#include "trust_sha256_mb.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SHA256_MB_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+const uint32_t sha256_initial_state[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static const uint32_t sha256_k[64] __attribute__((aligned(16))) = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+// Stands in for the blocks of lanes that have already finished.
+static const unsigned char zero_block[SHA256_BLOCK_LEN];
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+// One block of rounds on state s[8] with message words w[16] (overwritten by
+// the schedule). V is uint32_t or a vector of uint32_t.
+#define SHA256_ROUNDS(V, s, w) do { \
+    V a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7]; \
+    for (int t = 0; t < 64; t++) { \
+        if (t >= 16) { \
+            V w1 = w[(t + 1) & 15], w14 = w[(t + 14) & 15]; \
+            w[t & 15] += (ROTR(w1, 7) ^ ROTR(w1, 18) ^ (w1 >> 3)) + w[(t + 9) & 15] \
+                       + (ROTR(w14, 17) ^ ROTR(w14, 19) ^ (w14 >> 10)); \
+        } \
+        V t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[t] + w[t & 15]; \
+        V t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) | (c & (a | b))); \
+        h = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2; \
+    } \
+    s[0] += a; s[1] += b; s[2] += c; s[3] += d; s[4] += e; s[5] += f; s[6] += g; s[7] += h; \
+} while (0)
+
+static inline uint32_t load_be32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+void sha256_compress(uint32_t state[8], const unsigned char *data, size_t blocks) {
+    uint32_t w[16];
+    for (; blocks > 0; blocks--, data += SHA256_BLOCK_LEN) {
+        for (int t = 0; t < 16; t++) w[t] = load_be32(data + 4 * t);
+        SHA256_ROUNDS(uint32_t, state, w);
+    }
+}
+
+static void sha256_lanes_scalar(sha256_lane_t *lanes, int lane_count) {
+    for (int i = 0; i < lane_count; i++) sha256_compress(lanes[i].state, lanes[i].data, lanes[i].blocks);
+}
+
+#ifdef SHA256_MB_X86
+
+typedef uint32_t u32x8 __attribute__((vector_size(32)));
+typedef uint32_t u32x16 __attribute__((vector_size(64)));
+
+// Body of a wide kernel: `width` lanes of type V. Each block's words are
+// transposed into w_in (word t of lane i at w_in[t][i]) before the rounds.
+#define SHA256_MB_KERNEL_BODY(V, width) do { \
+    uint32_t w_in[16][width] __attribute__((aligned(sizeof(V)))); \
+    uint32_t s_in[8][width] __attribute__((aligned(sizeof(V)))); \
+    uint32_t remaining[width] __attribute__((aligned(sizeof(V)))); \
+    const unsigned char *data[width]; \
+    size_t max_blocks = 0; \
+    memset(s_in, 0, sizeof(s_in)); \
+    for (int i = 0; i < width; i++) { \
+        size_t blocks = i < lane_count ? lanes[i].blocks : 0; \
+        remaining[i] = (uint32_t)blocks; \
+        data[i] = i < lane_count ? lanes[i].data : zero_block; \
+        if (blocks > max_blocks) max_blocks = blocks; \
+        for (int j = 0; j < 8 && i < lane_count; j++) s_in[j][i] = lanes[i].state[j]; \
+    } \
+    V s[8], live, left; \
+    for (int j = 0; j < 8; j++) memcpy(&s[j], s_in[j], sizeof(V)); \
+    memcpy(&left, remaining, sizeof(V)); \
+    for (size_t b = 0; b < max_blocks; b++) { \
+        for (int i = 0; i < width; i++) { \
+            const unsigned char *p = b < remaining[i] ? data[i] + b * SHA256_BLOCK_LEN : zero_block; \
+            for (int t = 0; t < 16; t++) w_in[t][i] = load_be32(p + 4 * t); \
+        } \
+        V w[16], next[8]; \
+        for (int t = 0; t < 16; t++) memcpy(&w[t], w_in[t], sizeof(V)); \
+        memcpy(next, s, sizeof(next)); \
+        SHA256_ROUNDS(V, next, w); \
+        live = (V)(left > (uint32_t)b); \
+        for (int j = 0; j < 8; j++) s[j] = (next[j] & live) | (s[j] & ~live); \
+    } \
+    for (int j = 0; j < 8; j++) memcpy(s_in[j], &s[j], sizeof(V)); \
+    for (int i = 0; i < lane_count; i++) { \
+        for (int j = 0; j < 8; j++) lanes[i].state[j] = s_in[j][i]; \
+    } \
+} while (0)
+
+__attribute__((target("avx2")))
+static void sha256_x8_avx2(sha256_lane_t *lanes, int lane_count) {
+    SHA256_MB_KERNEL_BODY(u32x8, 8);
+}
+
+__attribute__((target("avx512f")))
+static void sha256_x16_avx512(sha256_lane_t *lanes, int lane_count) {
+    SHA256_MB_KERNEL_BODY(u32x16, 16);
+}
+
+// Single-buffer SHA-NI: two rounds per sha256rnds2, the schedule in
+// sha256msg1/sha256msg2. The state is kept as ABEF/CDGH as the instructions
+// expect.
+__attribute__((target("sha,sse4.1")))
+static void sha256_compress_shani(uint32_t state[8], const unsigned char *data, size_t blocks) {
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+    __m128i s1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+    __m128i s0 = _mm_alignr_epi8(tmp, s1, 8);
+    s1 = _mm_blend_epi16(s1, tmp, 0xF0);
+
+    for (; blocks > 0; blocks--, data += SHA256_BLOCK_LEN) {
+        __m128i abef = s0, cdgh = s1, m[4];
+        for (int g = 0; g < 16; g++) {
+            __m128i w;
+            if (g < 4) {
+                w = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16 * g)), bswap);
+            } else {
+                w = _mm_add_epi32(_mm_sha256msg1_epu32(m[g & 3], m[(g + 1) & 3]),
+                                  _mm_alignr_epi8(m[(g + 3) & 3], m[(g + 2) & 3], 4));
+                w = _mm_sha256msg2_epu32(w, m[(g + 3) & 3]);
+            }
+            m[g & 3] = w;
+            __m128i wk = _mm_add_epi32(w, _mm_load_si128((const __m128i *)&sha256_k[4 * g]));
+            s1 = _mm_sha256rnds2_epu32(s1, s0, wk);
+            s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(wk, 0x0E));
+        }
+        s0 = _mm_add_epi32(s0, abef);
+        s1 = _mm_add_epi32(s1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(s0, 0x1B);
+    s1 = _mm_shuffle_epi32(s1, 0xB1);
+    _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, s1, 0xF0));
+    _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(s1, tmp, 8));
+}
+
+static void sha256_lanes_shani(sha256_lane_t *lanes, int lane_count) {
+    for (int i = 0; i < lane_count; i++) sha256_compress_shani(lanes[i].state, lanes[i].data, lanes[i].blocks);
+}
+
+static bool cpu_has_shani(void) {
+    unsigned int eax, ebx, ecx, edx;
+    return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & (1u << 29)) && __builtin_cpu_supports("sse4.1");
+}
+
+#endif // SHA256_MB_X86
+
+typedef void (*sha256_lanes_fn)(sha256_lane_t *lanes, int lane_count);
+
+typedef struct {
+    const char *name;
+    int width;              // lanes per call; 1 for single-buffer kernels
+    sha256_lanes_fn fn;
+} sha256_kernel_t;
+
+// Fastest first, per MAC on full batches of ~200-byte tokens: AVX-512 beats
+// SHA-NI, which beats 8-lane AVX2 (see bench_hmac).
+static const sha256_kernel_t kernels[] = {
+#ifdef SHA256_MB_X86
+    { "avx512", 16, sha256_x16_avx512 },
+    { "shani", 1, sha256_lanes_shani },
+    { "avx2", 8, sha256_x8_avx2 },
+#endif
+    { "scalar", 1, sha256_lanes_scalar },
+};
+#define KERNEL_COUNT (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+static const sha256_kernel_t *wide_kernel = NULL;    // for full batches
+static const sha256_kernel_t *single_kernel = NULL;  // for the leftover lanes
+
+static bool kernel_supported(const sha256_kernel_t *k) {
+#ifdef SHA256_MB_X86
+    if (strcmp(k->name, "avx512") == 0) return __builtin_cpu_supports("avx512f");
+    if (strcmp(k->name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+    if (strcmp(k->name, "shani") == 0) return cpu_has_shani();
+#endif
+    return true;
+}
+
+static void select_kernels(void) {
+    for (int i = 0; i < KERNEL_COUNT; i++) {
+        if (!kernel_supported(&kernels[i])) continue;
+        if (!wide_kernel) wide_kernel = &kernels[i];
+        if (!single_kernel && kernels[i].width == 1) single_kernel = &kernels[i];
+    }
+}
+
+const char *sha256_mb_kernel(void) {
+    if (!wide_kernel) select_kernels();
+    return wide_kernel->name;
+}
+
+bool sha256_mb_select(const char *name) {
+    if (!wide_kernel) select_kernels();
+    for (int i = 0; i < KERNEL_COUNT; i++) {
+        if (strcmp(kernels[i].name, name) != 0 || !kernel_supported(&kernels[i])) continue;
+        wide_kernel = &kernels[i];
+        if (kernels[i].width == 1) single_kernel = &kernels[i];
+        return true;
+    }
+    return false;
+}
+
+void sha256_mb(sha256_lane_t *lanes, int lane_count) {
+    if (!wide_kernel) select_kernels();
+    const sha256_kernel_t *k = wide_kernel;
+    // A wide pass costs about as much whether its lanes are full or not. SHA-NI
+    // keeps up with a partly filled one, so next to it the wide kernel only
+    // takes batches that fill most of its lanes; next to scalar it takes any
+    // batch that fills a quarter.
+    int min_lanes = strcmp(single_kernel->name, "scalar") == 0 ? k->width / 4 : k->width * 3 / 4;
+    if (min_lanes < 2) min_lanes = 2;
+    while (lane_count > 0 && k->width > 1 && lane_count >= min_lanes) {
+        int n = lane_count < k->width ? lane_count : k->width;
+        k->fn(lanes, n);
+        lanes += n;
+        lane_count -= n;
+    }
+    if (lane_count > 0) single_kernel->fn(lanes, lane_count);
+}
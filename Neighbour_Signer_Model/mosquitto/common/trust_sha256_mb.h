@@ -0,0 +1,38 @@
+// trust_sha256_mb.h
+//
+// Multi-buffer SHA-256 compression for batches of short, independent messages.
+// Each lane carries its own chaining state and a run of already padded 64-byte
+// blocks; sha256_mb() advances every lane through all of its blocks. On x86-64
+// the kernel is picked at runtime: AVX-512 (16 lanes) or AVX2 (8 lanes) for
+// wide batches, SHA-NI one lane at a time, then a portable scalar loop.
+//
+// This only runs the compression function. Padding and the initial state are
+// the caller's job (see trust_hmac_batch() for the HMAC use).
+
+#ifndef TRUST_SHA256_MB_H
+#define TRUST_SHA256_MB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_BLOCK_LEN 64
+
+typedef struct {
+    uint32_t state[8];
+    const unsigned char *data;      // blocks * SHA256_BLOCK_LEN bytes
+    size_t blocks;
+} sha256_lane_t;
+
+extern const uint32_t sha256_initial_state[8];
+
+void sha256_mb(sha256_lane_t *lanes, int lane_count);
+void sha256_compress(uint32_t state[8], const unsigned char *data, size_t blocks);
+
+// Name of the kernel sha256_mb() uses for wide batches ("avx512", "avx2",
+// "shani" or "scalar"). sha256_mb_select() forces one, for benchmarks; it
+// returns false if the CPU doesn't support it.
+const char *sha256_mb_kernel(void);
+bool sha256_mb_select(const char *name);
+
+#endif // TRUST_SHA256_MB_H
@@ -0,0 +1,172 @@
+// trust_token.c - encoder/decoder for the binary Access Token (see trust_token.h)
+
+#include <string.h>
+#include "trust_token.h"
+
+static uint16_t get_u16(const uint8_t *p) { return (uint16_t)((p[0] << 8) | p[1]); }
+static uint32_t get_u32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+static void put_u16(uint8_t *p, uint16_t v) { p[0] = (uint8_t)(v >> 8); p[1] = (uint8_t)v; }
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16); p[2] = (uint8_t)(v >> 8); p[3] = (uint8_t)v;
+}
+
+bool at_bin_is_binary(const void *buf, size_t len) {
+    return buf && len >= AT_BIN_HEADER_LEN + AT_BIN_MAC_LEN && ((const uint8_t *)buf)[0] == AT_BIN_VERSION_1;
+}
+
+bool at_bin_parse(const void *buf, size_t len, at_bin_view_t *view) {
+    const uint8_t *p = buf;
+    if (!at_bin_is_binary(buf, len)) return false;
+
+    memset(view, 0, sizeof(*view));
+    view->buf = p;
+    view->len = len;
+    view->broker_count = p[1];
+    view->signer_count = p[2];
+    view->issuer = p[3];
+    view->msg_id = get_u32(p + 4);
+    view->fields_len = get_u16(p + 8);
+    view->mac = p + len - AT_BIN_MAC_LEN;
+
+    size_t body_len = len - AT_BIN_HEADER_LEN - AT_BIN_MAC_LEN;
+    if (view->fields_len + view->signer_count > body_len) return false;
+    view->fields = view->mac - view->fields_len;
+    view->signers = view->fields - view->signer_count;
+    view->broker_table = p + AT_BIN_HEADER_LEN;
+
+    // The broker table must exactly fill the space up to the signer list.
+    const uint8_t *q = view->broker_table;
+    for (int i = 0; i < view->broker_count; i++) {
+        if (q >= view->signers || q + 1 + q[0] > view->signers) return false;
+        q += 1 + q[0];
+    }
+    if (q != view->signers) return false;
+    if (view->issuer >= view->broker_count) return false;
+    for (int i = 0; i < view->signer_count; i++) {
+        if (view->signers[i] >= view->broker_count) return false;
+    }
+
+    // Field TLVs must exactly fill the field block.
+    q = view->fields;
+    while (q < view->mac) {
+        if (q + 3 > view->mac || q + 3 + get_u16(q + 1) > view->mac) return false;
+        q += 3 + get_u16(q + 1);
+    }
+    return true;
+}
+
+bool at_bin_broker(const at_bin_view_t *view, uint8_t index, const char **name, size_t *name_len) {
+    if (index >= view->broker_count) return false;
+    const uint8_t *q = view->broker_table;
+    for (uint8_t i = 0; i < index; i++) q += 1 + q[0];
+    *name = (const char *)(q + 1);
+    *name_len = q[0];
+    return true;
+}
+
+int at_bin_find_broker(const at_bin_view_t *view, const char *name) {
+    size_t name_len = strlen(name);
+    const uint8_t *q = view->broker_table;
+    for (int i = 0; i < view->broker_count; i++) {
+        if (q[0] == name_len && memcmp(q + 1, name, name_len) == 0) return i;
+        q += 1 + q[0];
+    }
+    return -1;
+}
+
+bool at_bin_field(const at_bin_view_t *view, uint8_t tag, const char **value, size_t *value_len) {
+    const uint8_t *q = view->fields;
+    while (q < view->mac) {
+        uint16_t len = get_u16(q + 1);
+        if (q[0] == tag) {
+            *value = (const char *)(q + 3);
+            *value_len = len;
+            return true;
+        }
+        q += 3 + len;
+    }
+    return false;
+}
+
+static uint8_t *put_field(uint8_t *p, const uint8_t *end, uint8_t tag, const char *value) {
+    size_t len = value ? strlen(value) : 0;
+    if (!p || len > 0xFFFF || (size_t)(end - p) < 3 + len) return NULL;
+    p[0] = tag;
+    put_u16(p + 1, (uint16_t)len);
+    memcpy(p + 3, value, len);
+    return p + 3 + len;
+}
+
+size_t at_bin_encode(uint8_t *out, size_t out_size, const char *issuer, const char *client_id,
+                     const char *pub_topic, const char *sub_topic, const char *msg, uint32_t msg_id,
+                     const char *kid) {
+    size_t issuer_len = strlen(issuer);
+    const uint8_t *end = out + out_size;
+    if (issuer_len > 255 || out_size < AT_BIN_HEADER_LEN + 1 + issuer_len + 1 + AT_BIN_MAC_LEN) return 0;
+
+    out[0] = AT_BIN_VERSION_1;
+    out[1] = 1;     // broker table: just the issuer
+    out[2] = 1;     // signer list: just the issuer
+    out[3] = 0;
+    put_u32(out + 4, msg_id);
+
+    uint8_t *p = out + AT_BIN_HEADER_LEN;
+    *p++ = (uint8_t)issuer_len;
+    memcpy(p, issuer, issuer_len);
+    p += issuer_len;
+    *p++ = 0;
+
+    uint8_t *fields = p;
+    p = put_field(p, end, AT_BIN_TAG_CLIENT, client_id);
+    p = put_field(p, end, AT_BIN_TAG_PUB_TOPIC, pub_topic);
+    p = put_field(p, end, AT_BIN_TAG_SUB_TOPIC, sub_topic);
+    p = put_field(p, end, AT_BIN_TAG_MSG, msg);
+    if (kid) p = put_field(p, end, AT_BIN_TAG_KID, kid);
+    if (!p || (size_t)(end - p) < AT_BIN_MAC_LEN || p - fields > 0xFFFF) return 0;
+    put_u16(out + 8, (uint16_t)(p - fields));
+
+    memset(p, 0, AT_BIN_MAC_LEN);
+    return (size_t)(p - out) + AT_BIN_MAC_LEN;
+}
+
+bool at_bin_plan_append(const at_bin_view_t *view, const char *signer, at_bin_append_t *plan) {
+    size_t signer_len = strlen(signer);
+    int index = at_bin_find_broker(view, signer);
+
+    if (view->signer_count >= AT_BIN_MAX_SIGNERS) return false;
+    plan->table_entry_len = 0;
+    plan->table_off = (size_t)(view->signers - view->buf);
+    if (index < 0) {
+        if (view->broker_count >= AT_BIN_MAX_BROKERS || signer_len > 255) return false;
+        plan->table_entry[0] = (uint8_t)signer_len;
+        memcpy(plan->table_entry + 1, signer, signer_len);
+        plan->table_entry_len = 1 + signer_len;
+        index = view->broker_count;
+    }
+    plan->signer_index = (uint8_t)index;
+    plan->signer_off = (size_t)(view->fields - view->buf);
+    plan->new_len = view->len + plan->table_entry_len + 1;
+    return true;
+}
+
+void at_bin_write_append(const at_bin_view_t *view, const at_bin_append_t *plan, uint8_t *out) {
+    const uint8_t *in = view->buf;
+    size_t mac_off = view->len - AT_BIN_MAC_LEN;
+    uint8_t *p = out;
+
+    memcpy(p, in, plan->table_off);
+    p += plan->table_off;
+    memcpy(p, plan->table_entry, plan->table_entry_len);
+    p += plan->table_entry_len;
+    memcpy(p, in + plan->table_off, plan->signer_off - plan->table_off);
+    p += plan->signer_off - plan->table_off;
+    *p++ = plan->signer_index;
+    memcpy(p, in + plan->signer_off, mac_off - plan->signer_off);
+    p += mac_off - plan->signer_off;
+    memset(p, 0, AT_BIN_MAC_LEN);
+
+    if (plan->table_entry_len) out[1]++;
+    out[2]++;
+}
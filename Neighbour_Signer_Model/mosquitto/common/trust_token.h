@@ -0,0 +1,87 @@
+// trust_token.h
+//
+// Compact binary Access Token (AT) format, used alongside the JSON token.
+// A binary token never starts with '{', so receivers tell the two apart
+// from the first byte.
+//
+// Layout (multi-byte integers are big-endian):
+//
+//   0   u8   version       AT_BIN_VERSION_1
+//   1   u8   broker_count  entries in the broker table
+//   2   u8   signer_count  entries in the signer list
+//   3   u8   issuer        broker table index of the issuing broker ("b")
+//   4   u32  msg_id
+//   8   u16  fields_len    size of the field block
+//   10       broker table  broker_count x { u8 len, name }
+//            signer list   signer_count x u8 broker table index ("S")
+//            field block   TLVs { u8 tag, u16 len, value } ("c", "Fp", "Fs", "msg", "kid")
+//   len-32   mac           raw HMAC-SHA256 over bytes [0, len-32)
+//
+// The signer list and field block sit directly in front of the MAC, so both
+// are found from the header and the payload length alone.
+
+#ifndef TRUST_TOKEN_H
+#define TRUST_TOKEN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define AT_BIN_VERSION_1    0xA1
+#define AT_BIN_HEADER_LEN   10
+#define AT_BIN_MAC_LEN      32
+#define AT_BIN_MAX_BROKERS  255
+#define AT_BIN_MAX_SIGNERS  255
+
+enum at_bin_tag {
+    AT_BIN_TAG_CLIENT = 1,
+    AT_BIN_TAG_PUB_TOPIC = 2,
+    AT_BIN_TAG_SUB_TOPIC = 3,
+    AT_BIN_TAG_MSG = 4,
+    AT_BIN_TAG_KID = 5,         // optional; names the signing key
+};
+
+// Read-only view over a binary token; all pointers refer into the payload.
+typedef struct {
+    const uint8_t *buf;
+    size_t len;
+    uint8_t broker_count;
+    uint8_t signer_count;
+    uint8_t issuer;
+    uint32_t msg_id;
+    const uint8_t *broker_table;
+    const uint8_t *signers;
+    const uint8_t *fields;
+    size_t fields_len;
+    const uint8_t *mac;
+} at_bin_view_t;
+
+bool at_bin_is_binary(const void *buf, size_t len);
+bool at_bin_parse(const void *buf, size_t len, at_bin_view_t *view);
+bool at_bin_broker(const at_bin_view_t *view, uint8_t index, const char **name, size_t *name_len);
+int at_bin_find_broker(const at_bin_view_t *view, const char *name);
+bool at_bin_field(const at_bin_view_t *view, uint8_t tag, const char **value, size_t *value_len);
+
+// Writes an unsigned token (MAC bytes zeroed) for a single-signer message,
+// with a "kid" field unless `kid` is NULL. Returns the full token length
+// including the MAC, or 0 if it doesn't fit.
+size_t at_bin_encode(uint8_t *out, size_t out_size, const char *issuer, const char *client_id,
+                     const char *pub_topic, const char *sub_topic, const char *msg, uint32_t msg_id,
+                     const char *kid);
+
+// Describes how to append a signer to an existing token. The new token is the
+// old one (without MAC) with `table_entry` inserted at `table_off` and the
+// signer index inserted at `signer_off`, followed by a fresh MAC.
+typedef struct {
+    uint8_t table_entry[1 + 255];
+    size_t table_entry_len;
+    size_t table_off;
+    uint8_t signer_index;
+    size_t signer_off;
+    size_t new_len;
+} at_bin_append_t;
+
+bool at_bin_plan_append(const at_bin_view_t *view, const char *signer, at_bin_append_t *plan);
+void at_bin_write_append(const at_bin_view_t *view, const at_bin_append_t *plan, uint8_t *out);
+
+#endif // TRUST_TOKEN_H
@@ -194,11 +194,11 @@ PLUGIN_CFLAGS:=$(CFLAGS) -fPIC
 PLUGIN_LDFLAGS:=$(LDFLAGS)
 
 ifneq ($(or $(findstring $(UNAME),FreeBSD), $(findstring $(UNAME),OpenBSD), $(findstring $(UNAME),NetBSD)),)
-	BROKER_LDADD:=$(BROKER_LDADD) -lm
+	BROKER_LDADD:=$(BROKER_LDADD) -lm -pthread
 	BROKER_LDFLAGS:=$(BROKER_LDFLAGS) -Wl,--dynamic-list=linker.syms
 	SEDINPLACE:=-i ""
 else
-	BROKER_LDADD:=$(BROKER_LDADD) -ldl -lm
+	BROKER_LDADD:=$(BROKER_LDADD) -ldl -lm -pthread
 	SEDINPLACE:=-i
 endif
 
@@ -86,6 +86,7 @@ extern "C" {
 /* Enum: mosq_err_t
  * Integer values returned from many libmosquitto functions. */
 enum mosq_err_t {
+	MOSQ_ERR_MESSAGE_PENDING = -5,
 	MOSQ_ERR_AUTH_CONTINUE = -4,
 	MOSQ_ERR_NO_SUBSCRIBERS = -3,
 	MOSQ_ERR_SUB_EXISTS = -2,
@@ -568,6 +568,67 @@ mosq_EXPORT int mosquitto_broker_publish_copy(
 		bool retain,
 		mosquitto_property *properties);
 
+
+/* =========================================================================
+ *
+ * Section: Deferred message verdicts
+ *
+ * ========================================================================= */
+
+/* Function: mosquitto_message_defer
+ *
+ * Ask the broker to hold a message while its verdict is decided elsewhere,
+ * for example on a worker thread.
+ *
+ * This must only be called from within a MOSQ_EVT_MESSAGE callback, using the
+ * event_data passed to that callback. If a ticket is returned, the callback
+ * must return MOSQ_ERR_MESSAGE_PENDING, and the verdict must later be posted
+ * with <mosquitto_message_complete>. Until then the broker holds the message,
+ * and holds back any later messages from the same client so that they are
+ * still processed, and acknowledged, in the order they were received.
+ *
+ * The message topic, payload and properties are only valid for the duration
+ * of the callback. Copy anything the worker needs before returning.
+ *
+ * Pending messages are discarded if the client disconnects, and are denied if
+ * no verdict arrives within a few seconds.
+ *
+ * Parameters:
+ *  event_data - the event_data of the current MOSQ_EVT_MESSAGE callback
+ *
+ * Returns:
+ *   A non-zero ticket on success
+ *   0 - if called outside a message callback, if deferral is not supported
+ *       on this platform, or if too many messages are already pending
+ */
+mosq_EXPORT uint64_t mosquitto_message_defer(const struct mosquitto_evt_message *event_data);
+
+
+/* Function: mosquitto_message_complete
+ *
+ * Post the verdict for a message deferred with <mosquitto_message_defer>.
+ *
+ * This may be called from any thread. The verdict is applied by the broker
+ * main loop, which then runs any message callbacks registered after the one
+ * that deferred.
+ *
+ * Parameters:
+ *  ticket -     the ticket returned by <mosquitto_message_defer>
+ *  result -     MOSQ_ERR_SUCCESS to accept the message. Any other value
+ *               denies it, as if the callback had returned
+ *               MOSQ_ERR_ACL_DENIED.
+ *  payload -    optional replacement payload, or NULL to keep the original.
+ *               Memory remains the property of the calling function.
+ *  payloadlen - length of payload in bytes.
+ *
+ * Returns:
+ *   MOSQ_ERR_SUCCESS - on success
+ *   MOSQ_ERR_INVAL - if ticket is 0, or if payloadlen > 0 and payload is NULL
+ *   MOSQ_ERR_NOMEM - on out of memory
+ *   MOSQ_ERR_NOT_SUPPORTED - if deferral is not supported on this platform
+ */
+mosq_EXPORT int mosquitto_message_complete(uint64_t ticket, int result, const void *payload, uint32_t payloadlen);
+
 #ifdef __cplusplus
 }
 #endif
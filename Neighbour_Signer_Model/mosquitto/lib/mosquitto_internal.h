@@ -294,6 +294,7 @@ struct mosquitto {
 	struct mosquitto__client_sub **subs;
 	char *auth_method;
 	int sub_count;
+	struct mosquitto__pending_msg *pending_msgs;
 #  ifndef WITH_EPOLL
 	int pollfd_index;
 #  endif
@@ -31,6 +31,8 @@ Contributors:
 const char *mosquitto_strerror(int mosq_errno)
 {
 	switch(mosq_errno){
+		case MOSQ_ERR_MESSAGE_PENDING:
+			return "Message verdict pending.";
 		case MOSQ_ERR_AUTH_CONTINUE:
 			return "Continue with authentication.";
 		case MOSQ_ERR_NO_SUBSCRIBERS:
@@ -0,0 +1,218 @@
+/*
+ * Allocation benchmark: heap traffic of the JSON token path, per message.
+ *
+ * Replays the DOM work callback_message does for a canonical JSON token (copy
+ * and parse the payload, drop "hmac", print and MAC the rest, append this
+ * broker to "S", print and MAC again, print the final token and copy it for
+ * the broker) on tokens built the way generate_at() builds them, for routes
+ * of one to five signers. Each route is run with cJSON on plain malloc() and
+ * with the per-message arena from trust_arena.c, counting the calls that
+ * reach the heap.
+ *
+ * Build and run with:
+ *   make bench && ./bench_alloc [iterations]
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <cjson/cJSON.h>
+
+#include "trust_arena.h"
+#include "trust_hmac.h"
+
+#define HMAC_KEY "4c1c4d7e2b9f7a0e8b6d3e5f1a2c7b4d"
+#define VERIFIER "B9"
+
+static const char *route[] = { "B0", "B2", "B4", "B6", "B7" };
+
+static unsigned long heap_allocs = 0;
+static unsigned long heap_frees = 0;
+
+static void *counting_malloc(size_t size) {
+    heap_allocs++;
+    return malloc(size);
+}
+
+static void counting_free(void *ptr) {
+    if (ptr) heap_frees++;
+    free(ptr);
+}
+
+static char *counting_strndup(const char *s, size_t len) {
+    char *copy = counting_malloc(len + 1);
+    if (!copy) return NULL;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+// How the token path gets its own copies: strndup()/free() in the heap run,
+// the arena in the other.
+typedef struct {
+    char *(*strndup)(const char *s, size_t len);
+    void (*free)(void *ptr);
+} copy_ops_t;
+
+static const copy_ops_t heap_ops = { counting_strndup, counting_free };
+static const copy_ops_t arena_ops = { trust_arena_strndup, trust_arena_free };
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void hmac_hex(const char *data, char *out) {
+    static const char hex_digits[] = "0123456789abcdef";
+    unsigned char mac[TRUST_HMAC_LEN];
+    hmac_span_t span = { data, strlen(data) };
+    trust_hmac(&span, 1, mac);
+    for (int i = 0; i < TRUST_HMAC_LEN; i++) {
+        out[i * 2] = hex_digits[mac[i] >> 4];
+        out[i * 2 + 1] = hex_digits[mac[i] & 0xF];
+    }
+    out[TRUST_HMAC_LEN * 2] = '\0';
+}
+
+/**
+ * A token as generate_at() emits it, after the first `signers` brokers of
+ * `route` have signed it. Returned in a malloc()ed buffer.
+ */
+static char *make_token(int signers) {
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "b", route[0]);
+    cJSON_AddStringToObject(root, "c", "C1");
+    cJSON *S = cJSON_CreateArray();
+    for (int i = 0; i < signers; i++) cJSON_AddItemToArray(S, cJSON_CreateString(route[i]));
+    cJSON_AddItemToObject(root, "S", S);
+    cJSON *Fp = cJSON_CreateArray();
+    cJSON_AddItemToArray(Fp, cJSON_CreateString("groundfloor/bathroom"));
+    cJSON_AddItemToObject(root, "Fp", Fp);
+    cJSON *Fs = cJSON_CreateArray();
+    cJSON_AddItemToArray(Fs, cJSON_CreateString("groundfloor/living"));
+    cJSON_AddItemToObject(root, "Fs", Fs);
+    cJSON_AddStringToObject(root, "msg", "Temperature 21.5C, humidity 40%, door closed");
+    cJSON_AddNumberToObject(root, "msg_id", 123456);
+
+    char hmac[TRUST_HMAC_LEN * 2 + 1];
+    char *json_no_hmac = cJSON_PrintUnformatted(root);
+    hmac_hex(json_no_hmac, hmac);
+    cJSON_AddStringToObject(root, "hmac", hmac);
+    char *token = cJSON_PrintUnformatted(root);
+    cJSON_free(json_no_hmac);
+    cJSON_Delete(root);
+    return token;
+}
+
+/**
+ * The plugin's canonical verify and re-sign of one token. Returns the
+ * re-signed token, allocated as the broker would own it, or NULL.
+ */
+static char *process_token(const char *payload, size_t len, const copy_ops_t *ops) {
+    char *payload_copy = ops->strndup(payload, len);
+    cJSON *root = cJSON_Parse(payload_copy);
+    ops->free(payload_copy);
+    if (!root) return NULL;
+
+    cJSON *hmac_field = cJSON_GetObjectItemCaseSensitive(root, "hmac");
+    char *received_hmac = ops->strndup(hmac_field->valuestring, strlen(hmac_field->valuestring));
+    cJSON_DeleteItemFromObject(root, "hmac");
+    char *json_str_for_hmac = cJSON_PrintUnformatted(root);
+    char computed_hmac[TRUST_HMAC_LEN * 2 + 1];
+    hmac_hex(json_str_for_hmac, computed_hmac);
+    bool ok = strcmp(computed_hmac, received_hmac) == 0;
+    ops->free(received_hmac);
+    cJSON_free(json_str_for_hmac);
+    if (!ok) {
+        cJSON_Delete(root);
+        return NULL;
+    }
+
+    cJSON_AddItemToArray(cJSON_GetObjectItemCaseSensitive(root, "S"), cJSON_CreateString(VERIFIER));
+    char *updated_payload_no_hmac = cJSON_PrintUnformatted(root);
+    char new_hmac[TRUST_HMAC_LEN * 2 + 1];
+    hmac_hex(updated_payload_no_hmac, new_hmac);
+    cJSON_AddStringToObject(root, "hmac", new_hmac);
+    char *final_payload = cJSON_PrintUnformatted(root);
+    char *out = counting_strndup(final_payload, strlen(final_payload));   // mosquitto_strdup()
+    cJSON_free(final_payload);
+    cJSON_Delete(root);
+    cJSON_free(updated_payload_no_hmac);
+    return out;
+}
+
+typedef struct { double ns; double allocs; double frees; char *last; } run_t;
+
+static run_t run_heap(const char *token, long iterations) {
+    cJSON_Hooks hooks = { counting_malloc, counting_free };
+    cJSON_InitHooks(&hooks);
+    run_t run = { 0, 0, 0, NULL };
+    unsigned long allocs = heap_allocs, frees = heap_frees;
+    double start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        char *out = process_token(token, strlen(token), &heap_ops);
+        if (i + 1 < iterations) counting_free(out);
+        else run.last = out;
+    }
+    run.ns = (now_ns() - start) / (double)iterations;
+    run.allocs = (double)(heap_allocs - allocs) / (double)iterations;
+    run.frees = (double)(heap_frees - frees) / (double)iterations;
+    cJSON_InitHooks(NULL);
+    return run;
+}
+
+static run_t run_arena(const char *token, long iterations) {
+    if (!trust_arena_install(65536)) {
+        fprintf(stderr, "Could not set up the arena\n");
+        exit(1);
+    }
+    run_t run = { 0, 0, 0, NULL };
+    trust_arena_stats_t before, after;
+    trust_arena_stats(&before);
+    unsigned long allocs = heap_allocs, frees = heap_frees;
+    double start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        trust_arena_begin();
+        char *out = process_token(token, strlen(token), &arena_ops);
+        trust_arena_end();
+        if (i + 1 < iterations) counting_free(out);
+        else run.last = out;
+    }
+    run.ns = (now_ns() - start) / (double)iterations;
+    trust_arena_stats(&after);
+    // Chunks and fallbacks come from malloc() inside the arena; the counters
+    // here only see the payload copies.
+    run.allocs = (double)(heap_allocs - allocs + (after.chunks - before.chunks)
+                          + (after.fallbacks - before.fallbacks)) / (double)iterations;
+    run.frees = (double)(heap_frees - frees) / (double)iterations;
+    trust_arena_uninstall();
+    return run;
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = argc > 1 ? atol(argv[1]) : 200000;
+    if (iterations <= 0) iterations = 1;
+    if (!trust_hmac_init(HMAC_KEY, strlen(HMAC_KEY))) return 1;
+
+    printf("%-8s %6s  %22s  %22s\n", "signers", "bytes", "malloc()", "arena");
+    int failed = 0;
+    for (int signers = 1; signers <= 5; signers++) {
+        char *token = make_token(signers);
+        run_t heap = run_heap(token, iterations);
+        run_t arena = run_arena(token, iterations);
+        if (!heap.last || !arena.last || strcmp(heap.last, arena.last) != 0) {
+            fprintf(stderr, "Re-signed tokens differ for %d signers\n", signers);
+            failed = 1;
+        }
+        printf("%-8d %6zu  %5.1f allocs %7.1f ns  %5.2f allocs %7.1f ns  (%.2fx)\n",
+               signers, strlen(token), heap.allocs, heap.ns, arena.allocs, arena.ns, heap.ns / arena.ns);
+        free(heap.last);
+        free(arena.last);
+        cJSON_free(token);
+    }
+    trust_hmac_cleanup();
+    return failed;
+}
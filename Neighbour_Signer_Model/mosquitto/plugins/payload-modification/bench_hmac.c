@@ -0,0 +1,145 @@
+/*
+ * Microbenchmark: HMAC-SHA256 over a typical Access Token.
+ *
+ * Compares the one-shot HMAC() call the plugin and clients used to make on
+ * every message with the pre-keyed midstate path in common/trust_hmac.c, and
+ * that one-at-a-time path with trust_hmac_batch() for each multi-buffer
+ * SHA-256 kernel the CPU supports.
+ *
+ * Build and run with:
+ *   make bench && ./bench_hmac [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <openssl/hmac.h>
+#include <openssl/evp.h>
+
+#include "trust_hmac.h"
+#include "trust_sha256_mb.h"
+
+#define HMAC_KEY "4c1c4d7e2b9f7a0e8b6d3e5f1a2c7b4d"
+
+// A token as generate_at() emits it on the B0->B2->B4->B6->B7 route, without its
+// "hmac" member (~200 bytes, the size we actually send).
+static const char sample_token[] =
+    "{\"b\":\"B0\",\"c\":\"C1\",\"S\":[\"B0\",\"B2\",\"B4\",\"B6\",\"B7\"],"
+    "\"Fp\":[\"groundfloor/bathroom\"],\"Fs\":[\"groundfloor/living\"],"
+    "\"msg\":\"Temperature 21.5C, humidity 40%, door closed\",\"msg_id\":123456}";
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void report(const char *name, double start, long iterations, double baseline) {
+    double ns = (now_ns() - start) / (double)iterations;
+    if (baseline > 0) {
+        printf("%-28s %8.1f ns/op  (%.2fx)\n", name, ns, baseline / ns);
+    } else {
+        printf("%-28s %8.1f ns/op\n", name, ns);
+    }
+}
+
+#define MAX_BATCH 64
+
+/**
+ * Times trust_hmac_batch() over batches of `batch` copies of the token with
+ * the current kernel, reporting per MAC against the one-at-a-time path.
+ */
+static int bench_batch(int batch, long iterations, double one_at_a_time, const unsigned char *expected) {
+    static unsigned char macs[MAX_BATCH][TRUST_HMAC_LEN];
+    hmac_span_t span = { sample_token, strlen(sample_token) };
+    hmac_job_t jobs[MAX_BATCH] = {0};
+    for (int i = 0; i < batch; i++) jobs[i] = (hmac_job_t){ &span, 1, macs[i], NULL };
+
+    if (!trust_hmac_batch(jobs, batch)) return 1;
+    for (int i = 0; i < batch; i++) {
+        if (memcmp(macs[i], expected, TRUST_HMAC_LEN) != 0) {
+            fprintf(stderr, "%s batch of %d does not match trust_hmac()\n", sha256_mb_kernel(), batch);
+            return 1;
+        }
+    }
+
+    long rounds = iterations / batch;
+    if (rounds < 1) rounds = 1;
+    char name[32];
+    snprintf(name, sizeof(name), "batch %-6s x%d", sha256_mb_kernel(), batch);
+    double start = now_ns();
+    for (long r = 0; r < rounds; r++) trust_hmac_batch(jobs, batch);
+    report(name, start, rounds * batch, one_at_a_time);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = (argc > 1) ? atol(argv[1]) : 1000000;
+    size_t len = strlen(sample_token);
+    unsigned char mac[EVP_MAX_MD_SIZE], check[EVP_MAX_MD_SIZE];
+    unsigned int mac_len = 0;
+    volatile unsigned char sink = 0;
+
+    if (!trust_hmac_init(HMAC_KEY, strlen(HMAC_KEY))) {
+        fprintf(stderr, "trust_hmac_init failed\n");
+        return 1;
+    }
+
+    // Both paths must agree before timing anything.
+    HMAC(EVP_sha256(), HMAC_KEY, (int)strlen(HMAC_KEY), (const unsigned char *)sample_token, len, check, &mac_len);
+    hmac_span_t span = { sample_token, len };
+    if (trust_hmac(&span, 1, mac) != mac_len || memcmp(mac, check, mac_len) != 0) {
+        fprintf(stderr, "pre-keyed HMAC does not match HMAC()\n");
+        return 1;
+    }
+
+    printf("token: %zu bytes, %ld iterations\n", len, iterations);
+
+    double start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        HMAC(EVP_sha256(), HMAC_KEY, (int)strlen(HMAC_KEY), (const unsigned char *)sample_token, len, mac, &mac_len);
+        sink ^= mac[0];
+    }
+    double baseline = (now_ns() - start) / (double)iterations;
+    printf("%-28s %8.1f ns/op\n", "one-shot HMAC()", baseline);
+
+    start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        trust_hmac(&span, 1, mac);
+        sink ^= mac[0];
+    }
+    report("pre-keyed midstates", start, iterations, baseline);
+
+    // Same, with the token split around a cut-out member as the plugin does.
+    hmac_span_t spans[2] = { { sample_token, len / 2 }, { sample_token + len / 2, len - len / 2 } };
+    start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        trust_hmac(spans, 2, mac);
+        sink ^= mac[0];
+    }
+    report("pre-keyed midstates, 2 spans", start, iterations, baseline);
+
+    // Batches, against the pre-keyed one-at-a-time path.
+    start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        trust_hmac(&span, 1, mac);
+        sink ^= mac[0];
+    }
+    double one_at_a_time = (now_ns() - start) / (double)iterations;
+    printf("\nbatches vs pre-keyed midstates (%.1f ns/op), default kernel: %s\n", one_at_a_time, sha256_mb_kernel());
+    static const char *const kernels[] = { "avx512", "avx2", "shani", "scalar" };
+    static const int batches[] = { 1, 2, 8, 16, MAX_BATCH };
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        if (!sha256_mb_select(kernels[k])) {
+            printf("%-28s not supported on this CPU\n", kernels[k]);
+            continue;
+        }
+        for (size_t b = 0; b < sizeof(batches) / sizeof(batches[0]); b++) {
+            if (bench_batch(batches[b], iterations, one_at_a_time, check) != 0) return 1;
+        }
+    }
+
+    trust_hmac_cleanup();
+    return sink == 0xFF ? 2 : 0;
+}
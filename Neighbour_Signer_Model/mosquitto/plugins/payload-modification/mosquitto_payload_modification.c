@@ -22,18 +22,36 @@
 #include <stdarg.h>
 #include <openssl/hmac.h>
 #include <openssl/evp.h>
+#include <openssl/crypto.h>
 #include <cjson/cJSON.h>
 #include <math.h>
 
 #include <unistd.h>
 #include <sys/file.h> 
+#include <sys/stat.h>
 
 #include "mosquitto_broker.h"
 #include "mosquitto_plugin.h"
 #include "mosquitto.h"
 #include "mqtt_protocol.h"
+#include "uthash.h"
+#include "trust_acl.h"
+#include "trust_arena.h"
+#include "trust_admit.h"
+#include "trust_shape.h"
+#include "trust_log.h"
+#include "trust_metrics.h"
+#include "trust_pool.h"
+#include "trust_replay.h"
+#include "trust_shm.h"
+#include "trust_topics.h"
+#include "trust_keyring.h"
+#include "trust_digest.h"
+#include "trust_hmac.h"
+#include "trust_token.h"
 
 #define UNUSED(A) (void)(A)
+#define CJSON_VERSION_NUM (CJSON_VERSION_MAJOR*1000000+CJSON_VERSION_MINOR*1000+CJSON_VERSION_PATCH)
 
 // ---- Static Configuration and State ----
 static mosquitto_plugin_id_t *mosq_pid = NULL;
@@ -44,71 +62,368 @@ static char log_file_path[256] = "plugin_log.txt";
 static char network_map_file[256] = "/home/dhruv/winshare/Neighbour_Signer_Model/mosquitto/plugins/payload-modification/network_map.txt";
 static char trust_store_template[256] = "/home/dhruv/winshare/Neighbour_Signer_Model/mosquitto/plugins/payload-modification/trust_history/trust_store_%s.txt";
 
-static FILE *log_fp = NULL;
-static time_t last_map_refresh_time = 0;
-static const int MAP_REFRESH_INTERVAL_SECONDS = 10; // Set to 10 seconds
+
+// ---- Logging ----
+// Messages below `log_level` stay out of the plugin log file, which is written
+// by trust_log's background thread. Messages below `broker_log_level` are not
+// forwarded to the broker log, which formats them on the broker thread.
+// Messages below both are dropped before any formatting.
+typedef enum { LOG_RANK_DEBUG, LOG_RANK_INFO, LOG_RANK_NOTICE, LOG_RANK_WARNING, LOG_RANK_ERR, LOG_RANK_NONE } log_rank_t;
+static log_rank_t file_log_rank = LOG_RANK_DEBUG;
+static log_rank_t broker_log_rank = LOG_RANK_WARNING;
+static log_rank_t min_log_rank = LOG_RANK_DEBUG;
+
+// ---- Network Map Reload ----
+// The map file is stat()ed every MAP_POLL_INTERVAL_SECONDS and only re-parsed
+// when its inode, size or modification time changed.
+typedef struct { ino_t ino; off_t size; struct timespec mtime; } file_stamp_t;
+static const int MAP_POLL_INTERVAL_SECONDS = 1;
+static time_t last_map_poll_time = 0;
+static file_stamp_t network_map_stamp;
+
+// ---- Trust Store Persistence ----
+// Feedback only marks the local trust store dirty. It is written back once
+// `trust_flush_interval` seconds have passed (checked on tick) or
+// `trust_flush_dirty` updates are pending, and always at shutdown.
+static int trust_flush_interval = 5;
+static int trust_flush_dirty = 100;
+static int trust_store_dirty = 0;
+static time_t last_trust_flush_time = 0;
+
+// ---- HMAC Verification Mode ----
+// raw:       MAC is checked over the received bytes with the "hmac" member cut out (no JSON parse).
+// canonical: payload is parsed and re-printed with cJSON before checking (tolerates pretty-printed tokens).
+typedef enum { HMAC_VERIFY_RAW, HMAC_VERIFY_CANONICAL } hmac_verify_mode_t;
+static hmac_verify_mode_t hmac_verify_mode = HMAC_VERIFY_RAW;
+#define HMAC_HEX_LEN 64
+
+// ---- HMAC Keys ----
+// A token names its key with a "kid" (JSON member, binary field or user
+// property), looked up in `hmac_keyring`, a file of "kid key" lines; tokens
+// without one use `hmac_key`, or are denied if it is empty. A re-signed token
+// keeps the key it arrived with. The keyring file is re-read on a broker
+// reload (SIGHUP), so keys can be added and retired without restarting.
+static char hmac_keyring_file[256] = "";
+
+// ---- Property Tokens ----
+// When enabled, tokens may travel as MQTT v5 user properties ("b", "c",
+// "msg_id", "pd", one "S" per signer, one "hmac" per signature) instead of
+// inside the payload.
+// Bridges must use `bridge_protocol_version mqttv50` to carry them.
+static bool property_tokens_enabled = false;
+#define MAX_PROPERTY_SIGNERS 32
+
+// ---- Admission Control ----
+// Cheap limits checked before a token is scanned, parsed or MAC'd: payload
+// size, JSON nesting depth, signer count, and per-client / per-source-address
+// rate limits (see trust_admit.h), then the trust-weighted share of the last
+// signer (see trust_shape.h). 0 disables a limit. Rejections are counted per
+// reason and reported every ADMISSION_REPORT_INTERVAL_SECONDS.
+typedef enum { REJECT_SIZE, REJECT_DEPTH, REJECT_SIGNERS, REJECT_CLIENT_RATE, REJECT_SOURCE_RATE, REJECT_SHAPED, REJECT_REASON_COUNT } reject_reason_t;
+static int max_token_size = 16384;
+static int max_token_depth = 8;
+static int max_token_signers = 16;
+static double client_rate = 0, client_burst = 0;
+static double source_rate = 0, source_burst = 0;
+static double shaping_capacity = 0;     // messages/s shared between upstream signers
+// Signers outside the network map are charged to this one share between them.
+#define SHAPE_UNKNOWN_SIGNER "?"
+static unsigned long admission_rejects[REJECT_REASON_COUNT];
+static unsigned long admission_rejects_reported[REJECT_REASON_COUNT];
+static const int ADMISSION_REPORT_INTERVAL_SECONDS = 10;
+static time_t last_admission_report_time = 0;
+
+// ---- Metrics ----
+// Message verdicts (see deny()), feedback and link trust are always counted;
+// callback stages are only timed when the metrics are exported somewhere.
+// Every `metrics_interval` seconds the values are published, retained, under
+// $SYS/trust/, and with `metrics_port` set they are served in Prometheus text
+// format from http://<metrics_bind>:<metrics_port>/metrics (see trust_metrics.h).
+static int metrics_interval = 0;
+static int metrics_port = 0;
+static char metrics_bind[64] = "";
+static bool metrics_timing = false;
+static time_t last_metrics_publish_time = 0;
+static const metric_counter_t reject_metrics[REJECT_REASON_COUNT] = {
+    METRIC_ADMISSION_SIZE, METRIC_ADMISSION_DEPTH, METRIC_ADMISSION_SIGNERS,
+    METRIC_ADMISSION_CLIENT_RATE, METRIC_ADMISSION_SOURCE_RATE, METRIC_ADMISSION_SHAPED
+};
+// Time spent in each stage by the message being evaluated. A stage can be
+// entered more than once (a DOM parse after the MAC check counts as parsing)
+// and is observed once, when the callback returns.
+static uint64_t stage_clock = 0;                // 0 when not timing
+static uint64_t stage_ns[METRIC_STAGE_COUNT];
+static unsigned stage_mask = 0;                 // bit per stage entered
+// The share admit_signer_share() charged for the message being evaluated,
+// handed back by deny_unverified() if the token then fails its key or MAC check.
+static char shaped_signer[256];
+static size_t shaped_signer_len = 0;            // 0 when nothing was charged
+static bool passed_through = false;             // let through with no token (see pass_through())
+
+// ---- Trusted Topics ----
+// Comma-separated topic filters naming the topics that carry trust tokens;
+// '!' marks an exclusion. Anything else is passed through without looking at
+// the payload. Empty evaluates every topic except '$' topics and
+// internal/feedback/processed.
+static char trust_topics[512] = "";
+
+// ---- JSON Arena ----
+// cJSON trees, copies and print buffers built while one message is evaluated
+// come from a bump arena of `json_arena_size` bytes that is reset once the
+// callback returns; only the re-signed payload handed to the broker is
+// allocated on the heap. 0 leaves cJSON on malloc().
+static int json_arena_size = 65536;
+
+// ---- Verification Workers ----
+// With `verify_threads` > 0, raw JSON tokens are checked on the broker thread
+// as far as the ACL and trust verdict, then deferred (see
+// mosquitto_message_defer()) while a worker computes the verify and re-sign
+// MACs, `verify_batch` tokens per multi-buffer pass. Tokens that can't be
+// handled without a parse, or arrive while the queue is full, are verified
+// in place as before.
+static int verify_threads = 0;
+static int verify_batch = POOL_MAX_BATCH;
+
+// ---- Replay Filter ----
+// Tokens whose (b, c, msg_id) was already accepted, or is older than the
+// replay window, are dropped before their MAC is checked. Only accepted tokens
+// are recorded, so forged tokens can't advance the window.
+static bool replay_filter_enabled = true;
+static int replay_cache_size = 4096;
 
 // ---- Graph Representation & Trust Model ----
-#define MAX_NODES_IN_GRAPH 32
-#define MAX_LINKS_PER_NODE 8
-typedef struct { char target_broker_id[32]; int r; int s; } trust_link_t;
-typedef struct { char broker_id[32]; trust_link_t links[MAX_LINKS_PER_NODE]; int link_count; } network_node_t;
-static network_node_t network_graph[MAX_NODES_IN_GRAPH];
-static int node_count = 0;
+// Links are stored in compressed sparse row form: node u's outgoing links are
+// entries [link_offset[u], link_offset[u + 1]) of link_target and links.
+typedef struct { int r; int s; } trust_link_t;
+// Broker IDs are interned to their node index when the map loads. Each entry
+// holds its own copy of the ID, which doubles as its hash key.
+typedef struct { int index; UT_hash_handle hh; char id[]; } broker_name_t;
+typedef struct {
+    int node_count;
+    int link_count;
+    broker_name_t **nodes;          // node_count entries, by node index
+    broker_name_t *name_index;
+    int *link_offset;               // node_count + 1 entries
+    int *link_target;               // link_count entries
+    trust_link_t *links;            // link_count entries, parallel to link_target
+} network_graph_t;
+// A reload parses into the spare buffer and swaps it in only if the map loaded
+// cleanly, so a missing or half-written file never replaces a good graph.
+static network_graph_t graph_buffers[2];
+static network_graph_t *network_graph = &graph_buffers[0];
+static int self_idx = -1; // index of this broker, or -1 if it is not in the map
+
+// ---- Trust Decision Table ----
+// Direct trust of each node's link into this broker and the resulting verdict.
+// Rebuilt after every map reload and patched per link on feedback, so the
+// message path never recomputes calculate_trust().
+typedef struct { double trust; bool accept; } trust_decision_t;
+static trust_decision_t *trust_table = NULL; // node_count entries
+static trust_decision_t default_decision; // unknown broker or no link to us
+
+// ---- Feedback ----
+// Feedback on a link into this broker is summed into per-source (r, s)
+// deltas, applied to the links once per tick. Feedback for another broker is
+// also passed to the neighbour on the shortest path toward it, through the
+// bridge named in `feedback_bridges` ("B1=local.b0_to_b1,B3=local.b0_to_b3",
+// neighbour ID = bridge local_clientid), and dropped if there is none. The
+// message itself is accepted, so QoS>0 publishers are acknowledged, but only
+// as FEEDBACK_DONE_TOPIC: a '$' topic never matches the bridges' `#` filters,
+// so it reaches local subscribers of that topic and goes no further.
+#define FEEDBACK_DONE_TOPIC "$trust/feedback/processed"
+static char feedback_bridges[512] = "";
+static trust_link_t *feedback_deltas = NULL;    // node_count entries
+static int feedback_pending = 0;                // messages summed into feedback_deltas
+static int *feedback_next_hop = NULL;           // first hop toward each node, or -1; NULL until needed
+static broker_name_t *feedback_unrouted = NULL; // targets already warned about having no route
+static int feedback_unrouted_count = 0;
+#define MAX_FEEDBACK_UNROUTED 64
+
+// ---- Shared Trust Segment ----
+// With `trust_shm_file` set (e.g. /dev/shm/trust_graph), brokers on one host
+// share the graph and every link's (r, s) counters through that mapped file
+// instead of the aggregated map: each broker publishes the counters of links
+// into it on tick and picks up the others' on the next tick after they change.
+// The map file then only supplies the topology, and the seed counters of links
+// the segment does not hold yet. `trust_shm_nodes` and `trust_shm_links` size
+// a new segment.
+static char trust_shm_file[256] = "";
+static int trust_shm_nodes = 256;
+static int trust_shm_links = 4096;
+static bool shm_graph_live = false;     // network_graph was read from the segment
+static uint32_t shm_layout = 0;         // segment layout network_graph was read at
+static uint64_t shm_generation = 0;     // counter generation last pulled in
+static bool shm_publish_pending = false;
+
+// ---- Least-Trustworthy Path Cache ----
+// path_score_rows[s][t] is the lowest average link trust over any route from
+// s to t, or 0.0 if t is unreachable. A row is computed the first time a path
+// from s is queried. All rows are dropped on each map reload, on a feedback
+// tick that changed a link's counters, and when counters published by other
+// brokers are picked up from the shared segment.
+static double **path_score_rows = NULL;
+static double *path_link_trust = NULL;  // calculate_trust() per link, taken at reload
+static int path_node_count = 0;
 static const double LOCAL_THRESHOLD_THETA = 0.5;
 static const double BASE_RATE_DELTA = 0.5;
 static const int NEGATIVE_MULTIPLIER_MU = 5;
 
-// ---- ACL Structures ----
-#define MAX_ACL_RULES 256
-typedef struct { char client_id[64]; char access[8]; char topic[256]; } acl_rule_t;
-static acl_rule_t acl_rules[MAX_ACL_RULES];
-static int acl_rule_count = 0;
+// ---- Raw Token Scanning ----
+#define MAX_TOKEN_MEMBERS 16
+#define MAX_TOKEN_DEPTH 8
+typedef struct {
+    const char *key; size_t key_len;       // key bytes, without quotes
+    const char *value; size_t value_len;   // raw value bytes, including quotes/brackets
+    const char *start;                     // opening quote of the key
+    const char *end;                       // first byte after the value
+} raw_member_t;
+typedef struct { raw_member_t members[MAX_TOKEN_MEMBERS]; int member_count; } raw_token_t;
+
+// Where a splice re-sign inserts this broker into "S" and overwrites "hmac".
+// The spans are the MAC input of the re-signed token; they point into the
+// payload and into `insertion`, so a plan is used where it was filled in.
+typedef struct {
+    char insertion[sizeof(broker_id) + 4];
+    size_t ins_len, ins_off;
+    size_t hex_off;                        // hmac hex offset in the new token
+    hmac_span_t spans[4];
+    int span_count;
+} resign_plan_t;
 
 // ---- Function Prototypes ----
 void plugin_log(int level, const char *fmt, ...);
-void load_acl_file(const char *filename);
-void load_network_graph(const char *filename);
+bool load_network_graph(const char *filename, network_graph_t *graph);
 double calculate_trust(int r, int s);
-void save_local_trust_store(void);
+bool save_local_trust_store(void);
+static void flush_trust_store(void);
 bool load_local_trust_store(void);
 static int find_node_index(const char* broker_id);
-void compute_hmac(const char *data, size_t data_len, char *hmac_hex_out);
-bool check_permission(const char *client_id, const char *topic, bool is_publish);
+static trust_link_t *find_link(int source_idx, int target_idx);
+static bool network_map_changed(void);
+void compute_hmac(const trust_hmac_key_t *key, const char *data, size_t data_len, char *hmac_hex_out);
+void compute_hmac_spans(const trust_hmac_key_t *key, const hmac_span_t *spans, int span_count, char *hmac_hex_out);
+size_t compute_hmac_raw(const trust_hmac_key_t *key, const hmac_span_t *spans, int span_count, unsigned char *hmac_out);
+static bool raw_token_scan(const char *json, size_t len, raw_token_t *tok);
+static const raw_member_t *raw_token_member(const raw_token_t *tok, const char *key);
+static bool resign_plan(const char *payload, size_t len, const raw_token_t *tok, bool append_signer, resign_plan_t *plan);
+static void resign_write(const char *payload, size_t len, const resign_plan_t *plan, const unsigned char *mac, char *out);
+static char *resign_apply(const char *payload, size_t len, const resign_plan_t *plan, const unsigned char *mac, uint32_t *out_len);
 bool string_in_array(cJSON *array, const char *str);
 double get_least_trustworthy_path_score(const char *start_id, const char *end_id);
-void handle_feedback(const char *payload);
+static bool reload_trust_state(void);
+static void update_trust_decision(int source_idx);
+static void reset_path_cache(void);
+static void apply_feedback(void);
+static bool load_shared_graph(network_graph_t *graph, bool *shared, uint32_t *layout);
+static void shm_publish_local(void);
 static int callback_message(int event, void *event_data, void *userdata);
 
 // =================================================================================
 // CORE HELPER AND LOGIC FUNCTIONS
 // =================================================================================
 
+static log_rank_t log_rank(int level) {
+    switch (level) {
+        case MOSQ_LOG_DEBUG: return LOG_RANK_DEBUG;
+        case MOSQ_LOG_NOTICE: return LOG_RANK_NOTICE;
+        case MOSQ_LOG_WARNING: return LOG_RANK_WARNING;
+        case MOSQ_LOG_ERR: return LOG_RANK_ERR;
+        default: return LOG_RANK_INFO;
+    }
+}
+
+static log_rank_t parse_log_rank(const char *name) {
+    if (strcmp(name, "debug") == 0) return LOG_RANK_DEBUG;
+    if (strcmp(name, "notice") == 0) return LOG_RANK_NOTICE;
+    if (strcmp(name, "warning") == 0) return LOG_RANK_WARNING;
+    if (strcmp(name, "error") == 0) return LOG_RANK_ERR;
+    if (strcmp(name, "none") == 0) return LOG_RANK_NONE;
+    return LOG_RANK_INFO;
+}
+
+/**
+ * True if a message at `level` would reach any log. Callers use it to skip
+ * building strings that only exist to be logged.
+ */
+static inline bool plugin_log_enabled(int level) {
+    return log_rank(level) >= min_log_rank;
+}
+
 void plugin_log(int level, const char *fmt, ...) {
-    char buf[1024];
+    log_rank_t rank = log_rank(level);
+    if (rank < min_log_rank) return;
+
     va_list va;
-    va_start(va, fmt);
-    vsnprintf(buf, sizeof(buf), fmt, va);
-    va_end(va);
-    mosquitto_log_printf(level, "[PLUGIN][%s] %s", broker_id, buf);
-    if (log_fp) {
-        time_t now = time(NULL);
-        char time_buf[20];
-        strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", localtime(&now));
-        const char *level_str = "INFO";
-        if (level == MOSQ_LOG_WARNING) level_str = "WARN";
-        else if (level == MOSQ_LOG_ERR) level_str = "ERROR";
-        else if (level == MOSQ_LOG_DEBUG) level_str = "DEBUG";
-        fprintf(log_fp, "[%s] [%s] %s\n", time_buf, level_str, buf);
-        fflush(log_fp);
+    if (rank >= broker_log_rank) {
+        char buf[1024];
+        va_start(va, fmt);
+        vsnprintf(buf, sizeof(buf), fmt, va);
+        va_end(va);
+        mosquitto_log_printf(level, "[PLUGIN][%s] %s", broker_id, buf);
+    }
+    if (rank >= file_log_rank) {
+        va_start(va, fmt);
+        trust_log_vwrite(level, fmt, va);
+        va_end(va);
     }
 }
 
+static int graph_find_node(const network_graph_t *graph, const char *node_id) {
+    broker_name_t *entry = NULL;
+    HASH_FIND(hh, graph->name_index, node_id, strlen(node_id), entry);
+    return entry ? entry->index : -1;
+}
+
 static int find_node_index(const char* broker_id) {
-    for (int i = 0; i < node_count; i++) {
-        if (strcmp(network_graph[i].broker_id, broker_id) == 0) return i;
+    return graph_find_node(network_graph, broker_id);
+}
+
+/**
+ * Returns the node index for `node_id` in `graph`, adding a new node if it
+ * is not there yet. `capacity` tracks the size of graph->nodes. Returns -1 if
+ * memory runs out.
+ */
+static int intern_node(network_graph_t *graph, int *capacity, const char *node_id) {
+    int idx = graph_find_node(graph, node_id);
+    if (idx != -1) return idx;
+
+    if (graph->node_count == *capacity) {
+        int new_capacity = *capacity ? *capacity * 2 : 16;
+        broker_name_t **nodes = realloc(graph->nodes, (size_t)new_capacity * sizeof(*nodes));
+        if (!nodes) return -1;
+        graph->nodes = nodes;
+        *capacity = new_capacity;
     }
-    return -1;
+    size_t len = strlen(node_id);
+    broker_name_t *entry = malloc(sizeof(*entry) + len + 1);
+    if (!entry) return -1;
+    memcpy(entry->id, node_id, len + 1);
+    entry->index = idx = graph->node_count++;
+    graph->nodes[idx] = entry;
+    HASH_ADD_KEYPTR(hh, graph->name_index, entry->id, len, entry);
+    return idx;
+}
+
+static void graph_free(network_graph_t *graph) {
+    HASH_CLEAR(hh, graph->name_index);
+    for (int i = 0; i < graph->node_count; i++) free(graph->nodes[i]);
+    free(graph->nodes);
+    free(graph->link_offset);
+    free(graph->link_target);
+    free(graph->links);
+    memset(graph, 0, sizeof(*graph));
+}
+
+static trust_link_t *graph_find_link(network_graph_t *graph, int source_idx, int target_idx) {
+    if (source_idx < 0 || target_idx < 0) return NULL;
+    for (int k = graph->link_offset[source_idx]; k < graph->link_offset[source_idx + 1]; k++) {
+        if (graph->link_target[k] == target_idx) return &graph->links[k];
+    }
+    return NULL;
+}
+
+static trust_link_t *find_link(int source_idx, int target_idx) {
+    return graph_find_link(network_graph, source_idx, target_idx);
 }
 
 double calculate_trust(int r, int s) {
@@ -119,23 +434,46 @@ double calculate_trust(int r, int s) {
     return alpha + BASE_RATE_DELTA * gamma;
 }
 
-void save_local_trust_store(void) {
-    char local_store_path[512];
+/**
+ * Writes the local trust store to a temporary file and renames it over the
+ * real one, so readers (aggregator.py) only ever see a complete file.
+ */
+bool save_local_trust_store(void) {
+    char local_store_path[512], temp_path[520];
     snprintf(local_store_path, sizeof(local_store_path), trust_store_template, broker_id);
-    FILE *fp = fopen(local_store_path, "w");
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", local_store_path);
+    FILE *fp = fopen(temp_path, "w");
     if (!fp) {
-        plugin_log(MOSQ_LOG_ERR, "[PERSIST] Could not open local trust store for writing: %s", local_store_path);
-        return;
+        plugin_log(MOSQ_LOG_ERR, "[PERSIST] Could not open local trust store for writing: %s", temp_path);
+        return false;
     }
     fprintf(fp, "# Local trust data held by %s\n# Format: source_broker,r_value,s_value\n", broker_id);
-    for (int i = 0; i < node_count; i++) {
-        for (int j = 0; j < network_graph[i].link_count; j++) {
-            if (strcmp(network_graph[i].links[j].target_broker_id, broker_id) == 0) {
-                fprintf(fp, "%s,%d,%d\n", network_graph[i].broker_id, network_graph[i].links[j].r, network_graph[i].links[j].s);
-            }
+    for (int i = 0; i < network_graph->node_count; i++) {
+        trust_link_t *link = find_link(i, self_idx);
+        if (link) {
+            fprintf(fp, "%s,%d,%d\n", network_graph->nodes[i]->id, link->r, link->s);
         }
     }
-    fclose(fp);
+    bool ok = (fflush(fp) == 0 && fsync(fileno(fp)) == 0);
+    if (fclose(fp) != 0) ok = false;
+    if (!ok || rename(temp_path, local_store_path) != 0) {
+        plugin_log(MOSQ_LOG_ERR, "[PERSIST] Could not write local trust store: %s", local_store_path);
+        unlink(temp_path);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Writes back pending feedback updates, if there are any.
+ */
+static void flush_trust_store(void) {
+    if (trust_store_dirty == 0) return;
+    if (save_local_trust_store()) {
+        plugin_log(MOSQ_LOG_DEBUG, "[PERSIST] Flushed %d trust updates.", trust_store_dirty);
+        trust_store_dirty = 0;
+    }
+    last_trust_flush_time = time(NULL);
 }
 
 bool load_local_trust_store(void) {
@@ -150,14 +488,10 @@ bool load_local_trust_store(void) {
         char *r_str = strtok(NULL, ",");
         char *s_str = strtok(NULL, ",");
         if (source_id && r_str && s_str) {
-            int source_idx = find_node_index(source_id);
-            if (source_idx == -1) continue;
-            for (int i = 0; i < network_graph[source_idx].link_count; i++) {
-                if (strcmp(network_graph[source_idx].links[i].target_broker_id, broker_id) == 0) {
-                    network_graph[source_idx].links[i].r = atoi(r_str);
-                    network_graph[source_idx].links[i].s = atoi(s_str);
-                    break;
-                }
+            trust_link_t *link = find_link(find_node_index(source_id), self_idx);
+            if (link) {
+                link->r = atoi(r_str);
+                link->s = atoi(s_str);
             }
         }
     }
@@ -165,394 +499,2050 @@ bool load_local_trust_store(void) {
     return true;
 }
 
-static void find_paths_recursive(int current_idx, int end_idx,
-                                 double current_path_sum, int path_len,
-                                 bool visited[], double* min_avg_trust, int path_indices[]) {
-    path_indices[path_len] = current_idx;
-    visited[current_idx] = true;
+static trust_decision_t make_trust_decision(int r, int s) {
+    trust_decision_t decision;
+    decision.trust = calculate_trust(r, s);
+    decision.accept = decision.trust >= LOCAL_THRESHOLD_THETA;
+    return decision;
+}
+
+/**
+ * Recomputes the table entry for one source broker after its link into this
+ * broker changed.
+ */
+static void update_trust_decision(int source_idx) {
+    if (source_idx < 0) return;
+    trust_link_t *link = find_link(source_idx, self_idx);
+    trust_table[source_idx] = link ? make_trust_decision(link->r, link->s) : default_decision;
+    if (link) metrics_link_set(source_idx, network_graph->nodes[source_idx]->id, trust_table[source_idx].trust);
+}
 
-    if (current_idx == end_idx) {
-        double current_path_avg = (path_len > 0) ? current_path_sum / path_len : 1.0;
-        
-        char path_str[512] = {0}, temp_buf[64];
-        for (int i = 0; i < path_len; i++) {
-            sprintf(temp_buf, "%s -> ", network_graph[path_indices[i]].broker_id);
-            strcat(path_str, temp_buf);
+/**
+ * Copies this broker's counters for links into it from the graph being
+ * replaced onto the freshly loaded one. They are newer than the aggregated
+ * map, which only catches up once the trust store is flushed and aggregated.
+ */
+static void carry_local_trust(network_graph_t *to, network_graph_t *from) {
+    int to_self = graph_find_node(to, broker_id);
+    int from_self = graph_find_node(from, broker_id);
+    if (to_self == -1 || from_self == -1) return;
+    for (int i = 0; i < from->node_count; i++) {
+        const trust_link_t *old_link = graph_find_link(from, i, from_self);
+        if (!old_link) continue;
+        trust_link_t *link = graph_find_link(to, graph_find_node(to, from->nodes[i]->id), to_self);
+        if (link) {
+            link->r = old_link->r;
+            link->s = old_link->s;
         }
-        sprintf(temp_buf, "%s", network_graph[end_idx].broker_id);
-        strcat(path_str, temp_buf);
+    }
+}
+
+/**
+ * Loads the network map (through the shared segment, if one is mapped) into
+ * the spare graph buffer and swaps it in, then rebuilds the decision table and
+ * resets the path cache. If the map can't be loaded the current graph stays
+ * live and false is returned.
+ */
+static bool reload_trust_state(void) {
+    network_graph_t *shadow = (network_graph == &graph_buffers[0]) ? &graph_buffers[1] : &graph_buffers[0];
+    trust_decision_t *table = NULL;
+    trust_link_t *deltas = NULL;
+    // Feedback deltas are indexed by the live graph, so fold them in first.
+    apply_feedback();
+    uint32_t layout = 0;
+    bool shared = false;
+    bool loaded = trust_shm_attached() ? load_shared_graph(shadow, &shared, &layout) : load_network_graph(network_map_file, shadow);
+    if (!loaded
+            || !(table = malloc((size_t)shadow->node_count * sizeof(*table)))
+            || !(deltas = calloc((size_t)shadow->node_count, sizeof(*deltas)))) {
+        plugin_log(MOSQ_LOG_WARNING, "[REFRESH] Could not load network map %s. Keeping the current graph (%d brokers).",
+                   network_map_file, network_graph->node_count);
+        free(table);
+        graph_free(shadow);
+        return false;
+    }
 
-        plugin_log(MOSQ_LOG_DEBUG, "[PATH_FIND] \tFound Path: %s", path_str);
-        plugin_log(MOSQ_LOG_DEBUG, "[PATH_FIND] \tCalculation: (Sum: %.3f / Links: %d) = Avg: %.3f", current_path_sum, path_len, current_path_avg);
+    // Our local knowledge is authoritative over the global map: carry it over
+    // from the live graph, or read it from our trust store on the first load.
+    bool first_load = (network_graph->node_count == 0);
+    carry_local_trust(shadow, network_graph);
+    graph_free(network_graph);
+    network_graph = shadow;
+    free(trust_table);
+    trust_table = table;
+    free(feedback_deltas);
+    feedback_deltas = deltas;
+    free(feedback_next_hop);
+    feedback_next_hop = NULL;
+    self_idx = find_node_index(broker_id);
+    if (first_load) load_local_trust_store();
+    shm_graph_live = shared;
+    shm_layout = layout;
+    shm_generation = 0;
+    shm_publish_pending = true;
+    shm_publish_local();
 
-        if (current_path_avg < *min_avg_trust) {
-            plugin_log(MOSQ_LOG_DEBUG, "[PATH_FIND] \tNew minimum found! Updating from %.3f to %.3f", *min_avg_trust, current_path_avg);
-            *min_avg_trust = current_path_avg;
-        }
-        
-        visited[current_idx] = false;
-        return;
+    metrics_links_reset(broker_id, network_graph->node_count);
+    for (int i = 0; i < network_graph->node_count; i++) {
+        update_trust_decision(i);
     }
+    reset_path_cache();
+    plugin_log(MOSQ_LOG_DEBUG, "[REFRESH] Network map loaded with %d brokers and %d links.",
+               network_graph->node_count, network_graph->link_count);
+    return true;
+}
 
-    for (int i = 0; i < network_graph[current_idx].link_count; i++) {
-        int neighbor_idx = find_node_index(network_graph[current_idx].links[i].target_broker_id);
-        if (neighbor_idx != -1 && !visited[neighbor_idx]) {
-            double link_trust = calculate_trust(network_graph[current_idx].links[i].r, network_graph[current_idx].links[i].s);
-            find_paths_recursive(neighbor_idx, end_idx, current_path_sum + link_trust, path_len + 1, visited, min_avg_trust, path_indices);
-        }
+/**
+ * Returns true if the network map file differs from when it was last seen.
+ * A file that can't be stat()ed is reported as unchanged.
+ */
+static bool network_map_changed(void) {
+    struct stat st;
+    if (stat(network_map_file, &st) != 0) return false;
+    file_stamp_t stamp = { st.st_ino, st.st_size, st.st_mtim };
+    bool changed = stamp.ino != network_map_stamp.ino || stamp.size != network_map_stamp.size
+        || stamp.mtime.tv_sec != network_map_stamp.mtime.tv_sec || stamp.mtime.tv_nsec != network_map_stamp.mtime.tv_nsec;
+    network_map_stamp = stamp;
+    return changed;
+}
+
+static void free_path_cache(void) {
+    for (int i = 0; i < path_node_count; i++) free(path_score_rows[i]);
+    free(path_score_rows);
+    free(path_link_trust);
+    path_score_rows = NULL;
+    path_link_trust = NULL;
+    path_node_count = 0;
+}
+
+/**
+ * Drops every cached row and snapshots the link trust values the rows are
+ * computed from.
+ */
+static void reset_path_cache(void) {
+    free_path_cache();
+    int node_count = network_graph->node_count;
+    int link_count = network_graph->link_count;
+    path_score_rows = calloc((size_t)node_count, sizeof(*path_score_rows));
+    path_link_trust = malloc((size_t)link_count * sizeof(*path_link_trust));
+    if (!path_score_rows || !path_link_trust) {
+        free_path_cache();
+        return;
     }
-    visited[current_idx] = false;
+    for (int k = 0; k < link_count; k++) {
+        path_link_trust[k] = calculate_trust(network_graph->links[k].r, network_graph->links[k].s);
+    }
+    path_node_count = node_count;
 }
 
 /**
- * Finds the direct trust score from a specific source broker to the target (current) broker.
+ * Computes the path score row for `src` with a DP over route length. best[k][v]
+ * is the lowest trust sum of any k-link route from src to v, and the score for
+ * v is min over k of best[k][v] / k. Routes may revisit a broker. A low-trust
+ * cycle can therefore only lower a score, never raise it. Cost is O(V * E)
+ * instead of enumerating every simple path.
  */
-double get_direct_trust_score(const char *source_id, const char *target_id) {
-    plugin_log(MOSQ_LOG_DEBUG, "[TRUST] Looking up direct trust from '%s' to '%s'", source_id, target_id);
-    
-    int source_idx = find_node_index(source_id);
-    if (source_idx == -1) {
-        plugin_log(MOSQ_LOG_INFO, "[TRUST] No node entry found for source '%s'. Returning default trust.", source_id);
-        return calculate_trust(0, 0); // Return default trust for an unknown broker
+static double *path_score_row(int src) {
+    if (src < 0 || src >= path_node_count) return NULL;
+    if (path_score_rows[src]) return path_score_rows[src];
+
+    int node_count = path_node_count;
+    const int *offset = network_graph->link_offset;
+    double *row = malloc((size_t)node_count * sizeof(*row));
+    double *prev = malloc((size_t)node_count * sizeof(*prev));
+    double *cur = malloc((size_t)node_count * sizeof(*cur));
+    if (!row || !prev || !cur) {
+        free(row); free(prev); free(cur);
+        return NULL;
+    }
+
+    // `row` holds the running min average until it is finalised below.
+    for (int v = 0; v < node_count; v++) {
+        prev[v] = INFINITY;
+        row[v] = INFINITY;
     }
+    prev[src] = 0.0;
 
-    // Find the specific link from the source to the target
-    for (int i = 0; i < network_graph[source_idx].link_count; i++) {
-        if (strcmp(network_graph[source_idx].links[i].target_broker_id, target_id) == 0) {
-            trust_link_t *link = &network_graph[source_idx].links[i];
-            double direct_trust = calculate_trust(link->r, link->s);
-            plugin_log(MOSQ_LOG_DEBUG, "[TRUST] Found link from '%s'. r=%d, s=%d. Direct trust is %.3f", 
-                       source_id, link->r, link->s, direct_trust);
-            return direct_trust;
+    for (int k = 1; k < node_count; k++) {
+        bool reached = false;
+        for (int v = 0; v < node_count; v++) cur[v] = INFINITY;
+        for (int u = 0; u < node_count; u++) {
+            if (prev[u] == INFINITY) continue;
+            for (int i = offset[u]; i < offset[u + 1]; i++) {
+                int v = network_graph->link_target[i];
+                double sum = prev[u] + path_link_trust[i];
+                if (sum < cur[v]) { cur[v] = sum; reached = true; }
+            }
+        }
+        if (!reached) break;
+        for (int v = 0; v < node_count; v++) {
+            if (cur[v] != INFINITY && cur[v] / k < row[v]) row[v] = cur[v] / k;
+            prev[v] = cur[v];
         }
     }
+    free(prev);
+    free(cur);
 
-    plugin_log(MOSQ_LOG_INFO, "[TRUST] Node for '%s' exists, but no direct link to '%s' found. Returning default trust.", source_id, target_id);
-    return calculate_trust(0, 0); // Return default if no direct link exists
+    for (int dst = 0; dst < node_count; dst++) {
+        row[dst] = (dst == src) ? 1.0 : (row[dst] == INFINITY ? 0.0 : row[dst]);
+    }
+    path_score_rows[src] = row;
+    return row;
 }
 
 double get_least_trustworthy_path_score(const char *start_id, const char *end_id) {
     int start_idx = find_node_index(start_id);
     int end_idx = find_node_index(end_id);
     if (start_idx == -1 || end_idx == -1) return 0.0;
-    if (start_idx == end_idx) return 1.0;
 
-    bool visited[MAX_NODES_IN_GRAPH] = {false};
-    int path_indices[MAX_NODES_IN_GRAPH];
-    double min_avg_trust = 1.1;
-    
-    plugin_log(MOSQ_LOG_DEBUG, "[PATH_FIND] Searching for paths from %s to %s...", start_id, end_id);
-    find_paths_recursive(start_idx, end_idx, 0.0, 0, visited, &min_avg_trust, path_indices);
+    const double *row = path_score_row(start_idx);
+    double score = row ? row[end_idx] : 0.0;
+    plugin_log(MOSQ_LOG_DEBUG, "[PATH_FIND] Least-trustworthy path score for %s -> %s is %.3f", start_id, end_id, score);
+    return score;
+}
+
+/**
+ * Static trust from the map expressed as the (r, s) counts that yield it.
+ */
+static trust_link_t static_trust_counts(double static_trust) {
+    trust_link_t counts;
+    if (static_trust > 0.5) {
+        counts.r = (int)round((2 * static_trust - 1) / (1 - static_trust));
+        counts.s = 0;
+    } else {
+        counts.r = 0;
+        counts.s = (static_trust > 0) ? (int)round((1.0 / static_trust) - 2.0) : 99;
+    }
+    return counts;
+}
 
-    if (min_avg_trust > 1.0) {
-        plugin_log(MOSQ_LOG_INFO, "[PATH_FIND] No path found from '%s' to '%s'.", start_id, end_id);
-        return 0.0;
+typedef struct { int source; int target; trust_link_t counts; } map_edge_t;
+
+/**
+ * Lays the parsed edges out in CSR form with a counting sort on the source
+ * node. Links keep their file order within each source.
+ */
+static bool graph_build_links(network_graph_t *graph, const map_edge_t *edges, int edge_count) {
+    int node_count = graph->node_count;
+    int *cursor = malloc((size_t)node_count * sizeof(*cursor));
+    graph->link_offset = calloc((size_t)node_count + 1, sizeof(*graph->link_offset));
+    graph->link_target = malloc((size_t)edge_count * sizeof(*graph->link_target));
+    graph->links = malloc((size_t)edge_count * sizeof(*graph->links));
+    if (!cursor || !graph->link_offset || !graph->link_target || !graph->links) {
+        free(cursor);
+        return false;
     }
-    
-    plugin_log(MOSQ_LOG_DEBUG, "[PATH_FIND] Final least-trustworthy path score for %s -> %s is %.3f", start_id, end_id, min_avg_trust);
-    return min_avg_trust;
+
+    for (int e = 0; e < edge_count; e++) graph->link_offset[edges[e].source + 1]++;
+    for (int u = 0; u < node_count; u++) {
+        graph->link_offset[u + 1] += graph->link_offset[u];
+        cursor[u] = graph->link_offset[u];
+    }
+    for (int e = 0; e < edge_count; e++) {
+        int k = cursor[edges[e].source]++;
+        graph->link_target[k] = edges[e].target;
+        graph->links[k] = edges[e].counts;
+    }
+    graph->link_count = edge_count;
+    free(cursor);
+    return true;
 }
 
-void load_network_graph(const char *map_filename) {
+/**
+ * Parses the map into `graph` in a single read of the file. Returns false if
+ * the file can't be read, has a malformed or unterminated line (e.g. the
+ * aggregator is still writing it), defines no links, or memory runs out;
+ * `graph` then holds a partial graph the caller must free.
+ */
+bool load_network_graph(const char *map_filename, network_graph_t *graph) {
     FILE *map_fp = fopen(map_filename, "r");
-    if (!map_fp) { return; }
-    memset(network_graph, 0, sizeof(network_graph));
-    node_count = 0;
+    if (!map_fp) { return false; }
+    graph_free(graph);
+
+    map_edge_t *edges = NULL;
+    int edge_count = 0, edge_capacity = 0, node_capacity = 0;
+    bool ok = true;
     char line[512];
     while (fgets(line, sizeof(line), map_fp)) {
-        if (line[0] == '#') continue;
-        char temp_line[512]; strcpy(temp_line, line);
-        char *source_id = strtok(temp_line, ",");
-        char *dest_id = strtok(NULL, ",");
-        if (source_id && find_node_index(source_id) == -1) { strncpy(network_graph[node_count++].broker_id, source_id, 31); }
-        if (dest_id && find_node_index(dest_id) == -1) { strncpy(network_graph[node_count++].broker_id, dest_id, 31); }
-    }
-    fseek(map_fp, 0, SEEK_SET);
-    while (fgets(line, sizeof(line), map_fp)) {
-        if (line[0] == '#') continue;
+        if (line[strlen(line) - 1] != '\n') { ok = false; break; }
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') continue;
         char *source_id = strtok(line, ",");
         char *dest_id = strtok(NULL, ",");
-        char *trust_str = strtok(NULL, ",");
-        if (source_id && dest_id && trust_str) {
-            int source_idx = find_node_index(source_id);
-            if (source_idx != -1 && network_graph[source_idx].link_count < MAX_LINKS_PER_NODE) {
-                trust_link_t *link = &network_graph[source_idx].links[network_graph[source_idx].link_count++];
-                strncpy(link->target_broker_id, dest_id, 31);
-                double static_trust = atof(trust_str);
-                if (static_trust > 0.5) {
-                    link->r = (int)round((2 * static_trust - 1) / (1 - static_trust));
-                    link->s = 0;
-                } else {
-                    link->r = 0;
-                    link->s = (static_trust > 0) ? (int)round((1.0 / static_trust) - 2.0) : 99;
-                }
-            }
+        char *trust_str = strtok(NULL, ",\r\n");
+        char *trust_end = NULL;
+        double static_trust = trust_str ? strtod(trust_str, &trust_end) : 0.0;
+        if (!source_id || !dest_id || !trust_str || trust_end == trust_str) { ok = false; break; }
+
+        int source_idx = intern_node(graph, &node_capacity, source_id);
+        int dest_idx = intern_node(graph, &node_capacity, dest_id);
+        if (source_idx == -1 || dest_idx == -1) { ok = false; break; }
+        if (edge_count == edge_capacity) {
+            int new_capacity = edge_capacity ? edge_capacity * 2 : 64;
+            map_edge_t *grown = realloc(edges, (size_t)new_capacity * sizeof(*grown));
+            if (!grown) { ok = false; break; }
+            edges = grown;
+            edge_capacity = new_capacity;
         }
+        edges[edge_count++] = (map_edge_t){ source_idx, dest_idx, static_trust_counts(static_trust) };
     }
+    if (ferror(map_fp)) ok = false;
     fclose(map_fp);
-}
 
-void load_acl_file(const char *filename) {
-    FILE *fp = fopen(filename, "r");
-    if (!fp) { return; }
-    char line[512];
-    acl_rule_count = 0;
-    while (fgets(line, sizeof(line), fp) && acl_rule_count < MAX_ACL_RULES) {
-        line[strcspn(line, "\r\n")] = 0;
-        if (line[0] == '#' || strlen(line) < 5) continue;
-        char *client = strtok(line, ",");
-        char *access = strtok(NULL, ",");
-        char *topic = strtok(NULL, ",");
-        if (client && access && topic) {
-            strncpy(acl_rules[acl_rule_count].client_id, client, sizeof(acl_rules[0].client_id)-1);
-            strncpy(acl_rules[acl_rule_count].access, access, sizeof(acl_rules[0].access)-1);
-            strncpy(acl_rules[acl_rule_count].topic, topic, sizeof(acl_rules[0].topic)-1);
-            acl_rule_count++;
-        }
-    }
-    fclose(fp);
+    ok = ok && edge_count > 0 && graph_build_links(graph, edges, edge_count);
+    free(edges);
+    return ok;
 }
 
-void compute_hmac(const char *data, size_t data_len, char *hmac_hex_out) {
-    unsigned char hmac[EVP_MAX_MD_SIZE];
-    unsigned int hmac_len = 0;
-    HMAC(EVP_sha256(), hmac_key, (int)strlen(hmac_key), (const unsigned char*)data, data_len, hmac, &hmac_len);
-    static const char hex_digits[] = "0123456789abcdef";
-    for (size_t i = 0; i < hmac_len; ++i) {
-        hmac_hex_out[i*2] = hex_digits[(hmac[i] >> 4) & 0xF];
-        hmac_hex_out[i*2+1] = hex_digits[hmac[i] & 0xF];
+// =================================================================================
+// SHARED TRUST SEGMENT
+// The graph is loaded from the segment with the segment's own node and link
+// order, so an index means the same link in every broker and counters are
+// exchanged by index.
+// =================================================================================
+
+static uint64_t stamp_tag(const file_stamp_t *stamp) {
+    uint64_t fields[4] = { (uint64_t)stamp->ino, (uint64_t)stamp->size,
+                           (uint64_t)stamp->mtime.tv_sec, (uint64_t)stamp->mtime.tv_nsec };
+    uint64_t tag = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < 4; i++) {
+        tag ^= fields[i];
+        tag *= 0x100000001b3ULL;
     }
-    hmac_hex_out[hmac_len*2] = '\0';
+    return tag;
 }
 
-bool check_permission(const char *client_id, const char *topic, bool is_publish) {
-    const char *access = is_publish ? "pub" : "sub";
-    for (int i = 0; i < acl_rule_count; i++) {
-        if (strcmp(acl_rules[i].client_id, client_id) == 0 && strcmp(acl_rules[i].access, access) == 0 && strcmp(acl_rules[i].topic, topic) == 0) {
-            return true;
-        }
+/**
+ * Offers the topology of a graph parsed from the map file to the segment.
+ * This is a no-op if another broker already shared the same map.
+ */
+static bool shm_share_topology(const network_graph_t *graph) {
+    trust_shm_topology_t topo = { 0, graph->node_count, graph->link_count, NULL,
+                                  graph->link_offset, graph->link_target, NULL };
+    topo.names = calloc((size_t)graph->node_count, sizeof(*topo.names));
+    topo.counts = malloc((size_t)graph->link_count * sizeof(*topo.counts));
+    bool ok = topo.names && topo.counts;
+    for (int i = 0; ok && i < graph->node_count; i++) {
+        ok = strlen(graph->nodes[i]->id) < TRUST_SHM_ID_LEN;
+        if (ok) strcpy(topo.names[i], graph->nodes[i]->id);
     }
-    return false;
+    for (int k = 0; ok && k < graph->link_count; k++) {
+        topo.counts[k] = (trust_shm_counts_t){ graph->links[k].r, graph->links[k].s };
+    }
+    ok = ok && trust_shm_write_topology(&topo, stamp_tag(&network_map_stamp));
+    free(topo.names);
+    free(topo.counts);
+    return ok;
 }
 
-bool string_in_array(cJSON *array, const char *str) {
-    if (!cJSON_IsArray(array)) return false;
-    cJSON *element;
-    cJSON_ArrayForEach(element, array) {
-        if (cJSON_IsString(element) && strcmp(element->valuestring, str) == 0) return true;
+static bool graph_from_topology(network_graph_t *graph, const trust_shm_topology_t *topo) {
+    graph_free(graph);
+    int node_capacity = 0;
+    for (int i = 0; i < topo->node_count; i++) {
+        if (intern_node(graph, &node_capacity, topo->names[i]) != i) return false;
     }
-    return false;
+    int node_count = topo->node_count, link_count = topo->link_count;
+    graph->link_offset = malloc((size_t)(node_count + 1) * sizeof(*graph->link_offset));
+    graph->link_target = malloc((size_t)link_count * sizeof(*graph->link_target));
+    graph->links = malloc((size_t)link_count * sizeof(*graph->links));
+    if (!graph->link_offset || !graph->link_target || !graph->links) return false;
+    memcpy(graph->link_offset, topo->link_offset, (size_t)(node_count + 1) * sizeof(*graph->link_offset));
+    memcpy(graph->link_target, topo->link_target, (size_t)link_count * sizeof(*graph->link_target));
+    for (int k = 0; k < link_count; k++) {
+        graph->links[k] = (trust_link_t){ topo->counts[k].r, topo->counts[k].s };
+    }
+    graph->link_count = link_count;
+    return true;
 }
 
-void handle_feedback(const char *payload) {
-    if (!payload) return;
-    cJSON *root = cJSON_Parse(payload);
-    if (!root) { return; }
-    cJSON *source_item = cJSON_GetObjectItemCaseSensitive(root, "source");
-    cJSON *target_item = cJSON_GetObjectItemCaseSensitive(root, "target");
-    cJSON *feedback_item = cJSON_GetObjectItemCaseSensitive(root, "feedback");
-    if (!cJSON_IsString(source_item) || !cJSON_IsString(target_item) || !cJSON_IsString(feedback_item)) {
-        cJSON_Delete(root); return;
-    }
-    const char *source_id = source_item->valuestring;
-    const char *target_id = target_item->valuestring;
-    const char *feedback = feedback_item->valuestring;
-    if (strcmp(target_id, broker_id) != 0) { cJSON_Delete(root); return; }
-    int source_idx = find_node_index(source_id);
-    if (source_idx == -1) { cJSON_Delete(root); return; }
-    trust_link_t* target_link = NULL;
-    for (int i = 0; i < network_graph[source_idx].link_count; i++) {
-        if (strcmp(network_graph[source_idx].links[i].target_broker_id, target_id) == 0) {
-            target_link = &network_graph[source_idx].links[i];
-            break;
-        }
-    }
-    if (!target_link) { cJSON_Delete(root); return; }
-    if (strcmp(feedback, "positive") == 0) { target_link->r++; } 
-    else if (strcmp(feedback, "negative") == 0) { target_link->s += NEGATIVE_MULTIPLIER_MU; }
-    
-    plugin_log(MOSQ_LOG_INFO, "[TRUST] Feedback for link %s->%s. New counts: r=%d, s=%d. Link trust now %.3f",
-              source_id, target_id, target_link->r, target_link->s, calculate_trust(target_link->r, target_link->s));
+/**
+ * Shares the map file's topology with the segment, then loads the graph back
+ * from the segment, setting `shared` and the segment `layout` it was read at.
+ * If the segment can't be used the graph parsed from the map stands.
+ */
+static bool load_shared_graph(network_graph_t *graph, bool *shared, uint32_t *layout) {
+    bool map_loaded = load_network_graph(network_map_file, graph);
+    if (map_loaded && !shm_share_topology(graph)) {
+        plugin_log(MOSQ_LOG_WARNING, "[SHM] Could not share the network map through %s (%d brokers, %d links).",
+                   trust_shm_file, graph->node_count, graph->link_count);
+    }
 
-    cJSON_Delete(root);
-    save_local_trust_store();
+    trust_shm_topology_t topo;
+    network_graph_t copy = { 0 };
+    *shared = trust_shm_read_topology(&topo) && graph_from_topology(&copy, &topo);
+    if (*shared) {
+        *layout = topo.layout;
+        graph_free(graph);
+        *graph = copy;
+    } else {
+        graph_free(&copy);
+        plugin_log(MOSQ_LOG_WARNING, "[SHM] Could not read the graph from %s. Using the network map file.", trust_shm_file);
+    }
+    trust_shm_topology_free(&topo);
+    return *shared || map_loaded;
 }
 
 /**
- * This callback runs periodically (every second) and triggers a refresh
- * of the network map from disk if the interval has passed.
+ * Publishes the counters of links into this broker, if they changed since
+ * they were last published.
  */
-static int callback_tick(int event, void *event_data, void *userdata) {
-    UNUSED(event);
-    UNUSED(event_data);
-    UNUSED(userdata);
-
-    time_t current_time = time(NULL);
-    if (current_time - last_map_refresh_time >= MAP_REFRESH_INTERVAL_SECONDS) {
-        plugin_log(MOSQ_LOG_DEBUG, "[REFRESH] Periodic map refresh triggered.");
-        
-        // The order is important: load the global map first, then
-        // overwrite it with our specific, authoritative local knowledge.
-        load_network_graph(network_map_file);
-        load_local_trust_store();
-        
-        last_map_refresh_time = current_time;
+static void shm_publish_local(void) {
+    if (!shm_graph_live || !shm_publish_pending || self_idx == -1) return;
+    if (!trust_shm_publish_begin(shm_layout, self_idx)) return;
+    for (int i = 0; i < network_graph->node_count; i++) {
+        const trust_link_t *link = find_link(i, self_idx);
+        if (link) trust_shm_publish_link((int)(link - network_graph->links), link->r, link->s);
     }
-    return MOSQ_ERR_SUCCESS;
+    trust_shm_publish_end(self_idx);
+    shm_publish_pending = false;
 }
 
-static int callback_message(int event, void *event_data, void *userdata) 
-{
-    struct mosquitto_evt_message *ed = event_data;
-    UNUSED(event); UNUSED(userdata);
-
-    if (strcmp(ed->topic, "internal/feedback") == 0) {
-        char *payload_str = strndup((const char *)ed->payload, ed->payloadlen);
-        if (payload_str) { handle_feedback(payload_str); free(payload_str); }
-        ed->topic = mosquitto_strdup("internal/feedback/processed");
-        return MOSQ_ERR_SUCCESS;
-    }
+/**
+ * Copies in the counters other brokers published since the last pull. Links
+ * into this broker are left alone, since they are only ever written here.
+ * Returns false if the segment's topology moved on and the graph must be
+ * reloaded.
+ */
+static bool shm_pull_counts(void) {
+    uint64_t generation = trust_shm_generation();
+    if (generation == shm_generation) return trust_shm_layout() == shm_layout;
 
-    if (!ed->payload || ed->payloadlen < 2 || ((char *)ed->payload)[0] != '{') {
-        return MOSQ_ERR_SUCCESS;
+    bool changed = false;
+    for (int u = 0; u < network_graph->node_count; u++) {
+        for (int k = network_graph->link_offset[u]; k < network_graph->link_offset[u + 1]; k++) {
+            if (network_graph->link_target[k] == self_idx) continue;
+            trust_shm_counts_t counts;
+            if (!trust_shm_read_link(k, &counts)) return trust_shm_layout() == shm_layout;
+            trust_link_t *link = &network_graph->links[k];
+            if (link->r != counts.r || link->s != counts.s) {
+                link->r = counts.r;
+                link->s = counts.s;
+                changed = true;
+            }
+        }
     }
-    
-    char *payload_copy = strndup((const char *)ed->payload, ed->payloadlen);
-    if (!payload_copy) return MOSQ_ERR_NOMEM;
-
-    cJSON *root = cJSON_Parse(payload_copy);
-    if (!root) { free(payload_copy); return MOSQ_ERR_SUCCESS; }
-    
-    cJSON *hmac_field = cJSON_GetObjectItemCaseSensitive(root, "hmac");
-    if (!hmac_field || !cJSON_IsString(hmac_field)) {
-        cJSON_Delete(root); free(payload_copy); return MOSQ_ERR_ACL_DENIED;
+    // Counters read across a topology rewrite are discarded with the graph.
+    if (trust_shm_layout() != shm_layout) return false;
+    shm_generation = generation;
+    if (changed) {
+        reset_path_cache();
+        plugin_log(MOSQ_LOG_DEBUG, "[SHM] Picked up link counters published by other brokers.");
     }
-    char *received_hmac = strdup(hmac_field->valuestring);
-    cJSON_DeleteItemFromObject(root, "hmac");
-    char *json_str_for_hmac = cJSON_PrintUnformatted(root);
-    char computed_hmac[EVP_MAX_MD_SIZE * 2 + 1] = {0};
-    compute_hmac(json_str_for_hmac, strlen(json_str_for_hmac), computed_hmac);
+    return true;
+}
 
-    if (strcmp(computed_hmac, received_hmac) != 0) {
-        free(received_hmac); free(json_str_for_hmac); cJSON_Delete(root); free(payload_copy);
-        return MOSQ_ERR_ACL_DENIED;
+static void hex_encode(const unsigned char *in, size_t len, char *out) {
+    static const char hex_digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; ++i) {
+        out[i*2] = hex_digits[(in[i] >> 4) & 0xF];
+        out[i*2+1] = hex_digits[in[i] & 0xF];
     }
-    free(received_hmac); free(json_str_for_hmac);
+    out[len*2] = '\0';
+}
 
-    cJSON *c_item = cJSON_GetObjectItemCaseSensitive(root, "c");
-    if (!c_item || !cJSON_IsString(c_item) || !check_permission(c_item->valuestring, ed->topic, true)) {
-        cJSON_Delete(root); free(payload_copy); 
-        return MOSQ_ERR_ACL_DENIED;
-    }
+void compute_hmac(const trust_hmac_key_t *key, const char *data, size_t data_len, char *hmac_hex_out) {
+    hmac_span_t span = { data, data_len };
+    compute_hmac_spans(key, &span, 1, hmac_hex_out);
+}
 
-    cJSON *S_item = cJSON_GetObjectItemCaseSensitive(root, "S");
-    cJSON *b_item = cJSON_GetObjectItemCaseSensitive(root, "b");
-    bool is_local_origin = (b_item && cJSON_IsString(b_item) && strcmp(b_item->valuestring, broker_id) == 0);
+/**
+ * Hex HMAC-SHA256 over the concatenation of several byte spans, so callers can
+ * MAC a payload with a member cut out without copying it first.
+ */
+void compute_hmac_spans(const trust_hmac_key_t *key, const hmac_span_t *spans, int span_count, char *hmac_hex_out) {
+    unsigned char hmac[EVP_MAX_MD_SIZE];
+    size_t hmac_len = compute_hmac_raw(key, spans, span_count, hmac);
+    hex_encode(hmac, hmac_len, hmac_hex_out);
+}
 
-    if (!is_local_origin) {
-        char signers_str[512] = {0};
-        cJSON *signer_log_item;
-        cJSON_ArrayForEach(signer_log_item, S_item) {
-            if (cJSON_IsString(signer_log_item)) {
-                strcat(signers_str, signer_log_item->valuestring);
-                strcat(signers_str, " ");
-            }
-        }
-        plugin_log(MOSQ_LOG_INFO, "[TRUST] Evaluating message with signers: [ %s]", signers_str);
+/**
+ * Raw HMAC-SHA256 over several byte spans with a key from the keyring (see
+ * keyring_find()). Returns the MAC length (0 on failure).
+ */
+size_t compute_hmac_raw(const trust_hmac_key_t *key, const hmac_span_t *spans, int span_count, unsigned char *hmac_out) {
+    return trust_hmac_keyed(key, spans, span_count, hmac_out);
+}
 
-        plugin_log(MOSQ_LOG_INFO, "[TRUST] Evaluating message based on last signer only.");
+// =================================================================================
+// RAW TOKEN SCANNING
+// Walks the top level of a JSON object without building a DOM, recording where
+// each member's key and value sit in the original bytes.
+// =================================================================================
 
-bool is_accepted = false;
-const char* last_signer_id = NULL;
+static const char *json_skip_ws(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+    return p;
+}
 
-// Get the last signer from the S array
-int signer_count = cJSON_GetArraySize(S_item);
-if (signer_count > 0) {
-    cJSON *last_signer_item = cJSON_GetArrayItem(S_item, signer_count - 1);
-    if (cJSON_IsString(last_signer_item)) {
-        last_signer_id = last_signer_item->valuestring;
+static const char *json_skip_string(const char *p, const char *end) {
+    if (p >= end || *p != '"') return NULL;
+    for (p++; p < end; p++) {
+        if (*p == '\\') { p++; continue; }
+        if (*p == '"') return p + 1;
     }
+    return NULL;
 }
 
-if (last_signer_id) {
-    // Get the direct trust score of the last signer
-    double direct_trust = get_direct_trust_score(last_signer_id, broker_id);
-    
-    // Compare the direct trust against the threshold
-    if (direct_trust >= LOCAL_THRESHOLD_THETA) {
-        plugin_log(MOSQ_LOG_INFO, "[TRUST] ✅ Last signer '%s' is trusted (%.3f >= %.3f). Accepting message.", 
-                   last_signer_id, direct_trust, LOCAL_THRESHOLD_THETA);
-        is_accepted = true;
-    } else {
-        plugin_log(MOSQ_LOG_INFO, "[TRUST] ❌ Last signer '%s' is not trusted (%.3f < %.3f).", 
-                   last_signer_id, direct_trust, LOCAL_THRESHOLD_THETA);
+static const char *json_skip_value(const char *p, const char *end, int depth) {
+    if (p >= end) return NULL;
+    if (*p == '"') return json_skip_string(p, end);
+    if (*p == '{' || *p == '[') {
+        char close = (*p == '{') ? '}' : ']';
+        if (depth >= MAX_TOKEN_DEPTH) return NULL;
+        p = json_skip_ws(p + 1, end);
+        if (p < end && *p == close) return p + 1;
+        while (p < end) {
+            if (close == '}') {
+                p = json_skip_string(p, end);
+                if (!p) return NULL;
+                p = json_skip_ws(p, end);
+                if (p >= end || *p != ':') return NULL;
+                p = json_skip_ws(p + 1, end);
+            }
+            p = json_skip_value(p, end, depth + 1);
+            if (!p) return NULL;
+            p = json_skip_ws(p, end);
+            if (p >= end) return NULL;
+            if (*p == close) return p + 1;
+            if (*p != ',') return NULL;
+            p = json_skip_ws(p + 1, end);
+        }
+        return NULL;
     }
-} else {
-    plugin_log(MOSQ_LOG_WARNING, "[TRUST] ❌ Message has no signers to evaluate.");
+    // Numbers and literals: consume up to the next delimiter.
+    const char *start = p;
+    while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') p++;
+    return (p > start) ? p : NULL;
 }
 
-if (!is_accepted) {
-    plugin_log(MOSQ_LOG_WARNING, "[TRUST] ❌ Dropping message. Last signer check failed.");
-    cJSON_Delete(root); 
-    free(payload_copy); 
-    return MOSQ_ERR_ACL_DENIED;
+static bool raw_token_scan(const char *json, size_t len, raw_token_t *tok) {
+    const char *end = json + len;
+    const char *p = json_skip_ws(json, end);
+    tok->member_count = 0;
+    if (p >= end || *p != '{') return false;
+    p = json_skip_ws(p + 1, end);
+    if (p < end && *p == '}') return json_skip_ws(p + 1, end) == end;
+    while (p < end) {
+        if (tok->member_count >= MAX_TOKEN_MEMBERS) return false;
+        raw_member_t *m = &tok->members[tok->member_count];
+        m->start = p;
+        const char *key_end = json_skip_string(p, end);
+        if (!key_end) return false;
+        m->key = p + 1;
+        m->key_len = (size_t)(key_end - p - 2);
+        p = json_skip_ws(key_end, end);
+        if (p >= end || *p != ':') return false;
+        p = json_skip_ws(p + 1, end);
+        m->value = p;
+        p = json_skip_value(p, end, 1);
+        if (!p) return false;
+        m->value_len = (size_t)(p - m->value);
+        m->end = p;
+        tok->member_count++;
+        p = json_skip_ws(p, end);
+        if (p >= end) return false;
+        if (*p == '}') return json_skip_ws(p + 1, end) == end;
+        if (*p != ',') return false;
+        p = json_skip_ws(p + 1, end);
+    }
+    return false;
 }
+
+static const raw_member_t *raw_token_member(const raw_token_t *tok, const char *key) {
+    size_t key_len = strlen(key);
+    for (int i = 0; i < tok->member_count; i++) {
+        if (tok->members[i].key_len == key_len && memcmp(tok->members[i].key, key, key_len) == 0) {
+            return &tok->members[i];
+        }
     }
+    return NULL;
+}
 
-    if (!string_in_array(S_item, broker_id)) {
-        cJSON_AddItemToArray(S_item, cJSON_CreateString(broker_id));
+/**
+ * Number of elements in a raw array value, or -1 if the value isn't an array.
+ * If the last element is a string, its contents are returned through `last`
+ * (escapes left as they are); otherwise `last` is set to NULL.
+ */
+static int raw_array_scan(const raw_member_t *m, const char **last, size_t *last_len) {
+    *last = NULL;
+    *last_len = 0;
+    if (m->value[0] != '[') return -1;
+    const char *end = m->value + m->value_len - 1;
+    const char *p = json_skip_ws(m->value + 1, end);
+    int count = 0;
+    while (p && p < end) {
+        const char *elem = p;
+        p = json_skip_value(p, end, 2);
+        count++;
+        if (!p) break;
+        bool is_string = *elem == '"' && p - elem >= 2;
+        *last = is_string ? elem + 1 : NULL;
+        *last_len = is_string ? (size_t)(p - elem - 2) : 0;
+        p = json_skip_ws(p, end);
+        if (p < end && *p == ',') p = json_skip_ws(p + 1, end);
     }
+    return count;
+}
 
-    char *updated_payload_no_hmac = cJSON_PrintUnformatted(root);
-    char new_hmac[EVP_MAX_MD_SIZE * 2 + 1] = {0};
-    compute_hmac(updated_payload_no_hmac, strlen(updated_payload_no_hmac), new_hmac);
-    cJSON_AddStringToObject(root, "hmac", new_hmac);
+/**
+ * True if the text nests objects/arrays deeper than `limit`. Only brackets
+ * outside strings count; the text is not otherwise validated.
+ */
+static bool json_exceeds_depth(const char *p, size_t len, int limit) {
+    int depth = 0;
+    bool in_string = false;
+    for (const char *end = p + len; p < end; p++) {
+        if (in_string) {
+            if (*p == '\\') p++;
+            else if (*p == '"') in_string = false;
+        } else if (*p == '"') {
+            in_string = true;
+        } else if (*p == '{' || *p == '[') {
+            if (++depth > limit) return true;
+        } else if (*p == '}' || *p == ']') {
+            depth--;
+        }
+    }
+    return false;
+}
 
-    char *final_payload = cJSON_PrintUnformatted(root);
-    if (final_payload) {
-        ed->payload = mosquitto_strdup(final_payload);
-        ed->payloadlen = (uint32_t)strlen(final_payload);
-        free(final_payload);
+/**
+ * Byte range to drop from the token to get the MAC input: the member itself
+ * plus the comma that separates it from its neighbour.
+ */
+static void raw_token_cut(const raw_token_t *tok, const raw_member_t *m, const char **cut_start, const char **cut_end) {
+    int idx = (int)(m - tok->members);
+    if (idx > 0) {
+        *cut_start = tok->members[idx - 1].end;
+        *cut_end = m->end;
+    } else if (tok->member_count > 1) {
+        *cut_start = m->start;
+        *cut_end = tok->members[1].start;
+    } else {
+        *cut_start = m->start;
+        *cut_end = m->end;
     }
+}
 
-    cJSON_Delete(root);
-    free(payload_copy);
-    free(updated_payload_no_hmac);
+static const raw_member_t *raw_token_hmac(const raw_token_t *tok) {
+    const raw_member_t *h = raw_token_member(tok, "hmac");
+    if (!h || h->value_len != HMAC_HEX_LEN + 2 || h->value[0] != '"') return NULL;
+    return h;
+}
 
-    return MOSQ_ERR_SUCCESS;
+/**
+ * The key named by the token's "kid", or the default key if it has none.
+ * NULL if the key ID is unknown or not a plain string.
+ */
+static const trust_hmac_key_t *raw_token_key(const raw_token_t *tok) {
+    const raw_member_t *kid = raw_token_member(tok, "kid");
+    if (!kid) return keyring_find(NULL, 0);
+    if (kid->value[0] != '"' || memchr(kid->value, '\\', kid->value_len)) return NULL;
+    return keyring_find(kid->value + 1, kid->value_len - 2);
 }
 
-// =================================================================================
-// PLUGIN LIFECYCLE FUNCTIONS (SIMPLIFIED)
-// =================================================================================
+static const trust_hmac_key_t *json_token_key(cJSON *root) {
+    cJSON *kid = cJSON_GetObjectItemCaseSensitive(root, "kid");
+    if (!kid) return keyring_find(NULL, 0);
+    return cJSON_IsString(kid) ? keyring_find(kid->valuestring, strlen(kid->valuestring)) : NULL;
+}
 
-int mosquitto_plugin_version(int supported_version_count, const int *supported_versions) {
-    for (int i = 0; i < supported_version_count; i++) {
-        if (supported_versions[i] == 5) return 5;
+/**
+ * Parses `len` decimal digits as a msg_id. Returns false for an empty value,
+ * any other character, or a value past what this accepts of 32 bits.
+ */
+static bool parse_msg_id(const char *value, size_t len, uint32_t *msg_id) {
+    *msg_id = 0;
+    if (len == 0) return false;
+    for (size_t i = 0; i < len; i++) {
+        if (value[i] < '0' || value[i] > '9' || *msg_id > (UINT32_MAX - 9) / 10) return false;
+        *msg_id = *msg_id * 10 + (uint32_t)(value[i] - '0');
     }
-    return -1;
+    return true;
 }
 
-int mosquitto_plugin_init(mosquitto_plugin_id_t *identifier, void **user_data, struct mosquitto_opt *opts, int opt_count) {
-    UNUSED(user_data);
-    mosq_pid = identifier;
-
+/**
+ * Reads the replay identity of a scanned token. Returns false if "b" or "c"
+ * is not a string or "msg_id" is not an unsigned 32-bit integer.
+ */
+static bool raw_token_replay_id(const raw_token_t *tok, replay_id_t *id) {
+    const raw_member_t *b = raw_token_member(tok, "b");
+    const raw_member_t *c = raw_token_member(tok, "c");
+    const raw_member_t *m = raw_token_member(tok, "msg_id");
+    if (!b || !c || !m || b->value[0] != '"' || c->value[0] != '"') return false;
+    uint32_t msg_id;
+    if (!parse_msg_id(m->value, m->value_len, &msg_id)) return false;
+    *id = replay_make_id(b->value + 1, b->value_len - 2, c->value + 1, c->value_len - 2, msg_id);
+    return true;
+}
+
+/**
+ * Same as raw_token_replay_id, for a parsed token.
+ */
+static bool json_token_replay_id(cJSON *root, replay_id_t *id) {
+    cJSON *b = cJSON_GetObjectItemCaseSensitive(root, "b");
+    cJSON *c = cJSON_GetObjectItemCaseSensitive(root, "c");
+    cJSON *m = cJSON_GetObjectItemCaseSensitive(root, "msg_id");
+    if (!cJSON_IsString(b) || !cJSON_IsString(c) || !cJSON_IsNumber(m)) return false;
+    if (m->valuedouble < 0 || m->valuedouble > UINT32_MAX) return false;
+    *id = replay_make_id(b->valuestring, strlen(b->valuestring), c->valuestring, strlen(c->valuestring), (uint32_t)m->valuedouble);
+    return true;
+}
+
+/**
+ * True, with a log line, if the token was already accepted or is too old.
+ */
+static bool is_replay(const replay_id_t *id) {
+    if (!replay_seen(id)) return false;
+    plugin_log(MOSQ_LOG_DEBUG, "[REPLAY] Dropping duplicate or replayed token (msg_id %u).", id->msg_id);
+    return true;
+}
+
+/**
+ * Counts a denied message under `reason` and returns the deny verdict. Every
+ * denial is counted once, where it is decided: admission_reject() and
+ * evaluate_last_signer() count their own.
+ */
+static int deny(metric_counter_t reason) {
+    metrics_count(reason);
+    return MOSQ_ERR_ACL_DENIED;
+}
+
+/**
+ * Lets a message that carries no token through unverified. callback_message()
+ * counts it as passed through rather than accepted.
+ */
+static int pass_through(void) {
+    passed_through = true;
+    return MOSQ_ERR_SUCCESS;
+}
+
+/**
+ * deny() for a token that failed its key lookup or MAC check. Its signer was
+ * never authenticated, so the share it was charged to gets the token back.
+ */
+static int deny_unverified(metric_counter_t reason) {
+    if (shaped_signer_len > 0) shape_refund(shaped_signer, shaped_signer_len);
+    shaped_signer_len = 0;
+    return deny(reason);
+}
+
+/**
+ * Charges the time since the last stage boundary to `stage`.
+ */
+static void stage_end(metric_stage_t stage) {
+    if (!stage_clock) return;
+    uint64_t now = metrics_now();
+    stage_ns[stage] += now - stage_clock;
+    stage_mask |= 1u << stage;
+    stage_clock = now;
+}
+
+static bool admission_reject(reject_reason_t reason) {
+    admission_rejects[reason]++;
+    metrics_count(reject_metrics[reason]);
+    metrics_count(METRIC_DENIED_ADMISSION);
+    return false;
+}
+
+/**
+ * Limits that apply to every message: payload size, then the rate limits.
+ * Oversized messages are rejected without spending a rate token.
+ */
+static bool admit_message(const struct mosquitto_evt_message *ed) {
+    if (max_token_size > 0 && ed->payloadlen > (uint32_t)max_token_size) return admission_reject(REJECT_SIZE);
+    switch (admit_take(ed->client, ed->client ? mosquitto_client_address(ed->client) : NULL)) {
+        case ADMIT_CLIENT_RATE: return admission_reject(REJECT_CLIENT_RATE);
+        case ADMIT_SOURCE_RATE: return admission_reject(REJECT_SOURCE_RATE);
+        default: return true;
+    }
+}
+
+static bool admit_signer_count(int signer_count) {
+    if (max_token_signers > 0 && signer_count > max_token_signers) return admission_reject(REJECT_SIGNERS);
+    return true;
+}
+
+/**
+ * Charges a message to the trust-weighted share of the signer that forwarded
+ * it, weighted by the direct trust this broker holds in that signer. Signers
+ * that aren't in the network map all share SHAPE_UNKNOWN_SIGNER, so made-up
+ * names can't grow the table. Messages with no signer yet, or last signed by
+ * this broker, are not shaped.
+ */
+static bool admit_signer_share(const char *signer, size_t signer_len) {
+    shaped_signer_len = 0;
+    if (!shape_enabled() || !signer || signer_len == 0) return true;
+    char signer_id[sizeof(shaped_signer)];
+    int signer_idx = -1;
+    if (signer_len < sizeof(signer_id)) {
+        memcpy(signer_id, signer, signer_len);
+        signer_id[signer_len] = '\0';
+        if (strcmp(signer_id, broker_id) == 0) return true;
+        signer_idx = find_node_index(signer_id);
+    }
+    if (signer_idx == -1) {
+        signer = SHAPE_UNKNOWN_SIGNER;
+        signer_len = strlen(SHAPE_UNKNOWN_SIGNER);
+    }
+
+    double weight = signer_idx != -1 ? trust_table[signer_idx].trust : default_decision.trust;
+    if (!shape_take(signer, signer_len, weight)) return admission_reject(REJECT_SHAPED);
+    memcpy(shaped_signer, signer, signer_len);
+    shaped_signer_len = signer_len;
+    return true;
+}
+
+/**
+ * Structural limits and the signer share for a JSON payload, checked on the
+ * raw bytes. `tok` is the scanned token, or NULL if the payload didn't scan
+ * as one.
+ */
+static bool admit_json_token(const char *payload, size_t len, const raw_token_t *tok) {
+    if (max_token_depth > 0 && json_exceeds_depth(payload, len, max_token_depth)) return admission_reject(REJECT_DEPTH);
+    const raw_member_t *S = tok ? raw_token_member(tok, "S") : NULL;
+    if (!S) return true;
+    const char *last_signer;
+    size_t last_signer_len;
+    return admit_signer_count(raw_array_scan(S, &last_signer, &last_signer_len))
+        && admit_signer_share(last_signer, last_signer_len);
+}
+
+/**
+ * Logs the rejections counted since the last report, if there were any.
+ */
+static void report_admission_rejects(void) {
+    bool changed = false;
+    unsigned long delta[REJECT_REASON_COUNT];
+    for (int i = 0; i < REJECT_REASON_COUNT; i++) {
+        delta[i] = admission_rejects[i] - admission_rejects_reported[i];
+        admission_rejects_reported[i] = admission_rejects[i];
+        if (delta[i]) changed = true;
+    }
+    if (!changed) return;
+    plugin_log(MOSQ_LOG_WARNING, "[ADMIT] Rejected in the last %ds: size=%lu depth=%lu signers=%lu client_rate=%lu source_rate=%lu shaped=%lu",
+               ADMISSION_REPORT_INTERVAL_SECONDS, delta[REJECT_SIZE], delta[REJECT_DEPTH], delta[REJECT_SIGNERS],
+               delta[REJECT_CLIENT_RATE], delta[REJECT_SOURCE_RATE], delta[REJECT_SHAPED]);
+}
+
+static void publish_metric(const char *topic, const char *value, void *arg) {
+    UNUSED(arg);
+    char sys_topic[320];
+    snprintf(sys_topic, sizeof(sys_topic), "$SYS/trust/%s", topic);
+    mosquitto_broker_publish_copy(NULL, sys_topic, (int)strlen(value), value, 0, true, NULL);
+}
+
+/**
+ * True if the raw array value holds the string `str` (compared without
+ * unescaping, as broker IDs contain no escapes).
+ */
+static bool raw_array_contains(const raw_member_t *m, const char *str) {
+    if (m->value[0] != '[') return false;
+    size_t str_len = strlen(str);
+    const char *end = m->value + m->value_len - 1;
+    const char *p = json_skip_ws(m->value + 1, end);
+    while (p && p < end) {
+        const char *elem = p;
+        p = json_skip_value(p, end, 2);
+        if (!p) break;
+        if (*elem == '"' && (size_t)(p - elem) == str_len + 2 && memcmp(elem + 1, str, str_len) == 0) return true;
+        p = json_skip_ws(p, end);
+        if (p < end && *p == ',') p = json_skip_ws(p + 1, end);
+    }
+    return false;
+}
+
+/**
+ * Verifies the token MAC directly on the received bytes. The MAC covers the
+ * token as cJSON_PrintUnformatted emits it without "hmac", which for our
+ * compact producers is exactly the received bytes with the member (and its
+ * separating comma) cut out. Replays are dropped before the MAC is computed,
+ * and a DOM is only built once the MAC has matched.
+ */
+static int verify_token_raw(const char *payload, size_t len, const raw_token_t *tok, cJSON **root_out, replay_id_t *replay) {
+    *root_out = NULL;
+    if (!tok) return MOSQ_ERR_SUCCESS;
+    if (replay_filter_enabled && raw_token_replay_id(tok, replay) && is_replay(replay)) return deny(METRIC_DENIED_REPLAY);
+
+    const raw_member_t *h = raw_token_hmac(tok);
+    if (!h) return deny(METRIC_DENIED_MALFORMED);
+    const trust_hmac_key_t *key = raw_token_key(tok);
+    if (!key) return deny_unverified(METRIC_DENIED_KEY);
+
+    const char *cut_start, *cut_end;
+    raw_token_cut(tok, h, &cut_start, &cut_end);
+    hmac_span_t spans[2] = {
+        { payload, (size_t)(cut_start - payload) },
+        { cut_end, (size_t)(payload + len - cut_end) }
+    };
+    unsigned char mac[EVP_MAX_MD_SIZE];
+    if (compute_hmac_raw(key, spans, 2, mac) != TRUST_HMAC_LEN) {
+        return deny(METRIC_DENIED_ERROR);
+    }
+    char computed_hmac[EVP_MAX_MD_SIZE * 2 + 1];
+    hex_encode(mac, TRUST_HMAC_LEN, computed_hmac);
+    stage_end(METRIC_STAGE_HMAC);
+    if (CRYPTO_memcmp(computed_hmac, h->value + 1, HMAC_HEX_LEN) != 0) return deny_unverified(METRIC_DENIED_HMAC);
+
+#if CJSON_VERSION_NUM < 1007013
+    char *payload_copy = trust_arena_strndup(payload, len);
+    if (!payload_copy) return MOSQ_ERR_NOMEM;
+    cJSON *root = cJSON_Parse(payload_copy);
+    trust_arena_free(payload_copy);
+#else
+    cJSON *root = cJSON_ParseWithLength(payload, len);
+#endif
+    stage_end(METRIC_STAGE_PARSE);
+    if (!root) return deny(METRIC_DENIED_MALFORMED);
+    cJSON_DeleteItemFromObject(root, "hmac");
+    *root_out = root;
+    return MOSQ_ERR_SUCCESS;
+}
+
+/**
+ * Plans a re-sign of a verified raw token without re-serializing it: this
+ * broker is spliced into "S" just before its closing ']' and the "hmac" value
+ * is overwritten in place. The new MAC covers the original prefix, the
+ * insertion and the original suffix (plan->spans). Returns false when the
+ * token layout doesn't allow a splice.
+ */
+static bool resign_plan(const char *payload, size_t len, const raw_token_t *tok, bool append_signer, resign_plan_t *plan) {
+    const raw_member_t *h = raw_token_hmac(tok);
+    if (!h) return false;
+
+    plan->ins_len = 0;
+    plan->ins_off = 0;
+    if (append_signer) {
+        const raw_member_t *S = raw_token_member(tok, "S");
+        if (!S || S->value[0] != '[' || strpbrk(broker_id, "\"\\")) return false;
+        const char *close = S->value + S->value_len - 1;
+        bool empty = json_skip_ws(S->value + 1, close) == close;
+        plan->ins_len = (size_t)snprintf(plan->insertion, sizeof(plan->insertion), empty ? "\"%s\"" : ",\"%s\"", broker_id);
+        plan->ins_off = (size_t)(close - payload);
+    }
+
+    const char *cut_start, *cut_end;
+    raw_token_cut(tok, h, &cut_start, &cut_end);
+    size_t cs = (size_t)(cut_start - payload), ce = (size_t)(cut_end - payload);
+    size_t ins_off = plan->ins_off, ins_len = plan->ins_len;
+    plan->hex_off = (size_t)(h->value + 1 - payload);
+
+    hmac_span_t *spans = plan->spans;
+    int span_count = 0;
+    if (ins_len == 0) {
+        spans[span_count++] = (hmac_span_t){ payload, cs };
+        spans[span_count++] = (hmac_span_t){ payload + ce, len - ce };
+    } else if (ins_off <= cs) {
+        spans[span_count++] = (hmac_span_t){ payload, ins_off };
+        spans[span_count++] = (hmac_span_t){ plan->insertion, ins_len };
+        spans[span_count++] = (hmac_span_t){ payload + ins_off, cs - ins_off };
+        spans[span_count++] = (hmac_span_t){ payload + ce, len - ce };
+        plan->hex_off += ins_len;
+    } else {
+        spans[span_count++] = (hmac_span_t){ payload, cs };
+        spans[span_count++] = (hmac_span_t){ payload + ce, ins_off - ce };
+        spans[span_count++] = (hmac_span_t){ plan->insertion, ins_len };
+        spans[span_count++] = (hmac_span_t){ payload + ins_off, len - ins_off };
+    }
+    plan->span_count = span_count;
+    return true;
+}
+
+/**
+ * Writes the re-signed token planned by resign_plan() to `out`, which must
+ * hold len + plan->ins_len + 1 bytes, with `mac` (the MAC over plan->spans)
+ * as its new "hmac".
+ */
+static void resign_write(const char *payload, size_t len, const resign_plan_t *plan, const unsigned char *mac, char *out) {
+    size_t ins_off = plan->ins_off, ins_len = plan->ins_len;
+    size_t new_len = len + ins_len;
+    if (ins_len) {
+        memcpy(out, payload, ins_off);
+        memcpy(out + ins_off, plan->insertion, ins_len);
+        memcpy(out + ins_off + ins_len, payload + ins_off, len - ins_off);
+    } else {
+        memcpy(out, payload, len);
+    }
+    char new_hmac[EVP_MAX_MD_SIZE * 2 + 1];
+    hex_encode(mac, TRUST_HMAC_LEN, new_hmac);
+    memcpy(out + plan->hex_off, new_hmac, HMAC_HEX_LEN);
+    out[new_len] = '\0';
+}
+
+/**
+ * resign_write() into a buffer the broker can take as the message payload.
+ */
+static char *resign_apply(const char *payload, size_t len, const resign_plan_t *plan, const unsigned char *mac, uint32_t *out_len) {
+    size_t new_len = len + plan->ins_len;
+    char *out = mosquitto_malloc(new_len + 1);
+    if (!out) return NULL;
+    resign_write(payload, len, plan, mac, out);
+    *out_len = (uint32_t)new_len;
+    return out;
+}
+
+/**
+ * Legacy verification: parse, drop "hmac", re-print and MAC the result.
+ */
+static int verify_token_canonical(const char *payload, size_t len, cJSON **root_out) {
+    *root_out = NULL;
+    char *payload_copy = trust_arena_strndup(payload, len);
+    if (!payload_copy) return MOSQ_ERR_NOMEM;
+    cJSON *root = cJSON_Parse(payload_copy);
+    trust_arena_free(payload_copy);
+    stage_end(METRIC_STAGE_PARSE);
+    if (!root) return MOSQ_ERR_SUCCESS;
+
+    cJSON *hmac_field = cJSON_GetObjectItemCaseSensitive(root, "hmac");
+    if (!hmac_field || !cJSON_IsString(hmac_field)) {
+        cJSON_Delete(root); return deny(METRIC_DENIED_MALFORMED);
+    }
+    const trust_hmac_key_t *key = json_token_key(root);
+    if (!key) { cJSON_Delete(root); return deny_unverified(METRIC_DENIED_KEY); }
+    char *received_hmac = trust_arena_strndup(hmac_field->valuestring, strlen(hmac_field->valuestring));
+    cJSON_DeleteItemFromObject(root, "hmac");
+    char *json_str_for_hmac = cJSON_PrintUnformatted(root);
+    if (!json_str_for_hmac) {
+        trust_arena_free(received_hmac);
+        cJSON_Delete(root);
+        return MOSQ_ERR_NOMEM;
+    }
+    char computed_hmac[EVP_MAX_MD_SIZE * 2 + 1] = {0};
+    compute_hmac(key, json_str_for_hmac, strlen(json_str_for_hmac), computed_hmac);
+    bool ok = received_hmac && strcmp(computed_hmac, received_hmac) == 0;
+    trust_arena_free(received_hmac);
+    cJSON_free(json_str_for_hmac);
+    stage_end(METRIC_STAGE_HMAC);
+    if (!ok) { cJSON_Delete(root); return deny_unverified(METRIC_DENIED_HMAC); }
+    *root_out = root;
+    return MOSQ_ERR_SUCCESS;
+}
+
+bool string_in_array(cJSON *array, const char *str) {
+    if (!cJSON_IsArray(array)) return false;
+    cJSON *element;
+    cJSON_ArrayForEach(element, array) {
+        if (cJSON_IsString(element) && strcmp(element->valuestring, str) == 0) return true;
+    }
+    return false;
+}
+
+/**
+ * This callback runs periodically. It applies the feedback received since the
+ * last tick, flushes pending trust updates and, once per poll interval,
+ * reloads the network map if the file changed on disk.
+ */
+static int callback_tick(int event, void *event_data, void *userdata) {
+    UNUSED(event);
+    UNUSED(event_data);
+    UNUSED(userdata);
+
+    time_t current_time = time(NULL);
+    apply_feedback();
+    if (shm_graph_live) {
+        shm_publish_local();
+        if (!shm_pull_counts()) {
+            plugin_log(MOSQ_LOG_DEBUG, "[SHM] Shared topology changed. Reloading.");
+            reload_trust_state();
+        }
+    }
+    if (trust_store_dirty > 0 && current_time - last_trust_flush_time >= trust_flush_interval) {
+        flush_trust_store();
+    }
+    if (current_time - last_admission_report_time >= ADMISSION_REPORT_INTERVAL_SECONDS) {
+        last_admission_report_time = current_time;
+        report_admission_rejects();
+        admit_prune();
+    }
+    if (metrics_interval > 0 && current_time - last_metrics_publish_time >= metrics_interval) {
+        last_metrics_publish_time = current_time;
+        metrics_foreach(publish_metric, NULL);
+    }
+    if (current_time - last_map_poll_time >= MAP_POLL_INTERVAL_SECONDS) {
+        last_map_poll_time = current_time;
+        shape_rebalance();
+        if (network_map_changed()) {
+            plugin_log(MOSQ_LOG_DEBUG, "[REFRESH] Network map changed on disk. Reloading.");
+            reload_trust_state();
+        }
+    }
+    return MOSQ_ERR_SUCCESS;
+}
+
+static int callback_disconnect(int event, void *event_data, void *userdata) {
+    struct mosquitto_evt_disconnect *ed = event_data;
+    UNUSED(event); UNUSED(userdata);
+    admit_forget_client(ed->client);
+    return MOSQ_ERR_SUCCESS;
+}
+
+/**
+ * Builds the key set from `hmac_key` and the keyring file and makes it live.
+ * On failure the current set, if any, stays in use.
+ */
+static bool load_hmac_keys(void) {
+    int key_count = 0;
+    keyring_t *ring = keyring_load(hmac_keyring_file[0] ? hmac_keyring_file : NULL, hmac_key, &key_count);
+    if (!ring) return false;
+    keyring_install(ring);
+    if (hmac_keyring_file[0]) {
+        plugin_log(MOSQ_LOG_INFO, "[KEYS] Loaded %d HMAC key IDs from %s%s.", key_count, hmac_keyring_file,
+                   hmac_key[0] ? ", plus the default key" : "");
+    }
+    return true;
+}
+
+/**
+ * Re-reads the HMAC keyring on a broker reload. Verifications already queued
+ * on the workers finish with the keys they started with.
+ */
+static int callback_reload(int event, void *event_data, void *userdata) {
+    UNUSED(event); UNUSED(event_data); UNUSED(userdata);
+    if (!load_hmac_keys()) {
+        plugin_log(MOSQ_LOG_WARNING, "[KEYS] Could not reload HMAC keyring %s. Keeping the current keys.", hmac_keyring_file);
+    }
+    // Deferring lets the broker run the remaining reload handlers.
+    return MOSQ_ERR_PLUGIN_DEFER;
+}
+
+/**
+ * Accept/deny verdict for a message from a remote origin, based on the direct
+ * trust this broker holds in the last signer.
+ */
+static bool evaluate_last_signer(const char *last_signer_id) {
+    if (!last_signer_id) {
+        plugin_log(MOSQ_LOG_WARNING, "[TRUST] ❌ Message has no signers to evaluate.");
+        plugin_log(MOSQ_LOG_WARNING, "[TRUST] ❌ Dropping message. Last signer check failed.");
+        metrics_count(METRIC_DENIED_NO_SIGNERS);
+        return false;
+    }
+
+    // Look up the precomputed verdict for the last signer
+    int signer_idx = find_node_index(last_signer_id);
+    const trust_decision_t *decision = signer_idx != -1 ? &trust_table[signer_idx] : &default_decision;
+
+    if (decision->accept) {
+        plugin_log(MOSQ_LOG_INFO, "[TRUST] ✅ Last signer '%s' is trusted (%.3f >= %.3f). Accepting message.", 
+                   last_signer_id, decision->trust, LOCAL_THRESHOLD_THETA);
+        return true;
+    }
+    plugin_log(MOSQ_LOG_INFO, "[TRUST] ❌ Last signer '%s' is not trusted (%.3f < %.3f).", 
+               last_signer_id, decision->trust, LOCAL_THRESHOLD_THETA);
+    plugin_log(MOSQ_LOG_WARNING, "[TRUST] ❌ Dropping message. Last signer check failed.");
+    metrics_count(METRIC_DENIED_UNTRUSTED);
+    return false;
+}
+
+static bool copy_token_string(const char *value, size_t len, char *out, size_t out_size) {
+    if (len >= out_size) return false;
+    memcpy(out, value, len);
+    out[len] = '\0';
+    return true;
+}
+
+/**
+ * Same pipeline as the JSON path, for binary tokens (see common/trust_token.h).
+ * Every field is read in place; the only allocation is the re-signed payload,
+ * built once the token has been accepted.
+ */
+static int handle_binary_token(struct mosquitto_evt_message *ed) {
+    at_bin_view_t at;
+    if (!at_bin_parse(ed->payload, ed->payloadlen, &at)) {
+        plugin_log(MOSQ_LOG_WARNING, "[TOKEN] Malformed binary token. Dropping message.");
+        return deny(METRIC_DENIED_MALFORMED);
+    }
+    if (!admit_signer_count(at.signer_count)) return MOSQ_ERR_ACL_DENIED;
+
+    const char *value;
+    size_t value_len;
+    const trust_hmac_key_t *key = at_bin_field(&at, AT_BIN_TAG_KID, &value, &value_len)
+                                  ? keyring_find(value, value_len) : keyring_find(NULL, 0);
+    if (!key) return deny(METRIC_DENIED_KEY);
+    if (at.signer_count > 0) {
+        at_bin_broker(&at, at.signers[at.signer_count - 1], &value, &value_len);
+        if (!admit_signer_share(value, value_len)) return MOSQ_ERR_ACL_DENIED;
+    }
+    stage_end(METRIC_STAGE_PARSE);
+    replay_id_t replay = {0};
+    if (replay_filter_enabled) {
+        const char *issuer;
+        size_t issuer_len;
+        if (at_bin_broker(&at, at.issuer, &issuer, &issuer_len)
+                && at_bin_field(&at, AT_BIN_TAG_CLIENT, &value, &value_len)) {
+            replay = replay_make_id(issuer, issuer_len, value, value_len, at.msg_id);
+            if (is_replay(&replay)) return deny(METRIC_DENIED_REPLAY);
+        }
+    }
+
+    unsigned char mac[EVP_MAX_MD_SIZE];
+    hmac_span_t span = { (const char *)at.buf, at.len - AT_BIN_MAC_LEN };
+    bool mac_ok = compute_hmac_raw(key, &span, 1, mac) == AT_BIN_MAC_LEN;
+    stage_end(METRIC_STAGE_HMAC);
+    if (!mac_ok || CRYPTO_memcmp(mac, at.mac, AT_BIN_MAC_LEN) != 0) {
+        return mac_ok ? deny_unverified(METRIC_DENIED_HMAC) : deny(METRIC_DENIED_ERROR);
+    }
+
+    char client_id[64];
+    if (!at_bin_field(&at, AT_BIN_TAG_CLIENT, &value, &value_len)
+            || !copy_token_string(value, value_len, client_id, sizeof(client_id))
+            || !check_permission(client_id, ed->topic, true)) {
+        return deny(METRIC_DENIED_ACL);
+    }
+
+    at_bin_broker(&at, at.issuer, &value, &value_len);
+    bool is_local_origin = (value_len == strlen(broker_id) && memcmp(value, broker_id, value_len) == 0);
+
+    if (!is_local_origin) {
+        if (plugin_log_enabled(MOSQ_LOG_INFO)) {
+            char signers_str[512] = {0};
+            size_t pos = 0;
+            for (int i = 0; i < at.signer_count && pos < sizeof(signers_str); i++) {
+                at_bin_broker(&at, at.signers[i], &value, &value_len);
+                pos += (size_t)snprintf(signers_str + pos, sizeof(signers_str) - pos, "%.*s ", (int)value_len, value);
+            }
+            plugin_log(MOSQ_LOG_INFO, "[TRUST] Evaluating message with signers: [ %s]", signers_str);
+            plugin_log(MOSQ_LOG_INFO, "[TRUST] Evaluating message based on last signer only.");
+        }
+
+        char last_signer_id[256];
+        const char *last_signer = NULL;
+        if (at.signer_count > 0) {
+            at_bin_broker(&at, at.signers[at.signer_count - 1], &value, &value_len);
+            if (copy_token_string(value, value_len, last_signer_id, sizeof(last_signer_id))) {
+                last_signer = last_signer_id;
+            }
+        }
+        if (!evaluate_last_signer(last_signer)) return MOSQ_ERR_ACL_DENIED;
+    }
+
+    // Already signed by us means the existing MAC stays valid as it is.
+    int token_self = at_bin_find_broker(&at, broker_id);
+    bool signed_by_us = token_self >= 0 && memchr(at.signers, token_self, at.signer_count);
+    at_bin_append_t plan;
+    if (!signed_by_us && !at_bin_plan_append(&at, broker_id, &plan)) {
+        plugin_log(MOSQ_LOG_WARNING, "[TOKEN] Binary token has no room for another signer. Dropping message.");
+        return deny(METRIC_DENIED_MALFORMED);
+    }
+    // Checked again as it is recorded, in case a worker accepted a copy meanwhile.
+    bool admitted = !replay.key || replay_admit(&replay);
+    stage_end(METRIC_STAGE_TRUST);
+    if (!admitted) return deny(METRIC_DENIED_REPLAY);
+    if (signed_by_us) return MOSQ_ERR_SUCCESS;
+
+    uint8_t *out = mosquitto_malloc(plan.new_len + 1);
+    if (!out) return MOSQ_ERR_NOMEM;
+    at_bin_write_append(&at, &plan, out);
+    span = (hmac_span_t){ (const char *)out, plan.new_len - AT_BIN_MAC_LEN };
+    if (compute_hmac_raw(key, &span, 1, out + plan.new_len - AT_BIN_MAC_LEN) != AT_BIN_MAC_LEN) {
+        mosquitto_free(out);
+        return deny(METRIC_DENIED_ERROR);
+    }
+    out[plan.new_len] = 0;
+    stage_end(METRIC_STAGE_RESIGN);
+
+    ed->payload = out;
+    ed->payloadlen = (uint32_t)plan.new_len;
+    return MOSQ_ERR_SUCCESS;
+}
+
+// =================================================================================
+// PROPERTY TOKENS
+// The MAC covers "b", "c", "msg_id", the topic, "kid" (empty if absent), "pd"
+// (hex SHA-256 of the payload, computed once by the source) and the signers,
+// each NUL-terminated. The origin broker ("b") checks "pd" against the payload
+// as the token enters the mesh; later hops never hash, copy or rewrite the
+// payload, and subscribers check "pd" again on delivery (trust_digest.h). A
+// hop signs by appending its own "S" and "hmac" properties; the last "hmac"
+// is the current signature. (b, c, msg_id) goes through the replay filter like
+// the payload tokens.
+// =================================================================================
+
+typedef struct {
+    char *b, *c, *msg_id, *pd, *hmac, *kid;
+    char *signers[MAX_PROPERTY_SIGNERS];
+    int signer_count;
+} property_token_t;
+
+static void property_token_free(property_token_t *pt) {
+    mosquitto_free(pt->b);
+    mosquitto_free(pt->c);
+    mosquitto_free(pt->msg_id);
+    mosquitto_free(pt->pd);
+    mosquitto_free(pt->hmac);
+    mosquitto_free(pt->kid);
+    for (int i = 0; i < pt->signer_count; i++) mosquitto_free(pt->signers[i]);
+    memset(pt, 0, sizeof(*pt));
+}
+
+static void property_token_take(char **slot, char *value) {
+    mosquitto_free(*slot);
+    *slot = value;
+}
+
+/**
+ * Collects the token user properties. Returns false if the message carries
+ * no "hmac" property (i.e. it isn't a property token).
+ */
+static bool property_token_read(const mosquitto_property *props, property_token_t *pt) {
+    memset(pt, 0, sizeof(*pt));
+    for (const mosquitto_property *p = props; p; p = mosquitto_property_next(p)) {
+        if (mosquitto_property_identifier(p) != MQTT_PROP_USER_PROPERTY) continue;
+        char *name = NULL, *value = NULL;
+        if (!mosquitto_property_read_string_pair(p, MQTT_PROP_USER_PROPERTY, &name, &value, false)) continue;
+
+        if (strcmp(name, "b") == 0 && !pt->b) pt->b = value;
+        else if (strcmp(name, "c") == 0 && !pt->c) pt->c = value;
+        else if (strcmp(name, "msg_id") == 0 && !pt->msg_id) pt->msg_id = value;
+        else if (strcmp(name, "pd") == 0 && !pt->pd) pt->pd = value;
+        else if (strcmp(name, "kid") == 0 && !pt->kid) pt->kid = value;
+        else if (strcmp(name, "hmac") == 0) property_token_take(&pt->hmac, value);
+        else if (strcmp(name, "S") == 0 && pt->signer_count < MAX_PROPERTY_SIGNERS) pt->signers[pt->signer_count++] = value;
+        else mosquitto_free(value);
+        mosquitto_free(name);
+    }
+    return pt->hmac != NULL;
+}
+
+static void property_token_mac(const property_token_t *pt, const trust_hmac_key_t *key, const char *topic,
+                               const char *extra_signer, char *hmac_hex_out) {
+    const char *kid = pt->kid ? pt->kid : "";
+    hmac_span_t spans[6 + MAX_PROPERTY_SIGNERS + 1];
+    int n = 0;
+    spans[n++] = (hmac_span_t){ pt->b, strlen(pt->b) + 1 };
+    spans[n++] = (hmac_span_t){ pt->c, strlen(pt->c) + 1 };
+    spans[n++] = (hmac_span_t){ pt->msg_id, strlen(pt->msg_id) + 1 };
+    spans[n++] = (hmac_span_t){ topic, strlen(topic) + 1 };
+    spans[n++] = (hmac_span_t){ kid, strlen(kid) + 1 };
+    spans[n++] = (hmac_span_t){ pt->pd, strlen(pt->pd) + 1 };
+    for (int i = 0; i < pt->signer_count; i++) {
+        spans[n++] = (hmac_span_t){ pt->signers[i], strlen(pt->signers[i]) + 1 };
+    }
+    if (extra_signer) spans[n++] = (hmac_span_t){ extra_signer, strlen(extra_signer) + 1 };
+    compute_hmac_spans(key, spans, n, hmac_hex_out);
+}
+
+static int handle_property_token(struct mosquitto_evt_message *ed, property_token_t *pt) {
+    uint32_t msg_id;
+    if (!pt->b || !pt->c || !pt->msg_id || !pt->pd || strlen(pt->hmac) != HMAC_HEX_LEN
+            || !parse_msg_id(pt->msg_id, strlen(pt->msg_id), &msg_id)) {
+        return deny(METRIC_DENIED_MALFORMED);
+    }
+    if (!admit_signer_count(pt->signer_count)) return MOSQ_ERR_ACL_DENIED;
+    if (pt->signer_count > 0) {
+        const char *last_signer = pt->signers[pt->signer_count - 1];
+        if (!admit_signer_share(last_signer, strlen(last_signer))) return MOSQ_ERR_ACL_DENIED;
+    }
+    const trust_hmac_key_t *key = keyring_find(pt->kid, pt->kid ? strlen(pt->kid) : 0);
+    if (!key) return deny_unverified(METRIC_DENIED_KEY);
+    stage_end(METRIC_STAGE_PARSE);
+    replay_id_t replay = {0};
+    if (replay_filter_enabled) {
+        replay = replay_make_id(pt->b, strlen(pt->b), pt->c, strlen(pt->c), msg_id);
+        if (is_replay(&replay)) return deny(METRIC_DENIED_REPLAY);
+    }
+
+    char computed_hmac[EVP_MAX_MD_SIZE * 2 + 1];
+    property_token_mac(pt, key, ed->topic, NULL, computed_hmac);
+    stage_end(METRIC_STAGE_HMAC);
+    if (CRYPTO_memcmp(computed_hmac, pt->hmac, HMAC_HEX_LEN) != 0) return deny_unverified(METRIC_DENIED_HMAC);
+
+    if (!check_permission(pt->c, ed->topic, true)) return deny(METRIC_DENIED_ACL);
+
+    bool is_local_origin = strcmp(pt->b, broker_id) == 0;
+    if (is_local_origin && !trust_digest_matches(ed->payload, ed->payloadlen, pt->pd)) {
+        plugin_log(MOSQ_LOG_WARNING, "[TOKEN] Payload does not match the property token digest. Dropping message.");
+        return deny(METRIC_DENIED_PAYLOAD);
+    }
+    if (!is_local_origin) {
+        if (plugin_log_enabled(MOSQ_LOG_INFO)) {
+            char signers_str[512] = {0};
+            size_t pos = 0;
+            for (int i = 0; i < pt->signer_count && pos < sizeof(signers_str); i++) {
+                pos += (size_t)snprintf(signers_str + pos, sizeof(signers_str) - pos, "%s ", pt->signers[i]);
+            }
+            plugin_log(MOSQ_LOG_INFO, "[TRUST] Evaluating message with signers: [ %s]", signers_str);
+            plugin_log(MOSQ_LOG_INFO, "[TRUST] Evaluating message based on last signer only.");
+        }
+        if (!evaluate_last_signer(pt->signer_count > 0 ? pt->signers[pt->signer_count - 1] : NULL)) {
+            return MOSQ_ERR_ACL_DENIED;
+        }
+    }
+    bool admitted = !replay.key || replay_admit(&replay);
+    stage_end(METRIC_STAGE_TRUST);
+    if (!admitted) return deny(METRIC_DENIED_REPLAY);
+
+    for (int i = 0; i < pt->signer_count; i++) {
+        if (strcmp(pt->signers[i], broker_id) == 0) return MOSQ_ERR_SUCCESS;
+    }
+    if (pt->signer_count >= MAX_PROPERTY_SIGNERS) return deny(METRIC_DENIED_MALFORMED);
+
+    char new_hmac[EVP_MAX_MD_SIZE * 2 + 1];
+    property_token_mac(pt, key, ed->topic, broker_id, new_hmac);
+    int rc = mosquitto_property_add_string_pair(&ed->properties, MQTT_PROP_USER_PROPERTY, "S", broker_id);
+    if (rc == MOSQ_ERR_SUCCESS) {
+        rc = mosquitto_property_add_string_pair(&ed->properties, MQTT_PROP_USER_PROPERTY, "hmac", new_hmac);
+    }
+    stage_end(METRIC_STAGE_RESIGN);
+    return rc;
+}
+
+// =================================================================================
+// DEFERRED VERIFICATION
+// verify_token_async() takes a raw JSON token as far as the replay prefilter,
+// ACL and last-signer verdict on the broker thread, reading the members in
+// place. The MACs, the final replay check and the re-signed payload are left
+// to verify_jobs_run() on a worker, which posts the verdict back with
+// mosquitto_message_complete(). Workers only touch the job, the key set it
+// holds a reference to, and the replay filter and signer shares, which are
+// locked.
+// =================================================================================
+
+typedef struct {
+    uint64_t ticket;
+    replay_id_t replay;                 // key 0 when the token isn't filtered
+    bool append_signer;
+    char share[sizeof(shaped_signer)];  // share to refund if the MAC fails (see deny_unverified())
+    size_t share_len;
+    keyring_t *keys;                    // held until the job is done, so a reload can't free `key`
+    const trust_hmac_key_t *key;
+    size_t len;
+    char payload[];                     // copy of the received token
+} verify_job_t;
+
+/**
+ * Copies a JSON string's contents to `out` if it has no escapes and fits.
+ */
+static bool raw_plain_string(const char *value, size_t len, char *out, size_t out_size) {
+    if (memchr(value, '\\', len)) return false;
+    return copy_token_string(value, len, out, out_size);
+}
+
+/**
+ * Worker side: MACs every job of the batch in one trust_hmac_batch() pass,
+ * two inputs per token (received and re-signed), then completes each one.
+ */
+static void verify_jobs_run(void **jobs, int job_count) {
+    resign_plan_t plans[POOL_MAX_BATCH];
+    hmac_span_t spans[POOL_MAX_BATCH][2];
+    const char *received[POOL_MAX_BATCH];
+    unsigned char macs[POOL_MAX_BATCH][2][EVP_MAX_MD_SIZE];
+    hmac_job_t mac_jobs[POOL_MAX_BATCH * 2];
+    bool scanned[POOL_MAX_BATCH];
+    int mac_count = 0;
+
+    for (int i = 0; i < job_count; i++) {
+        verify_job_t *job = jobs[i];
+        raw_token_t tok;
+        const raw_member_t *h = NULL;
+        scanned[i] = raw_token_scan(job->payload, job->len, &tok) && (h = raw_token_hmac(&tok)) != NULL
+                     && resign_plan(job->payload, job->len, &tok, job->append_signer, &plans[i]);
+        if (!scanned[i]) continue;
+
+        const char *cut_start, *cut_end;
+        raw_token_cut(&tok, h, &cut_start, &cut_end);
+        spans[i][0] = (hmac_span_t){ job->payload, (size_t)(cut_start - job->payload) };
+        spans[i][1] = (hmac_span_t){ cut_end, (size_t)(job->payload + job->len - cut_end) };
+        received[i] = h->value + 1;
+        mac_jobs[mac_count++] = (hmac_job_t){ spans[i], 2, macs[i][0], job->key };
+        mac_jobs[mac_count++] = (hmac_job_t){ plans[i].spans, plans[i].span_count, macs[i][1], job->key };
+    }
+    uint64_t started = metrics_timing ? metrics_now() : 0;
+    bool macs_ok = mac_count == 0 || trust_hmac_batch(mac_jobs, mac_count);
+    if (started) {
+        // Each token is charged its share of the batch.
+        uint64_t share = (metrics_now() - started) / (uint64_t)job_count;
+        for (int i = 0; i < job_count; i++) metrics_observe(METRIC_STAGE_HMAC, share);
+    }
+
+    for (int i = 0; i < job_count; i++) {
+        verify_job_t *job = jobs[i];
+        metric_counter_t verdict = METRIC_DENIED_MALFORMED;
+        char *out = NULL;
+        size_t out_len = 0;
+        if (scanned[i] && !macs_ok) {
+            verdict = METRIC_DENIED_ERROR;
+        } else if (scanned[i]) {
+            char computed_hmac[EVP_MAX_MD_SIZE * 2 + 1];
+            hex_encode(macs[i][0], TRUST_HMAC_LEN, computed_hmac);
+            if (CRYPTO_memcmp(computed_hmac, received[i], HMAC_HEX_LEN) != 0) {
+                verdict = METRIC_DENIED_HMAC;
+                if (job->share_len > 0) shape_refund(job->share, job->share_len);
+            } else if (job->replay.key && !replay_admit(&job->replay)) {
+                verdict = METRIC_DENIED_REPLAY;
+            } else if (!(out = malloc(job->len + plans[i].ins_len + 1))) {
+                verdict = METRIC_DENIED_ERROR;
+            } else {
+                uint64_t resign_started = metrics_timing ? metrics_now() : 0;
+                resign_write(job->payload, job->len, &plans[i], macs[i][1], out);
+                out_len = job->len + plans[i].ins_len;
+                verdict = METRIC_ACCEPTED;
+                if (resign_started) metrics_observe(METRIC_STAGE_RESIGN, metrics_now() - resign_started);
+            }
+        }
+        metrics_count(verdict);
+        mosquitto_message_complete(job->ticket, verdict == METRIC_ACCEPTED ? MOSQ_ERR_SUCCESS : MOSQ_ERR_ACL_DENIED,
+                                   out, (uint32_t)out_len);
+        free(out);
+        keyring_release(job->keys);
+        free(job);
+    }
+}
+
+static void verify_job_discard(void *job) {
+    metrics_count(METRIC_DENIED_ERROR);
+    mosquitto_message_complete(((verify_job_t *)job)->ticket, MOSQ_ERR_ACL_DENIED, NULL, 0);
+    keyring_release(((verify_job_t *)job)->keys);
+    free(job);
+}
+
+/**
+ * Broker-thread side of a raw JSON token. Returns MOSQ_ERR_MESSAGE_PENDING
+ * once the MACs are queued, a verdict if one was reached without them, or
+ * MOSQ_ERR_PLUGIN_DEFER if the token has to be verified in place (a string
+ * with escapes, no splice plan, or a full queue).
+ */
+static int verify_token_async(struct mosquitto_evt_message *ed, const raw_token_t *tok) {
+    const char *payload = ed->payload;
+    size_t len = ed->payloadlen;
+    replay_id_t replay = {0};
+    if (replay_filter_enabled && raw_token_replay_id(tok, &replay) && is_replay(&replay)) return deny(METRIC_DENIED_REPLAY);
+    if (!raw_token_hmac(tok)) return deny(METRIC_DENIED_MALFORMED);
+    const trust_hmac_key_t *key = raw_token_key(tok);
+    if (!key) return deny_unverified(METRIC_DENIED_KEY);
+
+    const raw_member_t *c = raw_token_member(tok, "c");
+    const raw_member_t *b = raw_token_member(tok, "b");
+    const raw_member_t *S = raw_token_member(tok, "S");
+    char client_id[256], last_signer_id[256];
+    const char *last_signer = NULL;
+    size_t last_signer_len = 0;
+    if (!c || c->value[0] != '"') return deny(METRIC_DENIED_MALFORMED);
+    if (!raw_plain_string(c->value + 1, c->value_len - 2, client_id, sizeof(client_id))) return MOSQ_ERR_PLUGIN_DEFER;
+    // Broker IDs contain no escapes, so "b" is compared as it stands.
+    size_t self_len = strlen(broker_id);
+    bool is_local_origin = b && b->value[0] == '"' && b->value_len == self_len + 2
+                           && memcmp(b->value + 1, broker_id, self_len) == 0;
+    if (!is_local_origin && S) {
+        raw_array_scan(S, &last_signer, &last_signer_len);
+        if (last_signer && !raw_plain_string(last_signer, last_signer_len, last_signer_id, sizeof(last_signer_id))) {
+            return MOSQ_ERR_PLUGIN_DEFER;
+        }
+    }
+    bool append_signer = !S || !raw_array_contains(S, broker_id);
+    resign_plan_t plan;
+    if (!resign_plan(payload, len, tok, append_signer, &plan)) return MOSQ_ERR_PLUGIN_DEFER;
+
+    if (!check_permission(client_id, ed->topic, true)) return deny(METRIC_DENIED_ACL);
+    if (!is_local_origin) {
+        plugin_log(MOSQ_LOG_INFO, "[TRUST] Evaluating message based on last signer only.");
+        if (!evaluate_last_signer(last_signer ? last_signer_id : NULL)) return MOSQ_ERR_ACL_DENIED;
+    }
+    stage_end(METRIC_STAGE_TRUST);
+
+    verify_job_t *job = malloc(sizeof(*job) + len);
+    if (!job) return MOSQ_ERR_PLUGIN_DEFER;
+    job->ticket = mosquitto_message_defer(ed);
+    job->replay = replay;
+    job->append_signer = append_signer;
+    memcpy(job->share, shaped_signer, shaped_signer_len);
+    job->share_len = shaped_signer_len;
+    job->keys = keyring_acquire();
+    job->key = key;
+    job->len = len;
+    memcpy(job->payload, payload, len);
+    if (!job->ticket || !pool_submit(job)) {
+        keyring_release(job->keys);
+        free(job);
+        return MOSQ_ERR_PLUGIN_DEFER;
+    }
+    return MOSQ_ERR_MESSAGE_PENDING;
+}
+
+// =================================================================================
+// FEEDBACK
+// Feedback messages are flat JSON objects ({"source", "target", "feedback"})
+// and are read in place with the token scanner. The message is consumed here
+// either way: it is summed into feedback_deltas when it is about a link into
+// this broker, or re-published to a single bridge otherwise, and the original
+// only goes on to local subscribers of FEEDBACK_DONE_TOPIC.
+// =================================================================================
+
+/**
+ * Copies a string member of a scanned object to `out` (no escapes, must fit).
+ */
+static bool raw_string_member(const raw_token_t *tok, const char *key, char *out, size_t out_size) {
+    const raw_member_t *m = raw_token_member(tok, key);
+    return m && m->value[0] == '"' && raw_plain_string(m->value + 1, m->value_len - 2, out, out_size);
+}
+
+/**
+ * The neighbour on a shortest path of outgoing links from this broker to
+ * `target_idx`, or -1. One breadth-first search fills the table for every
+ * target; it is dropped when the graph is reloaded.
+ */
+static int feedback_first_hop(int target_idx) {
+    if (self_idx == -1 || target_idx < 0) return -1;
+    if (!feedback_next_hop) {
+        int node_count = network_graph->node_count;
+        int *hop = malloc((size_t)node_count * sizeof(*hop));
+        int *queue = malloc((size_t)node_count * sizeof(*queue));
+        if (!hop || !queue) {
+            free(hop);
+            free(queue);
+            return -1;
+        }
+        for (int i = 0; i < node_count; i++) hop[i] = -1;
+        int head = 0, tail = 0;
+        hop[self_idx] = self_idx;
+        queue[tail++] = self_idx;
+        while (head < tail) {
+            int u = queue[head++];
+            for (int k = network_graph->link_offset[u]; k < network_graph->link_offset[u + 1]; k++) {
+                int v = network_graph->link_target[k];
+                if (hop[v] != -1) continue;
+                hop[v] = (u == self_idx) ? v : hop[u];
+                queue[tail++] = v;
+            }
+        }
+        free(queue);
+        feedback_next_hop = hop;
+    }
+    return feedback_next_hop[target_idx];
+}
+
+/**
+ * Finds the bridge local client ID configured for neighbour `broker`.
+ */
+static bool feedback_bridge_client(const char *broker, char *out, size_t out_size) {
+    size_t broker_len = strlen(broker);
+    const char *p = feedback_bridges;
+    while (*p) {
+        const char *end = strchr(p, ',');
+        if (!end) end = p + strlen(p);
+        const char *eq = memchr(p, '=', (size_t)(end - p));
+        if (eq && (size_t)(eq - p) == broker_len && memcmp(p, broker, broker_len) == 0) {
+            return eq + 1 < end && copy_token_string(eq + 1, (size_t)(end - eq - 1), out, out_size);
+        }
+        p = *end ? end + 1 : end;
+    }
+    return false;
+}
+
+/**
+ * Warns once per target that feedback toward it has no feedback bridge and is
+ * dropped. Remembers at most MAX_FEEDBACK_UNROUTED targets, since they come
+ * from the payload.
+ */
+static void warn_feedback_unrouted(const char *target_id) {
+    size_t len = strlen(target_id);
+    broker_name_t *entry = NULL;
+    HASH_FIND(hh, feedback_unrouted, target_id, len, entry);
+    if (entry || feedback_unrouted_count >= MAX_FEEDBACK_UNROUTED) return;
+    entry = malloc(sizeof(*entry) + len + 1);
+    if (!entry) return;
+    entry->index = feedback_unrouted_count++;
+    memcpy(entry->id, target_id, len + 1);
+    HASH_ADD(hh, feedback_unrouted, id[0], len, entry);
+    plugin_log(MOSQ_LOG_WARNING, "[FEEDBACK] No feedback bridge toward %s (see feedback_bridges). "
+               "Dropping its feedback.", target_id);
+}
+
+static void free_feedback_unrouted(void) {
+    broker_name_t *entry, *tmp;
+    HASH_ITER(hh, feedback_unrouted, entry, tmp) {
+        HASH_DEL(feedback_unrouted, entry);
+        free(entry);
+    }
+    feedback_unrouted_count = 0;
+}
+
+static void forward_feedback(const struct mosquitto_evt_message *ed, const char *target_id, int target_idx) {
+    int hop = feedback_first_hop(target_idx);
+    char bridge_id[128];
+    if (hop < 0 || !feedback_bridge_client(network_graph->nodes[hop]->id, bridge_id, sizeof(bridge_id))) {
+        warn_feedback_unrouted(target_id);
+        metrics_count(METRIC_FEEDBACK_IGNORED);
+        return;
+    }
+    if (mosquitto_broker_publish_copy(bridge_id, ed->topic, (int)ed->payloadlen, ed->payload, ed->qos, false, NULL) == MOSQ_ERR_SUCCESS) {
+        metrics_count(METRIC_FEEDBACK_FORWARDED);
+    }
+}
+
+/**
+ * Sums or forwards one feedback message, then accepts it under
+ * FEEDBACK_DONE_TOPIC so that it is acknowledged but never bridged.
+ */
+static int handle_feedback(struct mosquitto_evt_message *ed) {
+    raw_token_t tok;
+    char source_id[256], target_id[256], feedback[16];
+    if (!raw_token_scan((const char *)ed->payload, ed->payloadlen, &tok)
+            || !raw_string_member(&tok, "source", source_id, sizeof(source_id))
+            || !raw_string_member(&tok, "target", target_id, sizeof(target_id))
+            || !raw_string_member(&tok, "feedback", feedback, sizeof(feedback))) {
+        metrics_count(METRIC_FEEDBACK_IGNORED);
+    } else {
+        int target_idx = find_node_index(target_id);
+        int source_idx = find_node_index(source_id);
+        if (self_idx == -1 || target_idx != self_idx) {
+            forward_feedback(ed, target_id, target_idx);
+        } else if (!find_link(source_idx, self_idx)) {
+            metrics_count(METRIC_FEEDBACK_IGNORED);
+        } else if (strcmp(feedback, "positive") == 0) {
+            feedback_deltas[source_idx].r++;
+            feedback_pending++;
+            metrics_count(METRIC_FEEDBACK_POSITIVE);
+        } else if (strcmp(feedback, "negative") == 0) {
+            feedback_deltas[source_idx].s += NEGATIVE_MULTIPLIER_MU;
+            feedback_pending++;
+            metrics_count(METRIC_FEEDBACK_NEGATIVE);
+        } else {
+            metrics_count(METRIC_FEEDBACK_IGNORED);
+        }
+    }
+    char *done_topic = mosquitto_strdup(FEEDBACK_DONE_TOPIC);
+    if (!done_topic) return MOSQ_ERR_NOMEM;
+    ed->topic = done_topic;
+    ed->retain = false;
+    return MOSQ_ERR_SUCCESS;
+}
+
+/**
+ * Folds the summed feedback into the links into this broker and their trust
+ * decisions, one update per link however many messages arrived for it, and
+ * drops the cached path scores computed from the old counts.
+ */
+static void apply_feedback(void) {
+    if (feedback_pending == 0) return;
+    bool changed = false;
+    for (int i = 0; i < network_graph->node_count; i++) {
+        trust_link_t *delta = &feedback_deltas[i];
+        if (delta->r == 0 && delta->s == 0) continue;
+        trust_link_t *link = find_link(i, self_idx);
+        if (link) {
+            link->r += delta->r;
+            link->s += delta->s;
+            changed = true;
+            update_trust_decision(i);
+            plugin_log(MOSQ_LOG_INFO, "[TRUST] Feedback for link %s->%s: r+%d, s+%d. New counts: r=%d, s=%d. Link trust now %.3f",
+                       network_graph->nodes[i]->id, broker_id, delta->r, delta->s, link->r, link->s, trust_table[i].trust);
+        }
+        delta->r = delta->s = 0;
+    }
+    if (changed) reset_path_cache();
+    trust_store_dirty += feedback_pending;
+    feedback_pending = 0;
+    shm_publish_pending = true;
+    if (trust_store_dirty >= trust_flush_dirty) {
+        flush_trust_store();
+    }
+}
+
+/**
+ * Verdict for one (non-feedback) message. Denials are counted where they are
+ * decided; see deny().
+ */
+static int evaluate_message(struct mosquitto_evt_message *ed)
+{
+    if (!admit_message(ed)) return MOSQ_ERR_ACL_DENIED;
+
+    if (property_tokens_enabled && ed->properties) {
+        property_token_t pt;
+        if (property_token_read(ed->properties, &pt)) {
+            int rc = handle_property_token(ed, &pt);
+            property_token_free(&pt);
+            return rc;
+        }
+        property_token_free(&pt);
+    }
+    if (at_bin_is_binary(ed->payload, ed->payloadlen)) {
+        return handle_binary_token(ed);
+    }
+    if (!ed->payload || ed->payloadlen < 2 || ((char *)ed->payload)[0] != '{') {
+        return pass_through();
+    }
+    
+    cJSON *root = NULL;
+    raw_token_t tok;
+    replay_id_t replay = {0};
+    int rc;
+    bool scanned = raw_token_scan((const char *)ed->payload, ed->payloadlen, &tok);
+    if (!admit_json_token((const char *)ed->payload, ed->payloadlen, scanned ? &tok : NULL)) return MOSQ_ERR_ACL_DENIED;
+    stage_end(METRIC_STAGE_PARSE);
+    if (hmac_verify_mode == HMAC_VERIFY_RAW && scanned && pool_running()) {
+        rc = verify_token_async(ed, &tok);
+        if (rc != MOSQ_ERR_PLUGIN_DEFER) return rc;
+    }
+    if (hmac_verify_mode == HMAC_VERIFY_RAW) {
+        rc = verify_token_raw((const char *)ed->payload, ed->payloadlen, scanned ? &tok : NULL, &root, &replay);
+    } else {
+        rc = verify_token_canonical((const char *)ed->payload, ed->payloadlen, &root);
+    }
+    if (rc != MOSQ_ERR_SUCCESS) return rc;
+    if (!root) return pass_through();
+    if (hmac_verify_mode == HMAC_VERIFY_CANONICAL && replay_filter_enabled
+            && json_token_replay_id(root, &replay) && is_replay(&replay)) {
+        cJSON_Delete(root);
+        return deny(METRIC_DENIED_REPLAY);
+    }
+
+    cJSON *c_item = cJSON_GetObjectItemCaseSensitive(root, "c");
+    if (!c_item || !cJSON_IsString(c_item) || !check_permission(c_item->valuestring, ed->topic, true)) {
+        cJSON_Delete(root);
+        return deny(METRIC_DENIED_ACL);
+    }
+
+    cJSON *S_item = cJSON_GetObjectItemCaseSensitive(root, "S");
+    cJSON *b_item = cJSON_GetObjectItemCaseSensitive(root, "b");
+    bool is_local_origin = (b_item && cJSON_IsString(b_item) && strcmp(b_item->valuestring, broker_id) == 0);
+
+    if (!is_local_origin) {
+        if (plugin_log_enabled(MOSQ_LOG_INFO)) {
+            char signers_str[512] = {0};
+            size_t pos = 0;
+            cJSON *signer_log_item;
+            cJSON_ArrayForEach(signer_log_item, S_item) {
+                if (cJSON_IsString(signer_log_item) && pos < sizeof(signers_str)) {
+                    pos += (size_t)snprintf(signers_str + pos, sizeof(signers_str) - pos, "%s ", signer_log_item->valuestring);
+                }
+            }
+            plugin_log(MOSQ_LOG_INFO, "[TRUST] Evaluating message with signers: [ %s]", signers_str);
+            plugin_log(MOSQ_LOG_INFO, "[TRUST] Evaluating message based on last signer only.");
+        }
+
+        // Get the last signer from the S array
+        const char *last_signer_id = NULL;
+        int signer_count = cJSON_GetArraySize(S_item);
+        if (signer_count > 0) {
+            cJSON *last_signer_item = cJSON_GetArrayItem(S_item, signer_count - 1);
+            if (cJSON_IsString(last_signer_item)) {
+                last_signer_id = last_signer_item->valuestring;
+            }
+        }
+        if (!evaluate_last_signer(last_signer_id)) {
+            cJSON_Delete(root);
+            return MOSQ_ERR_ACL_DENIED;
+        }
+    }
+    bool admitted = !replay.key || replay_admit(&replay);
+    stage_end(METRIC_STAGE_TRUST);
+    if (!admitted) {
+        cJSON_Delete(root);
+        return deny(METRIC_DENIED_REPLAY);
+    }
+
+    bool append_signer = !string_in_array(S_item, broker_id);
+    resign_plan_t plan;
+    unsigned char resign_mac[EVP_MAX_MD_SIZE];
+    if (hmac_verify_mode == HMAC_VERIFY_RAW && resign_plan((const char *)ed->payload, ed->payloadlen, &tok, append_signer, &plan)
+            && compute_hmac_raw(raw_token_key(&tok), plan.spans, plan.span_count, resign_mac) == TRUST_HMAC_LEN) {
+        uint32_t new_len = 0;
+        char *new_payload = resign_apply((const char *)ed->payload, ed->payloadlen, &plan, resign_mac, &new_len);
+        if (new_payload) {
+            ed->payload = new_payload;
+            ed->payloadlen = new_len;
+            cJSON_Delete(root);
+            stage_end(METRIC_STAGE_RESIGN);
+            return MOSQ_ERR_SUCCESS;
+        }
+    }
+
+    if (append_signer) {
+        cJSON_AddItemToArray(S_item, cJSON_CreateString(broker_id));
+    }
+
+    char *updated_payload_no_hmac = cJSON_PrintUnformatted(root);
+    if (!updated_payload_no_hmac) {
+        cJSON_Delete(root);
+        return MOSQ_ERR_NOMEM;
+    }
+    char new_hmac[EVP_MAX_MD_SIZE * 2 + 1] = {0};
+    // Verification already found this key, in the same callback.
+    compute_hmac(json_token_key(root), updated_payload_no_hmac, strlen(updated_payload_no_hmac), new_hmac);
+    cJSON_AddStringToObject(root, "hmac", new_hmac);
+
+    // The broker takes ownership of the new payload, so it is the one copy
+    // made outside the arena.
+    char *final_payload = cJSON_PrintUnformatted(root);
+    if (final_payload) {
+        ed->payload = mosquitto_strdup(final_payload);
+        ed->payloadlen = (uint32_t)strlen(final_payload);
+        cJSON_free(final_payload);
+    }
+
+    cJSON_Delete(root);
+    cJSON_free(updated_payload_no_hmac);
+    stage_end(METRIC_STAGE_RESIGN);
+
+    return MOSQ_ERR_SUCCESS;
+}
+
+static int callback_message(int event, void *event_data, void *userdata)
+{
+    struct mosquitto_evt_message *ed = event_data;
+    UNUSED(event); UNUSED(userdata);
+
+    if (strcmp(ed->topic, "internal/feedback") == 0) return handle_feedback(ed);
+    if (!topics_evaluated(ed->topic)) {
+        metrics_count(METRIC_BYPASSED);
+        return MOSQ_ERR_SUCCESS;
+    }
+
+    metrics_count(METRIC_EVALUATED);
+    uint64_t started = metrics_timing ? metrics_now() : 0;
+    stage_clock = started;
+    shaped_signer_len = 0;
+    passed_through = false;
+    trust_arena_begin();
+    int rc = evaluate_message(ed);
+    trust_arena_end();
+    if (started) {
+        for (int i = 0; i < METRIC_STAGE_COUNT; i++) {
+            if (stage_mask & (1u << i)) metrics_observe((metric_stage_t)i, stage_ns[i]);
+            stage_ns[i] = 0;
+        }
+        stage_mask = 0;
+        stage_clock = 0;
+        metrics_observe(METRIC_STAGE_TOTAL, metrics_now() - started);
+    }
+    // Deferred tokens are counted by the worker that verifies them.
+    if (rc == MOSQ_ERR_SUCCESS) metrics_count(passed_through ? METRIC_PASSED_THROUGH : METRIC_ACCEPTED);
+    else if (rc != MOSQ_ERR_ACL_DENIED && rc != MOSQ_ERR_MESSAGE_PENDING) metrics_count(METRIC_DENIED_ERROR);
+    return rc;
+}
+
+// =================================================================================
+// PLUGIN LIFECYCLE FUNCTIONS (SIMPLIFIED)
+// =================================================================================
+
+int mosquitto_plugin_version(int supported_version_count, const int *supported_versions) {
+    for (int i = 0; i < supported_version_count; i++) {
+        if (supported_versions[i] == 5) return 5;
+    }
+    return -1;
+}
+
+int mosquitto_plugin_init(mosquitto_plugin_id_t *identifier, void **user_data, struct mosquitto_opt *opts, int opt_count) {
+    UNUSED(user_data);
+    mosq_pid = identifier;
+
     for (int i = 0; i < opt_count; i++) {
         if (strcmp(opts[i].key, "broker_id") == 0) strncpy(broker_id, opts[i].value, sizeof(broker_id) - 1);
         if (strcmp(opts[i].key, "acl_file") == 0) strncpy(acl_file_path, opts[i].value, sizeof(acl_file_path) - 1);
         if (strcmp(opts[i].key, "hmac_key") == 0) strncpy(hmac_key, opts[i].value, sizeof(hmac_key) - 1);
+        if (strcmp(opts[i].key, "hmac_keyring") == 0) strncpy(hmac_keyring_file, opts[i].value, sizeof(hmac_keyring_file) - 1);
         if (strcmp(opts[i].key, "log_file") == 0) strncpy(log_file_path, opts[i].value, sizeof(log_file_path) - 1);
+        if (strcmp(opts[i].key, "log_level") == 0) file_log_rank = parse_log_rank(opts[i].value);
+        if (strcmp(opts[i].key, "broker_log_level") == 0) broker_log_rank = parse_log_rank(opts[i].value);
+        if (strcmp(opts[i].key, "property_tokens") == 0) property_tokens_enabled = (strcmp(opts[i].value, "true") == 0);
+        if (strcmp(opts[i].key, "max_token_size") == 0) max_token_size = atoi(opts[i].value);
+        if (strcmp(opts[i].key, "max_token_depth") == 0) max_token_depth = atoi(opts[i].value);
+        if (strcmp(opts[i].key, "max_token_signers") == 0) max_token_signers = atoi(opts[i].value);
+        if (strcmp(opts[i].key, "client_rate") == 0) client_rate = atof(opts[i].value);
+        if (strcmp(opts[i].key, "client_burst") == 0) client_burst = atof(opts[i].value);
+        if (strcmp(opts[i].key, "source_rate") == 0) source_rate = atof(opts[i].value);
+        if (strcmp(opts[i].key, "source_burst") == 0) source_burst = atof(opts[i].value);
+        if (strcmp(opts[i].key, "shaping_capacity") == 0) shaping_capacity = atof(opts[i].value);
+        if (strcmp(opts[i].key, "replay_filter") == 0) replay_filter_enabled = (strcmp(opts[i].value, "false") != 0);
+        if (strcmp(opts[i].key, "replay_cache_size") == 0) replay_cache_size = atoi(opts[i].value);
+        if (strcmp(opts[i].key, "verify_threads") == 0) verify_threads = atoi(opts[i].value);
+        if (strcmp(opts[i].key, "verify_batch") == 0) verify_batch = atoi(opts[i].value);
+        if (strcmp(opts[i].key, "trust_topics") == 0) strncpy(trust_topics, opts[i].value, sizeof(trust_topics) - 1);
+        if (strcmp(opts[i].key, "json_arena_size") == 0) json_arena_size = atoi(opts[i].value);
+        if (strcmp(opts[i].key, "metrics_interval") == 0) metrics_interval = atoi(opts[i].value);
+        if (strcmp(opts[i].key, "metrics_port") == 0) metrics_port = atoi(opts[i].value);
+        if (strcmp(opts[i].key, "feedback_bridges") == 0) strncpy(feedback_bridges, opts[i].value, sizeof(feedback_bridges) - 1);
+        if (strcmp(opts[i].key, "trust_shm_file") == 0) strncpy(trust_shm_file, opts[i].value, sizeof(trust_shm_file) - 1);
+        if (strcmp(opts[i].key, "trust_shm_nodes") == 0) trust_shm_nodes = atoi(opts[i].value);
+        if (strcmp(opts[i].key, "trust_shm_links") == 0) trust_shm_links = atoi(opts[i].value);
+        if (strcmp(opts[i].key, "metrics_bind") == 0) strncpy(metrics_bind, opts[i].value, sizeof(metrics_bind) - 1);
+        if (strcmp(opts[i].key, "trust_flush_interval") == 0) trust_flush_interval = atoi(opts[i].value);
+        if (strcmp(opts[i].key, "trust_flush_dirty") == 0) {
+            trust_flush_dirty = atoi(opts[i].value);
+            if (trust_flush_dirty < 1) trust_flush_dirty = 1;
+        }
+        if (strcmp(opts[i].key, "hmac_verify") == 0) {
+            hmac_verify_mode = (strcmp(opts[i].value, "canonical") == 0) ? HMAC_VERIFY_CANONICAL : HMAC_VERIFY_RAW;
+        }
     }
     
-    log_fp = fopen(log_file_path, "a");
+    if (file_log_rank == LOG_RANK_NONE || !trust_log_open(log_file_path)) file_log_rank = LOG_RANK_NONE;
+    min_log_rank = (file_log_rank < broker_log_rank) ? file_log_rank : broker_log_rank;
     
     plugin_log(MOSQ_LOG_INFO, "--- Trust-based plugin initializing (V4.1 - Standalone Mode w/Logs) ---");
-    load_acl_file(acl_file_path);
-    load_network_graph(network_map_file);
-    load_local_trust_store();
+    if (!load_hmac_keys()) {
+        plugin_log(MOSQ_LOG_ERR, "[INIT] Could not prepare HMAC keys%s%s.", hmac_keyring_file[0] ? " from " : "", hmac_keyring_file);
+        trust_log_close();
+        return MOSQ_ERR_UNKNOWN;
+    }
+    plugin_log(MOSQ_LOG_INFO, "[INIT] HMAC verification mode: %s", hmac_verify_mode == HMAC_VERIFY_RAW ? "raw" : "canonical");
+    int acl_rules = load_acl_file(acl_file_path);
+    if (acl_rules < 0) {
+        plugin_log(MOSQ_LOG_WARNING, "[INIT] Could not read ACL file %s. All tokens will be denied.", acl_file_path);
+    } else {
+        plugin_log(MOSQ_LOG_INFO, "[INIT] Loaded %d ACL rules from %s.", acl_rules, acl_file_path);
+    }
+    int topic_filters = topics_configure(trust_topics);
+    if (topic_filters < 0) {
+        plugin_log(MOSQ_LOG_WARNING, "[INIT] Malformed trust_topics \"%s\". Evaluating all topics.", trust_topics);
+    } else if (topic_filters > 0) {
+        plugin_log(MOSQ_LOG_INFO, "[INIT] Evaluating only topics matching %s.", trust_topics);
+    }
+    default_decision = make_trust_decision(0, 0);
+    if (json_arena_size > 0 && !trust_arena_install((size_t)json_arena_size)) {
+        plugin_log(MOSQ_LOG_WARNING, "[INIT] Could not set up the %d byte JSON arena. cJSON will use malloc().", json_arena_size);
+    }
+    network_map_changed();
+    // A burst defaults to one second's worth of messages.
+    admit_configure(client_rate, client_burst > 0 ? client_burst : client_rate,
+                    source_rate, source_burst > 0 ? source_burst : source_rate);
+    plugin_log(MOSQ_LOG_INFO, "[INIT] Admission limits: size=%d depth=%d signers=%d client_rate=%.1f/s source_rate=%.1f/s",
+               max_token_size, max_token_depth, max_token_signers, client_rate, source_rate);
+    shape_configure(shaping_capacity);
+    if (shape_enabled()) {
+        plugin_log(MOSQ_LOG_INFO, "[INIT] Trust-weighted shaping enabled: %.1f msg/s shared by upstream signers.", shaping_capacity);
+    }
+    if (replay_filter_enabled) {
+        if (replay_cache_size > 0 && replay_init((size_t)replay_cache_size)) {
+            plugin_log(MOSQ_LOG_INFO, "[INIT] Replay filter on: %d issuer/client pairs, window of %d msg_ids.",
+                       replay_cache_size, REPLAY_WINDOW);
+        } else {
+            plugin_log(MOSQ_LOG_WARNING, "[INIT] Could not set up the replay filter. Replays will not be dropped.");
+            replay_filter_enabled = false;
+        }
+    }
+    if (trust_shm_file[0]) {
+        if (trust_shm_attach(trust_shm_file, trust_shm_nodes, trust_shm_links)) {
+            plugin_log(MOSQ_LOG_INFO, "[INIT] Sharing link trust with co-located brokers through %s.", trust_shm_file);
+        } else {
+            plugin_log(MOSQ_LOG_WARNING, "[INIT] Could not map shared trust segment %s. Using the network map file.", trust_shm_file);
+        }
+    }
+    reload_trust_state();
+    if (metrics_port > 0) {
+        if (metrics_serve(metrics_bind, metrics_port)) {
+            plugin_log(MOSQ_LOG_INFO, "[INIT] Serving Prometheus metrics on %s:%d/metrics.",
+                       metrics_bind[0] ? metrics_bind : "*", metrics_port);
+        } else {
+            plugin_log(MOSQ_LOG_WARNING, "[INIT] Could not listen for metrics scrapes on port %d.", metrics_port);
+            metrics_port = 0;
+        }
+    }
+    if (metrics_interval > 0) {
+        plugin_log(MOSQ_LOG_INFO, "[INIT] Publishing metrics under $SYS/trust/ every %ds.", metrics_interval);
+    }
+    metrics_timing = metrics_interval > 0 || metrics_port > 0;
+    if (verify_threads > 0) {
+        if (pool_start(verify_threads, verify_batch, verify_jobs_run, verify_job_discard)) {
+            plugin_log(MOSQ_LOG_INFO, "[INIT] Verifying tokens on %d worker threads, up to %d per batch.", verify_threads, verify_batch);
+        } else {
+            plugin_log(MOSQ_LOG_WARNING, "[INIT] Could not start verification workers. Tokens will be verified in place.");
+        }
+    }
     
     mosquitto_callback_register(mosq_pid, MOSQ_EVT_MESSAGE, callback_message, NULL, NULL);
     mosquitto_callback_register(mosq_pid, MOSQ_EVT_TICK, callback_tick, NULL, NULL);
+    mosquitto_callback_register(mosq_pid, MOSQ_EVT_DISCONNECT, callback_disconnect, NULL, NULL);
+    mosquitto_callback_register(mosq_pid, MOSQ_EVT_RELOAD, callback_reload, NULL, NULL);
 
     
     plugin_log(MOSQ_LOG_INFO, "[INIT] ✅ Plugin initialization complete.");
@@ -563,12 +2553,36 @@ int mosquitto_plugin_cleanup(void *user_data, struct mosquitto_opt *opts, int op
     UNUSED(user_data); UNUSED(opts); UNUSED(opt_count);
     
     plugin_log(MOSQ_LOG_INFO, "--- Trust-based plugin shutting down ---");
-    save_local_trust_store();
+    pool_stop();
+    metrics_stop();
+    trust_arena_uninstall();
+    apply_feedback();
+    shm_publish_local();
+    trust_shm_detach();
+    flush_trust_store();
+    keyring_cleanup();
+    acl_cleanup();
+    topics_cleanup();
+    replay_cleanup();
+    admit_cleanup();
+    shape_cleanup();
+    graph_free(&graph_buffers[0]);
+    graph_free(&graph_buffers[1]);
+    free(trust_table);
+    trust_table = NULL;
+    free(feedback_deltas);
+    feedback_deltas = NULL;
+    free(feedback_next_hop);
+    feedback_next_hop = NULL;
+    free_feedback_unrouted();
+    free_path_cache();
     
-    if (log_fp) { fclose(log_fp); }
+    trust_log_close();
     
     mosquitto_callback_unregister(mosq_pid, MOSQ_EVT_MESSAGE, callback_message, NULL);
     mosquitto_callback_unregister(mosq_pid, MOSQ_EVT_TICK, callback_tick, NULL);
+    mosquitto_callback_unregister(mosq_pid, MOSQ_EVT_DISCONNECT, callback_disconnect, NULL);
+    mosquitto_callback_unregister(mosq_pid, MOSQ_EVT_RELOAD, callback_reload, NULL);
 
     
     return MOSQ_ERR_SUCCESS;
@@ -0,0 +1,171 @@
+// trust_acl.c - indexed ACL for the trust plugin (see trust_acl.h)
+//
+// Rules are indexed by client ID in a hash table. Each client holds one topic
+// trie per access type, with one node per topic level. A lookup costs one hash
+// probe plus a walk down the trie, so it scales with topic depth rather than
+// with the number of rules.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uthash.h>
+
+#include "trust_acl.h"
+
+enum { ACL_ACCESS_SUB = 0, ACL_ACCESS_PUB = 1 };
+
+typedef struct acl_topic_node {
+    char *level;                        // this level's name; NULL for the root
+    struct acl_topic_node *children;    // literal child levels, hashed by name
+    struct acl_topic_node *plus;        // '+' child level
+    bool match_here;                    // a rule ends exactly at this level
+    bool match_hash;                    // a rule ends with '#' directly below this level
+    UT_hash_handle hh;
+} acl_topic_node_t;
+
+typedef struct {
+    char *client_id;
+    acl_topic_node_t *roots[2];         // indexed by ACL_ACCESS_*
+    UT_hash_handle hh;
+} acl_client_t;
+
+static acl_client_t *acl_index = NULL;
+
+static void acl_node_free(acl_topic_node_t *node) {
+    if (!node) return;
+    acl_topic_node_t *child, *tmp;
+    HASH_ITER(hh, node->children, child, tmp) {
+        HASH_DEL(node->children, child);
+        acl_node_free(child);
+    }
+    acl_node_free(node->plus);
+    free(node->level);
+    free(node);
+}
+
+static void acl_index_free(acl_client_t **index) {
+    acl_client_t *client, *tmp;
+    HASH_ITER(hh, *index, client, tmp) {
+        HASH_DEL(*index, client);
+        acl_node_free(client->roots[ACL_ACCESS_SUB]);
+        acl_node_free(client->roots[ACL_ACCESS_PUB]);
+        free(client->client_id);
+        free(client);
+    }
+    *index = NULL;
+}
+
+static acl_topic_node_t *acl_node_child(acl_topic_node_t *node, const char *level, size_t len) {
+    acl_topic_node_t *child = NULL;
+    if (len == 1 && level[0] == '+') {
+        if (!node->plus) node->plus = calloc(1, sizeof(acl_topic_node_t));
+        return node->plus;
+    }
+    HASH_FIND(hh, node->children, level, len, child);
+    if (child) return child;
+
+    child = calloc(1, sizeof(acl_topic_node_t));
+    if (!child) return NULL;
+    child->level = strndup(level, len);
+    if (!child->level) { free(child); return NULL; }
+    HASH_ADD_KEYPTR(hh, node->children, child->level, len, child);
+    return child;
+}
+
+static bool acl_index_add(acl_client_t **index, const char *client_id, const char *access, const char *topic) {
+    int access_idx;
+    if (strcmp(access, "pub") == 0) access_idx = ACL_ACCESS_PUB;
+    else if (strcmp(access, "sub") == 0) access_idx = ACL_ACCESS_SUB;
+    else return false;
+
+    acl_client_t *client = NULL;
+    HASH_FIND(hh, *index, client_id, strlen(client_id), client);
+    if (!client) {
+        client = calloc(1, sizeof(acl_client_t));
+        if (!client) return false;
+        client->client_id = strdup(client_id);
+        if (!client->client_id) { free(client); return false; }
+        HASH_ADD_KEYPTR(hh, *index, client->client_id, strlen(client->client_id), client);
+    }
+    if (!client->roots[access_idx]) {
+        client->roots[access_idx] = calloc(1, sizeof(acl_topic_node_t));
+        if (!client->roots[access_idx]) return false;
+    }
+
+    acl_topic_node_t *node = client->roots[access_idx];
+    const char *level = topic;
+    while (node) {
+        const char *slash = strchr(level, '/');
+        size_t len = slash ? (size_t)(slash - level) : strlen(level);
+        if (len == 1 && level[0] == '#') {
+            node->match_hash = true;
+            return true;
+        }
+        node = acl_node_child(node, level, len);
+        if (!slash) break;
+        level = slash + 1;
+    }
+    if (!node) return false;
+    node->match_here = true;
+    return true;
+}
+
+/**
+ * Matches the remaining topic levels (`level`, NULL once exhausted) against
+ * the trie below `node`. Wildcards never match a leading '$' level.
+ */
+static bool acl_match(const acl_topic_node_t *node, const char *level, bool first_level) {
+    if (!level) return node->match_here || node->match_hash;
+
+    bool wildcards = !(first_level && level[0] == '$');
+    if (wildcards && node->match_hash) return true;
+
+    const char *slash = strchr(level, '/');
+    size_t len = slash ? (size_t)(slash - level) : strlen(level);
+    const char *next = slash ? slash + 1 : NULL;
+
+    acl_topic_node_t *child = NULL;
+    HASH_FIND(hh, node->children, level, len, child);
+    if (child && acl_match(child, next, false)) return true;
+    if (wildcards && node->plus && acl_match(node->plus, next, false)) return true;
+    return false;
+}
+
+/**
+ * Builds a fresh index from `filename` and swaps it in. Returns the number of
+ * rules loaded, or -1 if the file can't be read (the current index is kept).
+ */
+int load_acl_file(const char *filename) {
+    FILE *fp = fopen(filename, "r");
+    if (!fp) { return -1; }
+    acl_client_t *index = NULL;
+    int rule_count = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[0] == '#' || strlen(line) < 5) continue;
+        char *client = strtok(line, ",");
+        char *access = strtok(NULL, ",");
+        char *topic = strtok(NULL, ",");
+        if (client && access && topic && acl_index_add(&index, client, access, topic)) {
+            rule_count++;
+        }
+    }
+    fclose(fp);
+
+    acl_index_free(&acl_index);
+    acl_index = index;
+    return rule_count;
+}
+
+bool check_permission(const char *client_id, const char *topic, bool is_publish) {
+    acl_client_t *client = NULL;
+    HASH_FIND(hh, acl_index, client_id, strlen(client_id), client);
+    if (!client) return false;
+    const acl_topic_node_t *root = client->roots[is_publish ? ACL_ACCESS_PUB : ACL_ACCESS_SUB];
+    return root && acl_match(root, topic, true);
+}
+
+void acl_cleanup(void) {
+    acl_index_free(&acl_index);
+}
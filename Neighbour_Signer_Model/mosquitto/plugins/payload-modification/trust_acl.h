@@ -0,0 +1,15 @@
+// trust_acl.h - client/topic ACL for the trust plugin
+//
+// Rules come from a text file of `client_id,access,topic` lines, where access
+// is "pub" or "sub" and topic may use the MQTT '+' and '#' wildcards.
+
+#ifndef TRUST_ACL_H
+#define TRUST_ACL_H
+
+#include <stdbool.h>
+
+int load_acl_file(const char *filename);
+bool check_permission(const char *client_id, const char *topic, bool is_publish);
+void acl_cleanup(void);
+
+#endif // TRUST_ACL_H
@@ -0,0 +1,132 @@
+// trust_admit.c - token-bucket rate limits (see trust_admit.h)
+//
+// Buckets are refilled lazily: each one remembers when it was last topped up
+// and adds rate * elapsed tokens the next time it is touched, so idle clients
+// cost nothing.
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <uthash.h>
+
+#include "trust_admit.h"
+
+typedef struct {
+    double tokens;
+    double updated;                     // monotonic seconds at the last refill
+} token_bucket_t;
+
+typedef struct {
+    const void *client;
+    token_bucket_t bucket;
+    UT_hash_handle hh;
+} client_bucket_t;
+
+typedef struct {
+    char *address;
+    token_bucket_t bucket;
+    UT_hash_handle hh;
+} source_bucket_t;
+
+static double client_rate = 0, client_burst = 0;
+static double source_rate = 0, source_burst = 0;
+static client_bucket_t *client_buckets = NULL;
+static source_bucket_t *source_buckets = NULL;
+
+static double monotonic_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void admit_configure(double c_rate, double c_burst, double s_rate, double s_burst) {
+    client_rate = c_rate > 0 ? c_rate : 0;
+    client_burst = c_burst >= 1 ? c_burst : 1;
+    source_rate = s_rate > 0 ? s_rate : 0;
+    source_burst = s_burst >= 1 ? s_burst : 1;
+}
+
+static void bucket_refill(token_bucket_t *b, double rate, double burst, double now) {
+    b->tokens += (now - b->updated) * rate;
+    if (b->tokens > burst) b->tokens = burst;
+    b->updated = now;
+}
+
+admit_verdict_t admit_take(const void *client, const char *address) {
+    if (client_rate == 0 && source_rate == 0) return ADMIT_OK;
+    double now = monotonic_now();
+
+    client_bucket_t *cb = NULL;
+    if (client_rate > 0 && client) {
+        HASH_FIND_PTR(client_buckets, &client, cb);
+        if (!cb && (cb = calloc(1, sizeof(*cb)))) {
+            cb->client = client;
+            cb->bucket = (token_bucket_t){ client_burst, now };
+            HASH_ADD_PTR(client_buckets, client, cb);
+        }
+        if (cb) {
+            bucket_refill(&cb->bucket, client_rate, client_burst, now);
+            if (cb->bucket.tokens < 1) return ADMIT_CLIENT_RATE;
+        }
+    }
+
+    source_bucket_t *sb = NULL;
+    if (source_rate > 0 && address) {
+        HASH_FIND_STR(source_buckets, address, sb);
+        if (!sb && (sb = calloc(1, sizeof(*sb)))) {
+            sb->address = strdup(address);
+            if (!sb->address) {
+                free(sb);
+                sb = NULL;
+            } else {
+                sb->bucket = (token_bucket_t){ source_burst, now };
+                HASH_ADD_KEYPTR(hh, source_buckets, sb->address, strlen(sb->address), sb);
+            }
+        }
+        if (sb) {
+            bucket_refill(&sb->bucket, source_rate, source_burst, now);
+            if (sb->bucket.tokens < 1) return ADMIT_SOURCE_RATE;
+        }
+    }
+
+    // Only charge the buckets once both have agreed to admit.
+    if (cb) cb->bucket.tokens -= 1;
+    if (sb) sb->bucket.tokens -= 1;
+    return ADMIT_OK;
+}
+
+void admit_forget_client(const void *client) {
+    client_bucket_t *cb = NULL;
+    HASH_FIND_PTR(client_buckets, &client, cb);
+    if (cb) {
+        HASH_DEL(client_buckets, cb);
+        free(cb);
+    }
+}
+
+void admit_prune(void) {
+    double now = monotonic_now();
+    source_bucket_t *sb, *tmp;
+    HASH_ITER(hh, source_buckets, sb, tmp) {
+        bucket_refill(&sb->bucket, source_rate, source_burst, now);
+        if (sb->bucket.tokens >= source_burst) {
+            HASH_DEL(source_buckets, sb);
+            free(sb->address);
+            free(sb);
+        }
+    }
+}
+
+void admit_cleanup(void) {
+    client_bucket_t *cb, *ctmp;
+    HASH_ITER(hh, client_buckets, cb, ctmp) {
+        HASH_DEL(client_buckets, cb);
+        free(cb);
+    }
+    source_bucket_t *sb, *stmp;
+    HASH_ITER(hh, source_buckets, sb, stmp) {
+        HASH_DEL(source_buckets, sb);
+        free(sb->address);
+        free(sb);
+    }
+}
@@ -0,0 +1,23 @@
+// trust_admit.h - token-bucket rate limits for the trust plugin
+//
+// Each connected client gets a bucket of `client_burst` messages refilled at
+// `client_rate` per second, and each source address one of `source_burst`
+// refilled at `source_rate`. A message is admitted only if both buckets have a
+// token left. A rate of 0 disables that limit.
+//
+// Client buckets are keyed by the broker's client handle and must be dropped
+// with admit_forget_client() when the client disconnects. Address buckets that
+// have refilled completely are dropped by admit_prune().
+
+#ifndef TRUST_ADMIT_H
+#define TRUST_ADMIT_H
+
+typedef enum { ADMIT_OK, ADMIT_CLIENT_RATE, ADMIT_SOURCE_RATE } admit_verdict_t;
+
+void admit_configure(double client_rate, double client_burst, double source_rate, double source_burst);
+admit_verdict_t admit_take(const void *client, const char *address);
+void admit_forget_client(const void *client);
+void admit_prune(void);
+void admit_cleanup(void);
+
+#endif // TRUST_ADMIT_H
@@ -0,0 +1,410 @@
+/*
+ * Trust map aggregator: the compiled counterpart of aggregator.py.
+ *
+ * Merges every broker's local trust store (trust_history/trust_store_<ID>.txt)
+ * into network_map.txt, where a store's line "source,r,s" sets the trust of
+ * link source -> <ID>. Links with no store line keep the baseline of 0.5.
+ *
+ * Unlike the script, it keeps the merged map in memory between passes:
+ * brokers are discovered from the store directory, only stores whose
+ * inode, size or mtime changed are re-read, and the map is only rewritten
+ * (to a temporary file, then renamed over it) when a link value changed.
+ * The topology is re-read only when something other than the aggregator
+ * rewrites the map.
+ *
+ * Usage:
+ *   trust_aggregator [-m network_map.txt] [-s trust_history] [-w interval_ms] [-v]
+ *
+ * Without -w it runs one pass and exits, like aggregator.py. With -w it stays
+ * up and checks the store directory every interval_ms milliseconds.
+ *
+ * Build with:
+ *   make aggregator
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uthash.h"
+
+#define BASE_PATH "/home/dhruv/winshare/Neighbour_Signer_Model/mosquitto/plugins/payload-modification"
+#define STORE_PREFIX "trust_store_"
+#define STORE_SUFFIX ".txt"
+
+// Trust calculation parameters (must match the C plugin)
+static const double BASE_RATE_DELTA = 0.5;
+static const double BASELINE_TRUST = 0.5;
+
+typedef struct { ino_t ino; off_t size; struct timespec mtime; } file_stamp_t;
+
+// One link of the topology. The key is "source\0target".
+typedef struct {
+    UT_hash_handle hh;
+    double trust;
+    double written;                 // trust as last written to the map
+    size_t key_len;
+    const char *target;             // points into key
+    char key[];
+} agg_link_t;
+
+// One broker's trust store and the links its last merge set.
+typedef struct {
+    UT_hash_handle hh;
+    file_stamp_t stamp;
+    bool seen;                      // found by the latest directory scan
+    agg_link_t **set;
+    int set_count, set_capacity;
+    char owner[];
+} agg_store_t;
+
+static const char *map_path = BASE_PATH "/network_map.txt";
+static const char *store_dir = BASE_PATH "/trust_history";
+static bool verbose = false;
+
+static agg_link_t *link_index = NULL;
+static agg_link_t **links = NULL;   // sorted by source, then target
+static int link_count = 0;
+static agg_store_t *stores = NULL;
+static file_stamp_t written_stamp;  // the map as this process last wrote it
+static volatile sig_atomic_t stopping = 0;
+
+static void agg_log(const char *level, const char *fmt, ...) {
+    if (!verbose && strcmp(level, "DEBUG") == 0) return;
+    char stamp[32];
+    time_t now = time(NULL);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    printf("[%s] [%s] ", stamp, level);
+    va_list va;
+    va_start(va, fmt);
+    vprintf(fmt, va);
+    va_end(va);
+    putchar('\n');
+    fflush(stdout);
+}
+
+static double calculate_trust(long r, long s) {
+    if (r < 0 || s < 0) return 0.0;
+    double denominator = (double)(r + s + 2);
+    return (double)r / denominator + BASE_RATE_DELTA * (2.0 / denominator);
+}
+
+static bool stat_stamp(const char *path, file_stamp_t *stamp) {
+    struct stat st;
+    if (stat(path, &st) != 0) return false;
+    *stamp = (file_stamp_t){ st.st_ino, st.st_size, st.st_mtim };
+    return true;
+}
+
+static bool stamp_equal(const file_stamp_t *a, const file_stamp_t *b) {
+    return a->ino == b->ino && a->size == b->size
+        && a->mtime.tv_sec == b->mtime.tv_sec && a->mtime.tv_nsec == b->mtime.tv_nsec;
+}
+
+// ---- Topology ----
+
+static agg_link_t *find_link(const char *source, const char *target) {
+    char key[512];
+    size_t source_len = strlen(source), target_len = strlen(target);
+    if (source_len + target_len + 1 >= sizeof(key)) return NULL;
+    memcpy(key, source, source_len + 1);
+    memcpy(key + source_len + 1, target, target_len);
+    agg_link_t *link = NULL;
+    HASH_FIND(hh, link_index, key, source_len + 1 + target_len, link);
+    return link;
+}
+
+static int link_order(const void *a, const void *b) {
+    const agg_link_t *x = *(agg_link_t *const *)a, *y = *(agg_link_t *const *)b;
+    int c = strcmp(x->key, y->key);
+    return c ? c : strcmp(x->target, y->target);
+}
+
+static void free_topology(void) {
+    agg_link_t *link, *tmp;
+    HASH_ITER(hh, link_index, link, tmp) {
+        HASH_DEL(link_index, link);
+        free(link);
+    }
+    free(links);
+    links = NULL;
+    link_count = 0;
+}
+
+/**
+ * Reads the links (not their trust) from the map. Every link starts at the
+ * baseline, so all stores have to be merged again afterwards.
+ */
+static bool load_topology(void) {
+    FILE *fp = fopen(map_path, "r");
+    if (!fp) return false;
+    free_topology();
+
+    int capacity = 0;
+    bool ok = true;
+    char line[512];
+    while (ok && fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') continue;
+        char *source = strtok(line, ",\r\n");
+        char *target = strtok(NULL, ",\r\n");
+        if (!source || !target || find_link(source, target)) continue;
+
+        size_t source_len = strlen(source), target_len = strlen(target);
+        agg_link_t *link = malloc(sizeof(*link) + source_len + target_len + 2);
+        if (!link) { ok = false; break; }
+        memcpy(link->key, source, source_len + 1);
+        memcpy(link->key + source_len + 1, target, target_len + 1);
+        link->key_len = source_len + 1 + target_len;
+        link->target = link->key + source_len + 1;
+        link->trust = BASELINE_TRUST;
+        link->written = -1.0;
+        if (link_count == capacity) {
+            int new_capacity = capacity ? capacity * 2 : 64;
+            agg_link_t **grown = realloc(links, (size_t)new_capacity * sizeof(*grown));
+            if (!grown) { free(link); ok = false; break; }
+            links = grown;
+            capacity = new_capacity;
+        }
+        links[link_count++] = link;
+        HASH_ADD(hh, link_index, key, link->key_len, link);
+    }
+    if (ferror(fp)) ok = false;
+    fclose(fp);
+    if (!ok) {
+        free_topology();
+        return false;
+    }
+    qsort(links, (size_t)link_count, sizeof(*links), link_order);
+    return true;
+}
+
+// ---- Trust Stores ----
+
+/**
+ * Puts the links set by the store's previous merge back to the baseline.
+ */
+static void unmerge_store(agg_store_t *store) {
+    for (int i = 0; i < store->set_count; i++) store->set[i]->trust = BASELINE_TRUST;
+    store->set_count = 0;
+}
+
+/**
+ * Re-reads one store and applies its lines over the baseline.
+ */
+static void merge_store(agg_store_t *store, const char *path) {
+    unmerge_store(store);
+    FILE *fp = fopen(path, "r");
+    if (!fp) return;
+
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') continue;
+        char *source = strtok(line, ",");
+        char *r_str = strtok(NULL, ",");
+        char *s_str = strtok(NULL, ",\r\n");
+        if (!source || !r_str || !s_str) continue;
+        char *r_end, *s_end;
+        long r = strtol(r_str, &r_end, 10);
+        long s = strtol(s_str, &s_end, 10);
+        if (r_end == r_str || s_end == s_str) continue;
+
+        agg_link_t *link = find_link(source, store->owner);
+        if (!link) {
+            agg_log("WARN", "  - Found link %s->%s in store, but not in base topology. Ignoring.", source, store->owner);
+            continue;
+        }
+        if (store->set_count == store->set_capacity) {
+            int new_capacity = store->set_capacity ? store->set_capacity * 2 : 8;
+            agg_link_t **grown = realloc(store->set, (size_t)new_capacity * sizeof(*grown));
+            if (!grown) break;
+            store->set = grown;
+            store->set_capacity = new_capacity;
+        }
+        store->set[store->set_count++] = link;
+        link->trust = calculate_trust(r, s);
+        agg_log("DEBUG", "  - Updated link %s->%s with trust %.3f (r=%ld, s=%ld)", source, store->owner, link->trust, r, s);
+    }
+    fclose(fp);
+}
+
+static void free_store(agg_store_t *store) {
+    HASH_DEL(stores, store);
+    free(store->set);
+    free(store);
+}
+
+/**
+ * Scans the store directory and merges every store that is new or changed
+ * since the last pass; stores that disappeared are unmerged. Returns true if
+ * any store was merged or unmerged.
+ */
+static bool merge_changed_stores(bool force) {
+    DIR *dir = opendir(store_dir);
+    if (!dir) {
+        agg_log("ERROR", "Could not open trust store directory %s.", store_dir);
+        return false;
+    }
+    bool changed = false;
+    agg_store_t *store, *tmp;
+    HASH_ITER(hh, stores, store, tmp) store->seen = false;
+
+    const size_t prefix_len = strlen(STORE_PREFIX), suffix_len = strlen(STORE_SUFFIX);
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        const char *name = entry->d_name;
+        size_t name_len = strlen(name);
+        if (name_len <= prefix_len + suffix_len || strncmp(name, STORE_PREFIX, prefix_len) != 0
+                || strcmp(name + name_len - suffix_len, STORE_SUFFIX) != 0) continue;
+
+        char path[1024];
+        file_stamp_t stamp;
+        snprintf(path, sizeof(path), "%s/%s", store_dir, name);
+        if (!stat_stamp(path, &stamp)) continue;
+
+        const char *owner = name + prefix_len;
+        size_t owner_len = name_len - prefix_len - suffix_len;
+        HASH_FIND(hh, stores, owner, owner_len, store);
+        if (!store) {
+            store = calloc(1, sizeof(*store) + owner_len + 1);
+            if (!store) continue;
+            memcpy(store->owner, owner, owner_len);
+            HASH_ADD_KEYPTR(hh, stores, store->owner, owner_len, store);
+            agg_log("INFO", "Discovered trust store for %s.", store->owner);
+        } else if (!force && stamp_equal(&stamp, &store->stamp)) {
+            store->seen = true;
+            continue;
+        }
+        store->seen = true;
+        store->stamp = stamp;
+        agg_log("INFO", "Processing trust store for %s...", store->owner);
+        merge_store(store, path);
+        changed = true;
+    }
+    closedir(dir);
+
+    HASH_ITER(hh, stores, store, tmp) {
+        if (store->seen) continue;
+        agg_log("INFO", "Trust store for %s is gone. Resetting its links.", store->owner);
+        unmerge_store(store);
+        free_store(store);
+        changed = true;
+    }
+    return changed;
+}
+
+// ---- Map Output ----
+
+static bool map_changed(void) {
+    for (int i = 0; i < link_count; i++) {
+        if (links[i]->trust != links[i]->written) return true;
+    }
+    return false;
+}
+
+/**
+ * Writes the map next to itself and renames it into place, so the plugin
+ * never reads a half-written file.
+ */
+static bool write_map(void) {
+    char temp_path[1024];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", map_path);
+    FILE *fp = fopen(temp_path, "w");
+    if (!fp) {
+        agg_log("ERROR", "Failed to write network map file: %s", strerror(errno));
+        return false;
+    }
+    char stamp[32];
+    time_t now = time(NULL);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S UTC", gmtime(&now));
+    fprintf(fp, "# Network Topology - Last aggregated at %s\n", stamp);
+    for (int i = 0; i < link_count; i++) {
+        fprintf(fp, "%s,%s,%.3f\n", links[i]->key, links[i]->target, links[i]->trust);
+    }
+    bool ok = (fflush(fp) == 0 && fsync(fileno(fp)) == 0);
+    if (fclose(fp) != 0) ok = false;
+    if (!ok || rename(temp_path, map_path) != 0) {
+        agg_log("ERROR", "Failed to write network map file: %s", strerror(errno));
+        unlink(temp_path);
+        return false;
+    }
+    for (int i = 0; i < link_count; i++) links[i]->written = links[i]->trust;
+    stat_stamp(map_path, &written_stamp);
+    return true;
+}
+
+/**
+ * One aggregation pass. Returns false if the map could not be read.
+ */
+static bool aggregate(void) {
+    file_stamp_t map_stamp;
+    if (!stat_stamp(map_path, &map_stamp)) {
+        agg_log("ERROR", "Network map file not found at %s. Cannot proceed.", map_path);
+        return false;
+    }
+    bool reloaded = false;
+    if (!links || !stamp_equal(&map_stamp, &written_stamp)) {
+        agg_log("DEBUG", "Reading base topology from: %s", map_path);
+        if (!load_topology()) {
+            agg_log("ERROR", "Could not read network map file %s.", map_path);
+            return false;
+        }
+        agg_log("INFO", "Loaded base topology with %d links.", link_count);
+        written_stamp = map_stamp;
+        reloaded = true;
+    }
+    bool merged = merge_changed_stores(reloaded);
+    if ((merged || reloaded) && map_changed()) {
+        agg_log("INFO", "Writing new authoritative network map to %s...", map_path);
+        if (write_map()) agg_log("SUCCESS", "Aggregation complete. Network map has been updated.");
+    }
+    return true;
+}
+
+static void handle_signal(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+int main(int argc, char *argv[]) {
+    long interval_ms = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "m:s:w:v")) != -1) {
+        switch (opt) {
+            case 'm': map_path = optarg; break;
+            case 's': store_dir = optarg; break;
+            case 'w': interval_ms = strtol(optarg, NULL, 10); break;
+            case 'v': verbose = true; break;
+            default:
+                fprintf(stderr, "Usage: %s [-m network_map.txt] [-s trust_history] [-w interval_ms] [-v]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    if (interval_ms <= 0) {
+        agg_log("INFO", "Starting trust map aggregation process...");
+        return aggregate() ? 0 : 1;
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    agg_log("INFO", "Watching %s every %ld ms.", store_dir, interval_ms);
+    struct timespec interval = { interval_ms / 1000, (interval_ms % 1000) * 1000000 };
+    while (!stopping) {
+        aggregate();
+        nanosleep(&interval, NULL);
+    }
+
+    free_topology();
+    agg_store_t *store, *tmp;
+    HASH_ITER(hh, stores, store, tmp) free_store(store);
+    agg_log("INFO", "Aggregator stopped.");
+    return 0;
+}
@@ -0,0 +1,139 @@
+// trust_arena.c - per-message bump allocator behind cJSON (see trust_arena.h)
+//
+// cJSON frees through the same hook whether a block came from the arena or
+// from a fallback malloc(), so trust_arena_free() tells them apart by address.
+// Between messages only the first chunk is kept, which keeps that check to a
+// single range compare in the common case.
+//
+// The hooks are process-wide, but all arena state is per thread: only the
+// thread that called trust_arena_install() has chunks, so on any other
+// thread, such as a verify worker, arena_owns() sees an empty list and the
+// hooks reduce to malloc() and free() without touching shared state.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cjson/cJSON.h>
+
+#include "trust_arena.h"
+
+#define ARENA_ALIGN 16
+
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+    _Alignas(ARENA_ALIGN) unsigned char data[];
+} arena_chunk_t;
+
+static __thread arena_chunk_t *first_chunk = NULL;
+static __thread arena_chunk_t *current_chunk = NULL;    // chunk being carved, last in the list
+static __thread size_t arena_chunk_size = 0;
+static __thread bool arena_open = false;
+static __thread trust_arena_stats_t arena_stats;
+
+static arena_chunk_t *chunk_new(size_t size) {
+    arena_chunk_t *chunk = malloc(sizeof(*chunk) + size);
+    if (!chunk) return NULL;
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    arena_stats.chunks++;
+    return chunk;
+}
+
+static bool arena_owns(const void *ptr) {
+    const unsigned char *p = ptr;
+    for (const arena_chunk_t *chunk = first_chunk; chunk; chunk = chunk->next) {
+        if (p >= chunk->data && p < chunk->data + chunk->size) return true;
+    }
+    return false;
+}
+
+/**
+ * Carves `size` bytes from the current chunk, chaining a new chunk when it is
+ * full. Returns NULL if that chunk can't be allocated.
+ */
+static void *arena_alloc(size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    arena_chunk_t *chunk = current_chunk;
+    if (chunk->size - chunk->used < size) {
+        arena_chunk_t *next = chunk_new(size > arena_chunk_size ? size : arena_chunk_size);
+        if (!next) return NULL;
+        chunk->next = next;
+        current_chunk = chunk = next;
+    }
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    arena_stats.allocs++;
+    return ptr;
+}
+
+void *trust_arena_malloc(size_t size) {
+    if (arena_open) {
+        void *ptr = arena_alloc(size);
+        if (ptr) return ptr;
+        arena_stats.fallbacks++;
+    }
+    return malloc(size);
+}
+
+void trust_arena_free(void *ptr) {
+    if (ptr && !arena_owns(ptr)) free(ptr);
+}
+
+char *trust_arena_strndup(const char *s, size_t len) {
+    char *copy = trust_arena_malloc(len + 1);
+    if (!copy) return NULL;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+bool trust_arena_install(size_t chunk_size) {
+    trust_arena_uninstall();
+    arena_chunk_size = chunk_size;
+    first_chunk = current_chunk = chunk_new(chunk_size);
+    if (!first_chunk) return false;
+    cJSON_Hooks hooks = { trust_arena_malloc, trust_arena_free };
+    cJSON_InitHooks(&hooks);
+    return true;
+}
+
+void trust_arena_uninstall(void) {
+    if (!first_chunk) return;
+    cJSON_InitHooks(NULL);
+    while (first_chunk) {
+        arena_chunk_t *next = first_chunk->next;
+        free(first_chunk);
+        first_chunk = next;
+    }
+    current_chunk = NULL;
+    arena_open = false;
+}
+
+void trust_arena_begin(void) {
+    arena_open = first_chunk != NULL;
+}
+
+/**
+ * Takes back everything allocated since trust_arena_begin(), releasing any
+ * chunks beyond the first.
+ */
+void trust_arena_end(void) {
+    if (!arena_open) return;
+    arena_open = false;
+    arena_chunk_t *extra = first_chunk->next;
+    while (extra) {
+        arena_chunk_t *next = extra->next;
+        free(extra);
+        extra = next;
+    }
+    first_chunk->next = NULL;
+    first_chunk->used = 0;
+    current_chunk = first_chunk;
+}
+
+void trust_arena_stats(trust_arena_stats_t *stats) {
+    *stats = arena_stats;
+}
@@ -0,0 +1,42 @@
+// trust_arena.h - per-message bump allocator behind cJSON
+//
+// trust_arena_install() points cJSON's allocator hooks at this module.
+// Between trust_arena_begin() and trust_arena_end() on the calling thread,
+// cJSON nodes, strings and print buffers are carved out of one arena, freeing
+// them does nothing, and trust_arena_end() takes all of it back at once.
+// Outside that window, and on any other thread, the hooks are plain malloc()
+// and free(), so other cJSON users in the broker are unaffected.
+//
+// The arena belongs to the thread that installed it (the broker thread), and
+// trust_arena_uninstall() must run on that thread too. Other threads never
+// see it, and trust_arena_stats() reports the calling thread's counts.
+
+#ifndef TRUST_ARENA_H
+#define TRUST_ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct {
+    unsigned long allocs;           // served from the arena
+    unsigned long fallbacks;        // served by malloc() while the arena was open
+    unsigned long chunks;           // chunks malloc()ed for the arena
+} trust_arena_stats_t;
+
+// `chunk_size` is the size of the first chunk, and the most kept between
+// messages; a message that needs more gets extra chunks for its duration.
+bool trust_arena_install(size_t chunk_size);
+void trust_arena_uninstall(void);
+
+void trust_arena_begin(void);
+void trust_arena_end(void);
+
+// Arena allocations while the arena is open, malloc() otherwise. Release
+// with trust_arena_free() (or cJSON_free()), which ignores arena memory.
+void *trust_arena_malloc(size_t size);
+char *trust_arena_strndup(const char *s, size_t len);
+void trust_arena_free(void *ptr);
+
+void trust_arena_stats(trust_arena_stats_t *stats);
+
+#endif // TRUST_ARENA_H
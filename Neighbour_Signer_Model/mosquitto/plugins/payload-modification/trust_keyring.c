@@ -0,0 +1,124 @@
+// trust_keyring.c - HMAC keys by key ID (see trust_keyring.h)
+//
+// Key IDs are hashed, so picking a token's key is one probe however many keys
+// are active during a rotation. Each set is reference counted: the live
+// pointer holds one reference and every queued verification another, and the
+// last release frees the set.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/crypto.h>
+#include <uthash.h>
+
+#include "trust_keyring.h"
+
+typedef struct {
+    trust_hmac_key_t *key;
+    UT_hash_handle hh;
+    char kid[];
+} keyring_entry_t;
+
+struct keyring {
+    int refs;
+    keyring_entry_t *by_kid;
+    trust_hmac_key_t *default_key;
+};
+
+static keyring_t *live_ring = NULL;
+
+static void keyring_free(keyring_t *ring) {
+    keyring_entry_t *entry, *tmp;
+    HASH_ITER(hh, ring->by_kid, entry, tmp) {
+        HASH_DEL(ring->by_kid, entry);
+        trust_hmac_key_free(entry->key);
+        free(entry);
+    }
+    trust_hmac_key_free(ring->default_key);
+    free(ring);
+}
+
+/**
+ * Adds `kid` with the given secret. Returns false only when memory runs out;
+ * a repeated key ID is ignored.
+ */
+static bool keyring_add(keyring_t *ring, const char *kid, const char *secret) {
+    size_t kid_len = strlen(kid);
+    keyring_entry_t *entry = NULL;
+    HASH_FIND(hh, ring->by_kid, kid, kid_len, entry);
+    if (entry) return true;
+
+    entry = malloc(sizeof(*entry) + kid_len + 1);
+    if (!entry) return false;
+    entry->key = trust_hmac_key_new(secret, strlen(secret));
+    if (!entry->key) {
+        free(entry);
+        return false;
+    }
+    memcpy(entry->kid, kid, kid_len + 1);
+    HASH_ADD(hh, ring->by_kid, kid[0], kid_len, entry);
+    return true;
+}
+
+keyring_t *keyring_load(const char *path, const char *default_key, int *key_count) {
+    *key_count = 0;
+    keyring_t *ring = calloc(1, sizeof(*ring));
+    if (!ring) return NULL;
+    ring->refs = 1;
+    if (default_key[0] && !(ring->default_key = trust_hmac_key_new(default_key, strlen(default_key)))) {
+        keyring_free(ring);
+        return NULL;
+    }
+    if (!path) return ring;
+
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        keyring_free(ring);
+        return NULL;
+    }
+    bool ok = true;
+    char line[512];
+    while (ok && fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "#\r\n")] = 0;
+        char *saveptr = NULL;
+        char *kid = strtok_r(line, " \t", &saveptr);
+        char *secret = strtok_r(NULL, " \t", &saveptr);
+        if (!kid || !secret || strlen(kid) > KEYRING_MAX_KID_LEN) continue;
+        ok = keyring_add(ring, kid, secret);
+    }
+    fclose(fp);
+    OPENSSL_cleanse(line, sizeof(line));
+    if (!ok) {
+        keyring_free(ring);
+        return NULL;
+    }
+    *key_count = (int)HASH_COUNT(ring->by_kid);
+    return ring;
+}
+
+void keyring_install(keyring_t *ring) {
+    keyring_t *old = live_ring;
+    live_ring = ring;
+    if (old) keyring_release(old);
+}
+
+const trust_hmac_key_t *keyring_find(const char *kid, size_t kid_len) {
+    if (!live_ring) return NULL;
+    if (!kid) return live_ring->default_key;
+    keyring_entry_t *entry = NULL;
+    HASH_FIND(hh, live_ring->by_kid, kid, kid_len, entry);
+    return entry ? entry->key : NULL;
+}
+
+keyring_t *keyring_acquire(void) {
+    if (live_ring) __atomic_add_fetch(&live_ring->refs, 1, __ATOMIC_RELAXED);
+    return live_ring;
+}
+
+void keyring_release(keyring_t *ring) {
+    if (ring && __atomic_sub_fetch(&ring->refs, 1, __ATOMIC_ACQ_REL) == 0) keyring_free(ring);
+}
+
+void keyring_cleanup(void) {
+    keyring_install(NULL);
+}
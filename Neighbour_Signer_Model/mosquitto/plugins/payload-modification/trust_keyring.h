@@ -0,0 +1,41 @@
+// trust_keyring.h - HMAC keys by key ID for the trust plugin
+//
+// Keys come from a text file of `kid key` lines ('#' starts a comment), each
+// prepared once with trust_hmac_key_new(), plus an optional default key for
+// tokens that carry no key ID. A loaded set never changes; keyring_install()
+// replaces the live set as a whole.
+//
+// keyring_find() and keyring_acquire() read the live set and belong to the
+// broker thread, like keyring_install(). A set taken with keyring_acquire()
+// stays valid, keys included, until keyring_release(), which may be called
+// from any thread, so work queued on the workers finishes with the keys it
+// started with.
+
+#ifndef TRUST_KEYRING_H
+#define TRUST_KEYRING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "trust_hmac.h"
+
+#define KEYRING_MAX_KID_LEN 32
+
+typedef struct keyring keyring_t;
+
+// `path` may be NULL for no keyring file, `default_key` empty for no default
+// key. Returns NULL if the file can't be read or memory runs out; malformed
+// lines and repeated key IDs are skipped. `key_count` receives the number of
+// key IDs loaded.
+keyring_t *keyring_load(const char *path, const char *default_key, int *key_count);
+void keyring_install(keyring_t *ring);
+
+// The key named by `kid` in the live set, or the default key if `kid` is
+// NULL. Returns NULL for an unknown key ID or a missing default key.
+const trust_hmac_key_t *keyring_find(const char *kid, size_t kid_len);
+
+keyring_t *keyring_acquire(void);
+void keyring_release(keyring_t *ring);
+void keyring_cleanup(void);
+
+#endif // TRUST_KEYRING_H
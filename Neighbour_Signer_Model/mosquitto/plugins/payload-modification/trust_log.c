@@ -0,0 +1,297 @@
+// trust_log.c - asynchronous log file for the trust plugin (see trust_log.h)
+//
+// The broker thread is the only producer and the writer thread the only
+// consumer, so the ring needs nothing beyond an acquire/release pair on each
+// index. Both sides walk the format string with the same parser: the producer
+// to pull arguments off the va_list, the writer to feed them back one
+// conversion at a time to snprintf.
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "mosquitto.h"
+#include "trust_log.h"
+
+#define LOG_RING_SLOTS 1024                 // must be a power of two
+#define LOG_ARG_BYTES 480
+#define LOG_LINE_LEN 1024
+#define LOG_IDLE_SLEEP_NS 20000000L         // writer poll interval while the ring is empty
+
+typedef struct {
+    time_t time;
+    const char *fmt;
+    int level;
+    uint16_t arg_len;
+    unsigned char args[LOG_ARG_BYTES];      // packed arguments, in format order
+} log_record_t;
+
+typedef enum { ARG_NONE, ARG_INT, ARG_LONG, ARG_LLONG, ARG_SIZE, ARG_DOUBLE, ARG_PTR, ARG_STR } log_arg_kind_t;
+
+// One conversion specification, spanning [start, end) of the format string.
+typedef struct {
+    const char *start, *end;
+    bool star_width, star_prec;
+    int prec;                               // literal precision, or -1
+    log_arg_kind_t kind;
+} log_conv_t;
+
+static log_record_t ring[LOG_RING_SLOTS];
+static atomic_size_t ring_head;             // next slot the broker thread fills
+static atomic_size_t ring_tail;             // next slot the writer drains
+static atomic_ulong dropped_records;
+static atomic_bool writer_running;
+static pthread_t writer_thread;
+static FILE *log_fp = NULL;
+
+/**
+ * Parses the conversion starting at the '%' at `p`. Returns false for
+ * conversions this logger can't pack; both sides stop at the same place.
+ */
+static bool parse_conv(const char *p, log_conv_t *c) {
+    memset(c, 0, sizeof(*c));
+    c->start = p++;
+    c->prec = -1;
+    if (*p == '%') {
+        c->kind = ARG_NONE;
+        c->end = p + 1;
+        return true;
+    }
+    while (*p && strchr("-+ #0", *p)) p++;
+    if (*p == '*') { c->star_width = true; p++; }
+    else while (*p >= '0' && *p <= '9') p++;
+    if (*p == '.') {
+        p++;
+        if (*p == '*') { c->star_prec = true; p++; }
+        else for (c->prec = 0; *p >= '0' && *p <= '9'; p++) c->prec = c->prec * 10 + (*p - '0');
+    }
+
+    int longs = 0;
+    bool size = false;
+    if (*p == 'h') { p++; if (*p == 'h') p++; }
+    else if (*p == 'l') { longs++; p++; if (*p == 'l') { longs++; p++; } }
+    else if (*p == 'z') { size = true; p++; }
+
+    switch (*p) {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+            c->kind = size ? ARG_SIZE : (longs == 2 ? ARG_LLONG : (longs == 1 ? ARG_LONG : ARG_INT));
+            break;
+        case 'c': c->kind = ARG_INT; break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': c->kind = ARG_DOUBLE; break;
+        case 's': c->kind = ARG_STR; break;
+        case 'p': c->kind = ARG_PTR; break;
+        default: return false;
+    }
+    c->end = p + 1;
+    return true;
+}
+
+static bool pack_arg(log_record_t *rec, const void *value, size_t len) {
+    if (rec->arg_len + len > LOG_ARG_BYTES) return false;
+    memcpy(rec->args + rec->arg_len, value, len);
+    rec->arg_len = (uint16_t)(rec->arg_len + len);
+    return true;
+}
+
+static bool pack_string(log_record_t *rec, const char *s, int prec) {
+    size_t room = LOG_ARG_BYTES - rec->arg_len;
+    if (room == 0) return false;
+    if (!s) s = "(null)";
+    size_t len = strnlen(s, (prec >= 0 && (size_t)prec < room - 1) ? (size_t)prec : room - 1);
+    memcpy(rec->args + rec->arg_len, s, len);
+    rec->args[rec->arg_len + len] = '\0';
+    rec->arg_len = (uint16_t)(rec->arg_len + len + 1);
+    return true;
+}
+
+static bool unpack_arg(const log_record_t *rec, size_t *off, void *value, size_t len) {
+    if (*off + len > rec->arg_len) return false;
+    memcpy(value, rec->args + *off, len);
+    *off += len;
+    return true;
+}
+
+void trust_log_vwrite(int level, const char *fmt, va_list va) {
+    if (!log_fp) return;
+    size_t head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&ring_tail, memory_order_acquire) >= LOG_RING_SLOTS) {
+        atomic_fetch_add_explicit(&dropped_records, 1, memory_order_relaxed);
+        return;
+    }
+
+    log_record_t *rec = &ring[head & (LOG_RING_SLOTS - 1)];
+    rec->time = time(NULL);
+    rec->fmt = fmt;
+    rec->level = level;
+    rec->arg_len = 0;
+
+    bool ok = true;
+    for (const char *p = strchr(fmt, '%'); p && ok; p = strchr(p, '%')) {
+        log_conv_t c;
+        if (!parse_conv(p, &c)) break;
+        p = c.end;
+        int prec = c.prec;
+        if (c.star_width) { int width = va_arg(va, int); ok = pack_arg(rec, &width, sizeof(width)); }
+        if (c.star_prec) { prec = va_arg(va, int); ok = ok && pack_arg(rec, &prec, sizeof(prec)); }
+        if (!ok) break;
+        switch (c.kind) {
+            case ARG_NONE: break;
+            case ARG_INT: { int v = va_arg(va, int); ok = pack_arg(rec, &v, sizeof(v)); break; }
+            case ARG_LONG: { long v = va_arg(va, long); ok = pack_arg(rec, &v, sizeof(v)); break; }
+            case ARG_LLONG: { long long v = va_arg(va, long long); ok = pack_arg(rec, &v, sizeof(v)); break; }
+            case ARG_SIZE: { size_t v = va_arg(va, size_t); ok = pack_arg(rec, &v, sizeof(v)); break; }
+            case ARG_DOUBLE: { double v = va_arg(va, double); ok = pack_arg(rec, &v, sizeof(v)); break; }
+            case ARG_PTR: { void *v = va_arg(va, void *); ok = pack_arg(rec, &v, sizeof(v)); break; }
+            case ARG_STR: ok = pack_string(rec, va_arg(va, const char *), prec); break;
+        }
+    }
+    atomic_store_explicit(&ring_head, head + 1, memory_order_release);
+}
+
+#define EMIT_ARG(value) \
+    (c.star_width && c.star_prec) ? snprintf(out + pos, size - pos, spec, width, prec, value) \
+    : (c.star_width || c.star_prec) ? snprintf(out + pos, size - pos, spec, c.star_width ? width : prec, value) \
+    : snprintf(out + pos, size - pos, spec, value)
+
+/**
+ * Formats a record's message into `out`. Arguments that did not fit in the
+ * record end the message with a "[truncated]" marker.
+ */
+static void format_record(const log_record_t *rec, char *out, size_t size) {
+    size_t pos = 0, off = 0;
+    const char *p = rec->fmt;
+    out[0] = '\0';
+    while (*p && pos < size - 1) {
+        const char *pct = strchr(p, '%');
+        size_t lit = pct ? (size_t)(pct - p) : strlen(p);
+        if (lit > size - 1 - pos) lit = size - 1 - pos;
+        memcpy(out + pos, p, lit);
+        pos += lit;
+        out[pos] = '\0';
+        if (!pct) return;
+
+        log_conv_t c;
+        char spec[32];
+        if (!parse_conv(pct, &c) || (size_t)(c.end - c.start) >= sizeof(spec)) {
+            snprintf(out + pos, size - pos, "%s", pct);
+            return;
+        }
+        p = c.end;
+        if (c.kind == ARG_NONE) {
+            snprintf(out + pos, size - pos, "%%");
+            pos++;
+            continue;
+        }
+        memcpy(spec, c.start, (size_t)(c.end - c.start));
+        spec[c.end - c.start] = '\0';
+
+        int width = 0, prec = 0, n = 0;
+        bool ok = (!c.star_width || unpack_arg(rec, &off, &width, sizeof(width)))
+            && (!c.star_prec || unpack_arg(rec, &off, &prec, sizeof(prec)));
+        switch (ok ? c.kind : ARG_NONE) {
+            case ARG_NONE: break;
+            case ARG_INT: { int v; if ((ok = unpack_arg(rec, &off, &v, sizeof(v)))) n = EMIT_ARG(v); break; }
+            case ARG_LONG: { long v; if ((ok = unpack_arg(rec, &off, &v, sizeof(v)))) n = EMIT_ARG(v); break; }
+            case ARG_LLONG: { long long v; if ((ok = unpack_arg(rec, &off, &v, sizeof(v)))) n = EMIT_ARG(v); break; }
+            case ARG_SIZE: { size_t v; if ((ok = unpack_arg(rec, &off, &v, sizeof(v)))) n = EMIT_ARG(v); break; }
+            case ARG_DOUBLE: { double v; if ((ok = unpack_arg(rec, &off, &v, sizeof(v)))) n = EMIT_ARG(v); break; }
+            case ARG_PTR: { void *v; if ((ok = unpack_arg(rec, &off, &v, sizeof(v)))) n = EMIT_ARG(v); break; }
+            case ARG_STR: {
+                const char *v = (const char *)rec->args + off;
+                ok = off < rec->arg_len;
+                if (ok) { off += strlen(v) + 1; n = EMIT_ARG(v); }
+                break;
+            }
+        }
+        if (!ok) {
+            snprintf(out + pos, size - pos, "[truncated]");
+            return;
+        }
+        if (n > 0) pos = ((size_t)n < size - pos) ? pos + (size_t)n : size - 1;
+    }
+}
+
+static const char *level_name(int level) {
+    if (level == MOSQ_LOG_WARNING) return "WARN";
+    if (level == MOSQ_LOG_ERR) return "ERROR";
+    if (level == MOSQ_LOG_DEBUG) return "DEBUG";
+    return "INFO";
+}
+
+static const char *format_time(time_t t) {
+    static time_t cached_time = (time_t)-1;
+    static char time_buf[20];
+    if (t != cached_time) {
+        struct tm tm;
+        localtime_r(&t, &tm);
+        strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", &tm);
+        cached_time = t;
+    }
+    return time_buf;
+}
+
+static size_t drain_ring(void) {
+    char msg[LOG_LINE_LEN];
+    size_t count = 0;
+    size_t tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring_head, memory_order_acquire);
+    for (; tail != head; tail++, count++) {
+        const log_record_t *rec = &ring[tail & (LOG_RING_SLOTS - 1)];
+        format_record(rec, msg, sizeof(msg));
+        fprintf(log_fp, "[%s] [%s] %s\n", format_time(rec->time), level_name(rec->level), msg);
+        atomic_store_explicit(&ring_tail, tail + 1, memory_order_release);
+    }
+    return count;
+}
+
+static void *writer_main(void *arg) {
+    (void)arg;
+    const struct timespec idle = { 0, LOG_IDLE_SLEEP_NS };
+    unsigned long reported_drops = 0;
+    for (;;) {
+        bool stopping = !atomic_load(&writer_running);
+        size_t written = drain_ring();
+        unsigned long drops = atomic_load_explicit(&dropped_records, memory_order_relaxed);
+        if (drops != reported_drops) {
+            fprintf(log_fp, "[%s] [WARN] %lu log records dropped (log ring full)\n",
+                    format_time(time(NULL)), drops - reported_drops);
+            reported_drops = drops;
+            written++;
+        }
+        if (written) fflush(log_fp);
+        else if (stopping) break;
+        else nanosleep(&idle, NULL);
+    }
+    return NULL;
+}
+
+bool trust_log_open(const char *filename) {
+    trust_log_close();
+    log_fp = fopen(filename, "a");
+    if (!log_fp) return false;
+    atomic_store(&writer_running, true);
+    if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0) {
+        fclose(log_fp);
+        log_fp = NULL;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Stops the writer once it has drained every queued record, then closes the file.
+ */
+void trust_log_close(void) {
+    if (!log_fp) return;
+    atomic_store(&writer_running, false);
+    pthread_join(writer_thread, NULL);
+    fclose(log_fp);
+    log_fp = NULL;
+}
+
+bool trust_log_is_open(void) {
+    return log_fp != NULL;
+}
@@ -0,0 +1,26 @@
+// trust_log.h - asynchronous log file for the trust plugin
+//
+// trust_log_vwrite() runs on the broker thread and only packs a timestamp, the
+// level, the format string pointer and the raw arguments into a fixed-size
+// record on a single-producer/single-consumer ring. A writer thread formats
+// the records and appends them to the file, so strftime, the formatting and
+// fflush all happen off the message path. When the ring is full records are
+// dropped and counted rather than blocking the broker.
+//
+// Format strings are kept by pointer and must be string literals. Supported
+// conversions are d i u x X o c s f F e E g G p and %%, with flags, width,
+// precision (including '*') and the h, l, ll and z length modifiers. Strings
+// are copied into the record and may be truncated.
+
+#ifndef TRUST_LOG_H
+#define TRUST_LOG_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+
+bool trust_log_open(const char *filename);
+void trust_log_close(void);
+bool trust_log_is_open(void);
+void trust_log_vwrite(int level, const char *fmt, va_list va);
+
+#endif // TRUST_LOG_H
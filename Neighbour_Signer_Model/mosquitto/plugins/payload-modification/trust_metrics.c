@@ -0,0 +1,375 @@
+// trust_metrics.c - metrics for the trust plugin (see trust_metrics.h)
+//
+// Histograms keep one count per bucket and are made cumulative when rendered.
+// The HTTP endpoint is a single thread that answers one scrape at a time,
+// which is all Prometheus needs.
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trust_metrics.h"
+
+typedef struct {
+    const char *family;                     // Prometheus metric name
+    const char *label;                      // label pair, or NULL
+    const char *topic;                      // below $SYS/trust/
+    const char *help;                       // set on the first entry of a family
+} counter_info_t;
+
+static const counter_info_t counter_info[METRIC_COUNTER_COUNT] = {
+    [METRIC_EVALUATED]             = { "trust_messages_evaluated_total", NULL, "messages/evaluated", "Messages seen by the trust plugin, feedback excluded." },
+    [METRIC_ACCEPTED]              = { "trust_messages_accepted_total", NULL, "messages/accepted", "Messages let through." },
+    [METRIC_BYPASSED]              = { "trust_messages_bypassed_total", NULL, "messages/bypassed", "Messages on topics outside trust_topics, passed through unevaluated." },
+    [METRIC_PASSED_THROUGH]        = { "trust_messages_passed_through_total", NULL, "messages/passed_through", "Evaluated messages that carried no token, let through unverified." },
+    [METRIC_DENIED_MALFORMED]      = { "trust_messages_denied_total", "reason=\"malformed\"", "messages/denied/malformed", "Messages dropped, by reason." },
+    [METRIC_DENIED_HMAC]           = { "trust_messages_denied_total", "reason=\"hmac\"", "messages/denied/hmac", NULL },
+    [METRIC_DENIED_PAYLOAD]        = { "trust_messages_denied_total", "reason=\"payload\"", "messages/denied/payload", NULL },
+    [METRIC_DENIED_KEY]            = { "trust_messages_denied_total", "reason=\"key\"", "messages/denied/key", NULL },
+    [METRIC_DENIED_ACL]            = { "trust_messages_denied_total", "reason=\"acl\"", "messages/denied/acl", NULL },
+    [METRIC_DENIED_UNTRUSTED]      = { "trust_messages_denied_total", "reason=\"untrusted_signer\"", "messages/denied/untrusted_signer", NULL },
+    [METRIC_DENIED_NO_SIGNERS]     = { "trust_messages_denied_total", "reason=\"no_signers\"", "messages/denied/no_signers", NULL },
+    [METRIC_DENIED_REPLAY]         = { "trust_messages_denied_total", "reason=\"replay\"", "messages/denied/replay", NULL },
+    [METRIC_DENIED_ADMISSION]      = { "trust_messages_denied_total", "reason=\"admission\"", "messages/denied/admission", NULL },
+    [METRIC_DENIED_ERROR]          = { "trust_messages_denied_total", "reason=\"error\"", "messages/denied/error", NULL },
+    [METRIC_ADMISSION_SIZE]        = { "trust_admission_rejected_total", "limit=\"size\"", "admission/size", "Messages rejected by admission control, by limit." },
+    [METRIC_ADMISSION_DEPTH]       = { "trust_admission_rejected_total", "limit=\"depth\"", "admission/depth", NULL },
+    [METRIC_ADMISSION_SIGNERS]     = { "trust_admission_rejected_total", "limit=\"signers\"", "admission/signers", NULL },
+    [METRIC_ADMISSION_CLIENT_RATE] = { "trust_admission_rejected_total", "limit=\"client_rate\"", "admission/client_rate", NULL },
+    [METRIC_ADMISSION_SOURCE_RATE] = { "trust_admission_rejected_total", "limit=\"source_rate\"", "admission/source_rate", NULL },
+    [METRIC_ADMISSION_SHAPED]      = { "trust_admission_rejected_total", "limit=\"shaped\"", "admission/shaped", NULL },
+    [METRIC_FEEDBACK_POSITIVE]     = { "trust_feedback_total", "kind=\"positive\"", "feedback/positive", "Feedback messages received, by kind." },
+    [METRIC_FEEDBACK_NEGATIVE]     = { "trust_feedback_total", "kind=\"negative\"", "feedback/negative", NULL },
+    [METRIC_FEEDBACK_FORWARDED]    = { "trust_feedback_total", "kind=\"forwarded\"", "feedback/forwarded", NULL },
+    [METRIC_FEEDBACK_IGNORED]      = { "trust_feedback_total", "kind=\"ignored\"", "feedback/ignored", NULL },
+};
+
+static const char *const stage_names[METRIC_STAGE_COUNT] = { "parse", "hmac", "trust", "resign", "total" };
+
+// Bucket upper bounds in nanoseconds; the last bucket is +Inf.
+static const uint64_t bucket_bounds[] = {
+    1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+};
+#define BUCKET_COUNT (sizeof(bucket_bounds) / sizeof(bucket_bounds[0]) + 1)
+
+typedef struct {
+    atomic_ulong buckets[BUCKET_COUNT];
+    atomic_ulong count;
+    atomic_ullong sum_ns;
+} histogram_t;
+
+static atomic_ulong counters[METRIC_COUNTER_COUNT];
+static histogram_t histograms[METRIC_STAGE_COUNT];
+
+typedef struct { char *source; double trust; } link_gauge_t;
+static link_gauge_t *links = NULL;
+static int link_slots = 0;
+static char *link_target = NULL;
+static pthread_mutex_t links_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int listen_fd = -1;
+static pthread_t server_thread;
+static atomic_bool server_stopping;
+
+void metrics_count(metric_counter_t counter) {
+    atomic_fetch_add_explicit(&counters[counter], 1, memory_order_relaxed);
+}
+
+void metrics_observe(metric_stage_t stage, uint64_t ns) {
+    histogram_t *h = &histograms[stage];
+    size_t b = 0;
+    while (b < BUCKET_COUNT - 1 && ns > bucket_bounds[b]) b++;
+    atomic_fetch_add_explicit(&h->buckets[b], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum_ns, ns, memory_order_relaxed);
+}
+
+uint64_t metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void links_free(void) {
+    for (int i = 0; i < link_slots; i++) free(links[i].source);
+    free(links);
+    free(link_target);
+    links = NULL;
+    link_target = NULL;
+    link_slots = 0;
+}
+
+bool metrics_links_reset(const char *target, int node_count) {
+    pthread_mutex_lock(&links_lock);
+    links_free();
+    bool ok = true;
+    if (node_count > 0) {
+        links = calloc((size_t)node_count, sizeof(*links));
+        link_target = strdup(target);
+        if (links && link_target) {
+            link_slots = node_count;
+        } else {
+            links_free();
+            ok = false;
+        }
+    }
+    pthread_mutex_unlock(&links_lock);
+    return ok;
+}
+
+void metrics_link_set(int source_idx, const char *source, double trust) {
+    pthread_mutex_lock(&links_lock);
+    if (source_idx >= 0 && source_idx < link_slots) {
+        link_gauge_t *g = &links[source_idx];
+        if (!g->source) g->source = strdup(source);
+        g->trust = trust;
+    }
+    pthread_mutex_unlock(&links_lock);
+}
+
+// ---- Rendering ----
+
+typedef struct { char *data; size_t len, cap; bool failed; } text_buf_t;
+
+static void buf_printf(text_buf_t *buf, const char *fmt, ...) {
+    if (buf->failed) return;
+    for (;;) {
+        va_list va;
+        va_start(va, fmt);
+        int n = vsnprintf(buf->data ? buf->data + buf->len : NULL, buf->cap - buf->len, fmt, va);
+        va_end(va);
+        if (n < 0) {
+            buf->failed = true;
+            return;
+        }
+        if (buf->len + (size_t)n < buf->cap) {
+            buf->len += (size_t)n;
+            return;
+        }
+        size_t cap = buf->cap ? buf->cap * 2 : 4096;
+        while (cap <= buf->len + (size_t)n) cap *= 2;
+        char *data = realloc(buf->data, cap);
+        if (!data) {
+            buf->failed = true;
+            return;
+        }
+        buf->data = data;
+        buf->cap = cap;
+    }
+}
+
+// Label values are broker IDs; escape them as the text format requires.
+static void buf_label_value(text_buf_t *buf, const char *value) {
+    for (const char *p = value; *p; p++) {
+        if (*p == '"' || *p == '\\') buf_printf(buf, "\\%c", *p);
+        else if (*p == '\n') buf_printf(buf, "\\n");
+        else buf_printf(buf, "%c", *p);
+    }
+}
+
+char *metrics_render(size_t *len) {
+    text_buf_t buf = {0};
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+        const counter_info_t *ci = &counter_info[i];
+        if (ci->help) buf_printf(&buf, "# HELP %s %s\n# TYPE %s counter\n", ci->family, ci->help, ci->family);
+        unsigned long v = atomic_load_explicit(&counters[i], memory_order_relaxed);
+        if (ci->label) buf_printf(&buf, "%s{%s} %lu\n", ci->family, ci->label, v);
+        else buf_printf(&buf, "%s %lu\n", ci->family, v);
+    }
+
+    buf_printf(&buf, "# HELP trust_callback_seconds Time spent in the message callback, by stage.\n"
+                     "# TYPE trust_callback_seconds histogram\n");
+    for (int s = 0; s < METRIC_STAGE_COUNT; s++) {
+        histogram_t *h = &histograms[s];
+        unsigned long cumulative = 0;
+        for (size_t b = 0; b < BUCKET_COUNT; b++) {
+            cumulative += atomic_load_explicit(&h->buckets[b], memory_order_relaxed);
+            if (b < BUCKET_COUNT - 1) {
+                buf_printf(&buf, "trust_callback_seconds_bucket{stage=\"%s\",le=\"%g\"} %lu\n",
+                           stage_names[s], (double)bucket_bounds[b] / 1e9, cumulative);
+            } else {
+                buf_printf(&buf, "trust_callback_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %lu\n", stage_names[s], cumulative);
+            }
+        }
+        buf_printf(&buf, "trust_callback_seconds_sum{stage=\"%s\"} %.9f\n", stage_names[s],
+                   (double)atomic_load_explicit(&h->sum_ns, memory_order_relaxed) / 1e9);
+        // The bucket total rather than `count`, so the two always agree.
+        buf_printf(&buf, "trust_callback_seconds_count{stage=\"%s\"} %lu\n", stage_names[s], cumulative);
+    }
+
+    buf_printf(&buf, "# HELP trust_link_trust Direct trust in each link into this broker.\n"
+                     "# TYPE trust_link_trust gauge\n");
+    pthread_mutex_lock(&links_lock);
+    for (int i = 0; i < link_slots; i++) {
+        if (!links[i].source) continue;
+        buf_printf(&buf, "trust_link_trust{source=\"");
+        buf_label_value(&buf, links[i].source);
+        buf_printf(&buf, "\",target=\"");
+        buf_label_value(&buf, link_target);
+        buf_printf(&buf, "\"} %.6f\n", links[i].trust);
+    }
+    pthread_mutex_unlock(&links_lock);
+
+    if (buf.failed) {
+        free(buf.data);
+        return NULL;
+    }
+    *len = buf.len;
+    return buf.data;
+}
+
+/**
+ * Upper bound, in microseconds, of the bucket holding the q-quantile, or -1
+ * if it falls in the +Inf bucket.
+ */
+static double histogram_quantile_us(histogram_t *h, unsigned long count, double q) {
+    unsigned long rank = (unsigned long)(q * (double)count + 0.5), cumulative = 0;
+    if (rank == 0) rank = 1;
+    for (size_t b = 0; b < BUCKET_COUNT - 1; b++) {
+        cumulative += atomic_load_explicit(&h->buckets[b], memory_order_relaxed);
+        if (cumulative >= rank) return (double)bucket_bounds[b] / 1e3;
+    }
+    return -1;
+}
+
+void metrics_foreach(metrics_value_fn fn, void *arg) {
+    char topic[256], value[64];
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+        snprintf(value, sizeof(value), "%lu", atomic_load_explicit(&counters[i], memory_order_relaxed));
+        fn(counter_info[i].topic, value, arg);
+    }
+    for (int s = 0; s < METRIC_STAGE_COUNT; s++) {
+        histogram_t *h = &histograms[s];
+        unsigned long count = atomic_load_explicit(&h->count, memory_order_relaxed);
+        unsigned long long sum_ns = atomic_load_explicit(&h->sum_ns, memory_order_relaxed);
+        snprintf(topic, sizeof(topic), "latency/%s/count", stage_names[s]);
+        snprintf(value, sizeof(value), "%lu", count);
+        fn(topic, value, arg);
+        snprintf(topic, sizeof(topic), "latency/%s/mean_us", stage_names[s]);
+        snprintf(value, sizeof(value), "%.3f", count ? (double)sum_ns / (double)count / 1e3 : 0.0);
+        fn(topic, value, arg);
+        if (count == 0) continue;
+        double p99 = histogram_quantile_us(h, count, 0.99);
+        snprintf(topic, sizeof(topic), "latency/%s/p99_us", stage_names[s]);
+        if (p99 < 0) snprintf(value, sizeof(value), ">%g", (double)bucket_bounds[BUCKET_COUNT - 2] / 1e3);
+        else snprintf(value, sizeof(value), "%g", p99);
+        fn(topic, value, arg);
+    }
+    pthread_mutex_lock(&links_lock);
+    for (int i = 0; i < link_slots; i++) {
+        if (!links[i].source) continue;
+        snprintf(topic, sizeof(topic), "links/%s/trust", links[i].source);
+        snprintf(value, sizeof(value), "%.3f", links[i].trust);
+        fn(topic, value, arg);
+    }
+    pthread_mutex_unlock(&links_lock);
+}
+
+// ---- HTTP Endpoint ----
+
+static bool send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static void serve_client(int fd) {
+    struct timeval timeout = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // The request line is all we look at.
+    char request[1024];
+    ssize_t n = recv(fd, request, sizeof(request) - 1, 0);
+    if (n <= 0) return;
+    request[n] = '\0';
+
+    char header[160];
+    if (strncmp(request, "GET /metrics", 12) != 0 && strncmp(request, "GET / ", 6) != 0) {
+        static const char not_found[] = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        send_all(fd, not_found, sizeof(not_found) - 1);
+        return;
+    }
+    size_t len = 0;
+    char *text = metrics_render(&len);
+    if (!text) {
+        static const char failed[] = "HTTP/1.0 500 Internal Server Error\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        send_all(fd, failed, sizeof(failed) - 1);
+        return;
+    }
+    int header_len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                                      "Content-Length: %zu\r\nConnection: close\r\n\r\n", len);
+    if (send_all(fd, header, (size_t)header_len)) send_all(fd, text, len);
+    free(text);
+}
+
+static void *server_main(void *arg) {
+    (void)arg;
+    struct pollfd pfd = { listen_fd, POLLIN, 0 };
+    while (!atomic_load(&server_stopping)) {
+        // Wake up now and then to notice metrics_stop().
+        if (poll(&pfd, 1, 250) <= 0) continue;
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) continue;
+        serve_client(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+bool metrics_serve(const char *bind_address, int port) {
+    if (listen_fd != -1 || port <= 0 || port > 65535) return false;
+    char service[8];
+    snprintf(service, sizeof(service), "%d", port);
+    struct addrinfo hints = {0}, *res = NULL;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(bind_address && *bind_address ? bind_address : NULL, service, &hints, &res) != 0) return false;
+
+    for (struct addrinfo *ai = res; ai && listen_fd == -1; ai = ai->ai_next) {
+        int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 8) == 0) listen_fd = fd;
+        else close(fd);
+    }
+    freeaddrinfo(res);
+    if (listen_fd == -1) return false;
+
+    atomic_store(&server_stopping, false);
+    if (pthread_create(&server_thread, NULL, server_main, NULL) != 0) {
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+void metrics_stop(void) {
+    if (listen_fd != -1) {
+        atomic_store(&server_stopping, true);
+        pthread_join(server_thread, NULL);
+        close(listen_fd);
+        listen_fd = -1;
+    }
+    pthread_mutex_lock(&links_lock);
+    links_free();
+    pthread_mutex_unlock(&links_lock);
+}
@@ -0,0 +1,81 @@
+// trust_metrics.h - counters, gauges and latency histograms for the trust plugin
+//
+// Counters and histograms are relaxed atomics, so they can be bumped from the
+// broker thread and the verification workers without a lock. Link trust
+// gauges are set by the broker thread and read under a mutex.
+//
+// The values are exported two ways: metrics_render() writes the Prometheus
+// text format, which metrics_serve() answers HTTP scrapes with from a
+// background thread, and metrics_foreach() walks them as (topic, value)
+// pairs for the plugin to publish under $SYS/trust/.
+
+#ifndef TRUST_METRICS_H
+#define TRUST_METRICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    METRIC_EVALUATED,
+    METRIC_ACCEPTED,
+    METRIC_BYPASSED,
+    METRIC_PASSED_THROUGH,
+    // Denials, by reason
+    METRIC_DENIED_MALFORMED,
+    METRIC_DENIED_HMAC,
+    METRIC_DENIED_PAYLOAD,
+    METRIC_DENIED_KEY,
+    METRIC_DENIED_ACL,
+    METRIC_DENIED_UNTRUSTED,
+    METRIC_DENIED_NO_SIGNERS,
+    METRIC_DENIED_REPLAY,
+    METRIC_DENIED_ADMISSION,
+    METRIC_DENIED_ERROR,
+    // Admission rejections (also counted as METRIC_DENIED_ADMISSION)
+    METRIC_ADMISSION_SIZE,
+    METRIC_ADMISSION_DEPTH,
+    METRIC_ADMISSION_SIGNERS,
+    METRIC_ADMISSION_CLIENT_RATE,
+    METRIC_ADMISSION_SOURCE_RATE,
+    METRIC_ADMISSION_SHAPED,
+    // Feedback messages
+    METRIC_FEEDBACK_POSITIVE,
+    METRIC_FEEDBACK_NEGATIVE,
+    METRIC_FEEDBACK_FORWARDED,
+    METRIC_FEEDBACK_IGNORED,
+    METRIC_COUNTER_COUNT
+} metric_counter_t;
+
+// Stages of callback_message. METRIC_STAGE_TOTAL covers the whole callback.
+typedef enum {
+    METRIC_STAGE_PARSE,
+    METRIC_STAGE_HMAC,
+    METRIC_STAGE_TRUST,
+    METRIC_STAGE_RESIGN,
+    METRIC_STAGE_TOTAL,
+    METRIC_STAGE_COUNT
+} metric_stage_t;
+
+void metrics_count(metric_counter_t counter);
+void metrics_observe(metric_stage_t stage, uint64_t ns);
+uint64_t metrics_now(void);                 // monotonic nanoseconds
+
+// Link trust gauges, one per source broker with a link into this one.
+// metrics_links_reset() drops them all and makes room for `node_count`
+// sources, indexed like the network graph.
+bool metrics_links_reset(const char *target, int node_count);
+void metrics_link_set(int source_idx, const char *source, double trust);
+
+// Returns the Prometheus text exposition in a malloc()ed buffer, or NULL.
+char *metrics_render(size_t *len);
+
+// Calls `fn` for every value, with a topic relative to $SYS/trust/.
+typedef void (*metrics_value_fn)(const char *topic, const char *value, void *arg);
+void metrics_foreach(metrics_value_fn fn, void *arg);
+
+// Serves metrics_render() over HTTP on `port` until metrics_stop().
+bool metrics_serve(const char *bind_address, int port);
+void metrics_stop(void);
+
+#endif // TRUST_METRICS_H
@@ -0,0 +1,86 @@
+// trust_pool.c - worker threads for MAC verification (see trust_pool.h)
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "trust_pool.h"
+
+#define POOL_QUEUE_SLOTS 4096               // must be a power of two
+#define POOL_MAX_THREADS 64
+
+static void *queue[POOL_QUEUE_SLOTS];
+static size_t queue_head = 0;               // next slot to fill
+static size_t queue_tail = 0;               // next slot to take
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_ready = PTHREAD_COND_INITIALIZER;
+static bool stopping = false;
+
+static pthread_t workers[POOL_MAX_THREADS];
+static int worker_count = 0;
+static int batch_size = 1;
+static pool_run_fn run_jobs = NULL;
+static pool_discard_fn discard_job = NULL;
+
+static void *worker_main(void *arg) {
+    (void)arg;
+    void *batch[POOL_MAX_BATCH];
+    for (;;) {
+        pthread_mutex_lock(&queue_lock);
+        while (queue_head == queue_tail && !stopping) pthread_cond_wait(&queue_ready, &queue_lock);
+        if (stopping) {
+            pthread_mutex_unlock(&queue_lock);
+            return NULL;
+        }
+        int n = 0;
+        while (n < batch_size && queue_tail != queue_head) {
+            batch[n++] = queue[queue_tail++ & (POOL_QUEUE_SLOTS - 1)];
+        }
+        pthread_mutex_unlock(&queue_lock);
+        run_jobs(batch, n);
+    }
+}
+
+bool pool_start(int threads, int max_batch, pool_run_fn run, pool_discard_fn discard) {
+    if (worker_count > 0 || threads <= 0 || !run || !discard) return false;
+    if (threads > POOL_MAX_THREADS) threads = POOL_MAX_THREADS;
+    batch_size = max_batch < 1 ? 1 : (max_batch > POOL_MAX_BATCH ? POOL_MAX_BATCH : max_batch);
+    run_jobs = run;
+    discard_job = discard;
+    stopping = false;
+    queue_head = queue_tail = 0;
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&workers[worker_count], NULL, worker_main, NULL) != 0) break;
+        worker_count++;
+    }
+    if (worker_count == 0) return false;
+    return true;
+}
+
+bool pool_running(void) {
+    return worker_count > 0;
+}
+
+bool pool_submit(void *job) {
+    if (worker_count == 0) return false;
+    pthread_mutex_lock(&queue_lock);
+    if (queue_head - queue_tail == POOL_QUEUE_SLOTS) {
+        pthread_mutex_unlock(&queue_lock);
+        return false;
+    }
+    queue[queue_head++ & (POOL_QUEUE_SLOTS - 1)] = job;
+    pthread_cond_signal(&queue_ready);
+    pthread_mutex_unlock(&queue_lock);
+    return true;
+}
+
+void pool_stop(void) {
+    if (worker_count == 0) return;
+    pthread_mutex_lock(&queue_lock);
+    stopping = true;
+    pthread_cond_broadcast(&queue_ready);
+    pthread_mutex_unlock(&queue_lock);
+    for (int i = 0; i < worker_count; i++) pthread_join(workers[i], NULL);
+    worker_count = 0;
+
+    while (queue_tail != queue_head) discard_job(queue[queue_tail++ & (POOL_QUEUE_SLOTS - 1)]);
+}
@@ -0,0 +1,27 @@
+// trust_pool.h - worker threads for the trust plugin's MAC verification
+//
+// The broker thread submits jobs with pool_submit(); each worker takes up to
+// `max_batch` queued jobs at a time and hands them to the `run` callback
+// together, so their MACs can share one multi-buffer pass. The queue is a
+// fixed ring, and pool_submit() returns false rather than blocking when it is
+// full, in which case the caller handles the job itself.
+//
+// Jobs still queued at pool_stop() are passed to `discard` instead.
+// Callbacks run on worker threads and must not touch broker-thread state.
+
+#ifndef TRUST_POOL_H
+#define TRUST_POOL_H
+
+#include <stdbool.h>
+
+#define POOL_MAX_BATCH 8
+
+typedef void (*pool_run_fn)(void **jobs, int job_count);
+typedef void (*pool_discard_fn)(void *job);
+
+bool pool_start(int threads, int max_batch, pool_run_fn run, pool_discard_fn discard);
+bool pool_running(void);
+bool pool_submit(void *job);
+void pool_stop(void);
+
+#endif // TRUST_POOL_H
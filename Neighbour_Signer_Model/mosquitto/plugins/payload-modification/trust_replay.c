@@ -0,0 +1,153 @@
+// trust_replay.c - replay and duplicate filter (see trust_replay.h)
+//
+// A pair is stored under a 64-bit FNV-1a hash of "issuer\0client" rather than
+// the strings themselves, so every slot has the same size and a lookup touches
+// one set of adjacent slots.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trust_replay.h"
+
+#define REPLAY_WAYS 4
+#define REPLAY_WORDS (REPLAY_WINDOW / 64)
+
+typedef struct {
+    uint64_t key;                       // 0 marks a free slot
+    uint32_t high;                      // highest accepted msg_id
+    uint32_t last_used;                 // replay_clock at the last accept
+    uint64_t window[REPLAY_WORDS];      // bit i: msg_id (high - i) was accepted
+} replay_slot_t;
+
+static replay_slot_t *slots = NULL;
+static size_t set_mask = 0;
+static uint32_t replay_clock = 0;
+static pthread_mutex_t replay_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Allocates room for at least `capacity` issuer/client pairs.
+ */
+bool replay_init(size_t capacity) {
+    replay_cleanup();
+    size_t sets = 1;
+    while (sets * REPLAY_WAYS < capacity) sets <<= 1;
+    slots = calloc(sets * REPLAY_WAYS, sizeof(*slots));
+    if (!slots) return false;
+    set_mask = sets - 1;
+    return true;
+}
+
+void replay_cleanup(void) {
+    free(slots);
+    slots = NULL;
+    set_mask = 0;
+}
+
+static uint64_t fnv1a(uint64_t hash, const char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+replay_id_t replay_make_id(const char *issuer, size_t issuer_len, const char *client, size_t client_len, uint32_t msg_id) {
+    replay_id_t id;
+    id.key = fnv1a(0xcbf29ce484222325ULL, issuer, issuer_len);
+    id.key = fnv1a(id.key, "", 1);
+    id.key = fnv1a(id.key, client, client_len);
+    if (id.key == 0) id.key = 1;
+    id.msg_id = msg_id;
+    return id;
+}
+
+static replay_slot_t *replay_set(uint64_t key) {
+    return &slots[((key >> 32 ^ key) & set_mask) * REPLAY_WAYS];
+}
+
+static replay_slot_t *replay_find(uint64_t key) {
+    replay_slot_t *set = replay_set(key);
+    for (int i = 0; i < REPLAY_WAYS; i++) {
+        if (set[i].key == key) return &set[i];
+    }
+    return NULL;
+}
+
+static bool slot_seen(const replay_id_t *id) {
+    const replay_slot_t *slot = replay_find(id->key);
+    if (!slot || id->msg_id > slot->high) return false;
+    uint32_t age = slot->high - id->msg_id;
+    if (age >= REPLAY_WINDOW) return true;
+    return (slot->window[age / 64] >> (age % 64)) & 1;
+}
+
+bool replay_seen(const replay_id_t *id) {
+    if (!slots) return false;
+    pthread_mutex_lock(&replay_lock);
+    bool seen = slot_seen(id);
+    pthread_mutex_unlock(&replay_lock);
+    return seen;
+}
+
+/**
+ * Moves the window up by `shift` msg_ids, so bit i becomes bit i + shift.
+ */
+static void window_advance(uint64_t *window, uint32_t shift) {
+    if (shift >= REPLAY_WINDOW) {
+        memset(window, 0, REPLAY_WORDS * sizeof(*window));
+        return;
+    }
+    int word_shift = (int)(shift / 64), bit_shift = (int)(shift % 64);
+    for (int i = REPLAY_WORDS - 1; i >= 0; i--) {
+        int src = i - word_shift;
+        uint64_t v = 0;
+        if (src >= 0) {
+            v = window[src] << bit_shift;
+            if (bit_shift && src > 0) v |= window[src - 1] >> (64 - bit_shift);
+        }
+        window[i] = v;
+    }
+}
+
+static void slot_accept(const replay_id_t *id) {
+    replay_slot_t *slot = replay_find(id->key);
+    if (!slot) {
+        // Claim a free way, or evict the least recently used one.
+        replay_slot_t *set = replay_set(id->key);
+        slot = &set[0];
+        for (int i = 1; i < REPLAY_WAYS && slot->key != 0; i++) {
+            if (set[i].key == 0 || set[i].last_used < slot->last_used) slot = &set[i];
+        }
+        memset(slot, 0, sizeof(*slot));
+        slot->key = id->key;
+        slot->high = id->msg_id;
+    }
+    slot->last_used = ++replay_clock;
+
+    if (id->msg_id > slot->high) {
+        window_advance(slot->window, id->msg_id - slot->high);
+        slot->high = id->msg_id;
+    }
+    uint32_t age = slot->high - id->msg_id;
+    if (age < REPLAY_WINDOW) slot->window[age / 64] |= 1ULL << (age % 64);
+}
+
+void replay_accept(const replay_id_t *id) {
+    if (!slots) return;
+    pthread_mutex_lock(&replay_lock);
+    slot_accept(id);
+    pthread_mutex_unlock(&replay_lock);
+}
+
+/**
+ * Records the token unless it is a replay. Returns false for a replay.
+ */
+bool replay_admit(const replay_id_t *id) {
+    if (!slots) return true;
+    pthread_mutex_lock(&replay_lock);
+    bool fresh = !slot_seen(id);
+    if (fresh) slot_accept(id);
+    pthread_mutex_unlock(&replay_lock);
+    return fresh;
+}
@@ -0,0 +1,33 @@
+// trust_replay.h - replay and duplicate filter for the trust plugin
+//
+// Tokens are identified by (issuer "b", client "c", msg_id). For each
+// issuer/client pair the filter keeps the highest accepted msg_id and a bitmap
+// of which of the REPLAY_WINDOW msg_ids below it were accepted. A token is a
+// replay if its msg_id was accepted before or has fallen out of the window.
+//
+// Pairs live in a fixed-size, 4-way set-associative table. When a set is full
+// the least recently used pair is evicted and its history is forgotten.
+//
+// replay_seen(), replay_accept() and replay_admit() may be called from any
+// thread; replay_admit() checks and records a token in one step, so that of
+// two copies verified concurrently only one is accepted.
+
+#ifndef TRUST_REPLAY_H
+#define TRUST_REPLAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define REPLAY_WINDOW 256
+
+typedef struct { uint64_t key; uint32_t msg_id; } replay_id_t;
+
+bool replay_init(size_t capacity);
+void replay_cleanup(void);
+replay_id_t replay_make_id(const char *issuer, size_t issuer_len, const char *client, size_t client_len, uint32_t msg_id);
+bool replay_seen(const replay_id_t *id);
+void replay_accept(const replay_id_t *id);
+bool replay_admit(const replay_id_t *id);
+
+#endif // TRUST_REPLAY_H
@@ -0,0 +1,155 @@
+// trust_shape.c - trust-weighted admission shares (see trust_shape.h)
+//
+// Each signer has a token bucket refilled at its share of the capacity, and a
+// shared bucket refilled at the full capacity tracks how much is left over.
+// Admissions within a share also drain the shared bucket, so it only holds
+// tokens while the signers together are below capacity.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <uthash.h>
+
+#include "trust_shape.h"
+
+// Rebalance rounds a signer may stay idle before its bucket is dropped.
+#define SHAPE_IDLE_ROUNDS 2
+
+typedef struct {
+    double weight;
+    double rate;                        // share of the capacity, messages/s
+    double tokens;
+    double updated;                     // monotonic seconds at the last refill
+    int idle_rounds;
+    UT_hash_handle hh;
+    char signer[];
+} signer_share_t;
+
+static double capacity = 0;
+static double spare_tokens = 0, spare_updated = 0;
+static double active_weight = 0;        // sum of weights at the last rebalance
+static signer_share_t *shares = NULL;
+static pthread_mutex_t shape_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double monotonic_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void shape_configure(double c) {
+    capacity = c > 0 ? c : 0;
+    spare_tokens = capacity;
+    spare_updated = monotonic_now();
+}
+
+bool shape_enabled(void) {
+    return capacity > 0;
+}
+
+static double share_burst(const signer_share_t *s) {
+    return s->rate > 1 ? s->rate : 1;
+}
+
+static void share_set_rate(signer_share_t *s, double total_weight) {
+    s->rate = total_weight > 0 ? capacity * s->weight / total_weight : 0;
+}
+
+static void share_refill(signer_share_t *s, double now) {
+    s->tokens += (now - s->updated) * s->rate;
+    if (s->tokens > share_burst(s)) s->tokens = share_burst(s);
+    s->updated = now;
+}
+
+static void spare_refill(double now) {
+    spare_tokens += (now - spare_updated) * capacity;
+    if (spare_tokens > capacity) spare_tokens = capacity;
+    spare_updated = now;
+}
+
+bool shape_take(const char *signer, size_t signer_len, double weight) {
+    if (capacity == 0) return true;
+    if (weight < 0) weight = 0;
+    pthread_mutex_lock(&shape_lock);
+    double now = monotonic_now();
+
+    signer_share_t *s = NULL;
+    HASH_FIND(hh, shares, signer, signer_len, s);
+    if (!s && HASH_COUNT(shares) < SHAPE_MAX_SIGNERS && (s = calloc(1, sizeof(*s) + signer_len + 1))) {
+        memcpy(s->signer, signer, signer_len);
+        s->weight = weight;
+        s->updated = now;
+        // Provisional share until the next rebalance counts this signer.
+        share_set_rate(s, active_weight + weight);
+        s->tokens = share_burst(s);
+        HASH_ADD_KEYPTR(hh, shares, s->signer, signer_len, s);
+    }
+
+    spare_refill(now);
+
+    bool admitted = false;
+    if (s) {
+        s->weight = weight;
+        s->idle_rounds = 0;
+        share_refill(s, now);
+        if (s->tokens >= 1) {
+            s->tokens -= 1;
+            spare_tokens = spare_tokens > 1 ? spare_tokens - 1 : 0;
+            admitted = true;
+        }
+    }
+    if (!admitted && spare_tokens >= 1) {
+        spare_tokens -= 1;
+        admitted = true;
+    }
+    pthread_mutex_unlock(&shape_lock);
+    return admitted;
+}
+
+void shape_refund(const char *signer, size_t signer_len) {
+    if (capacity == 0) return;
+    pthread_mutex_lock(&shape_lock);
+    double now = monotonic_now();
+    signer_share_t *s = NULL;
+    HASH_FIND(hh, shares, signer, signer_len, s);
+    if (s) {
+        share_refill(s, now);
+        s->tokens = s->tokens + 1 < share_burst(s) ? s->tokens + 1 : share_burst(s);
+    }
+    spare_refill(now);
+    spare_tokens = spare_tokens + 1 < capacity ? spare_tokens + 1 : capacity;
+    pthread_mutex_unlock(&shape_lock);
+}
+
+void shape_rebalance(void) {
+    pthread_mutex_lock(&shape_lock);
+    double now = monotonic_now();
+    double total_weight = 0;
+    signer_share_t *s, *tmp;
+    HASH_ITER(hh, shares, s, tmp) {
+        if (++s->idle_rounds > SHAPE_IDLE_ROUNDS) {
+            HASH_DEL(shares, s);
+            free(s);
+            continue;
+        }
+        total_weight += s->weight;
+    }
+    active_weight = total_weight;
+    HASH_ITER(hh, shares, s, tmp) {
+        share_refill(s, now);
+        share_set_rate(s, total_weight);
+    }
+    pthread_mutex_unlock(&shape_lock);
+}
+
+void shape_cleanup(void) {
+    pthread_mutex_lock(&shape_lock);
+    signer_share_t *s, *tmp;
+    HASH_ITER(hh, shares, s, tmp) {
+        HASH_DEL(shares, s);
+        free(s);
+    }
+    active_weight = 0;
+    pthread_mutex_unlock(&shape_lock);
+}
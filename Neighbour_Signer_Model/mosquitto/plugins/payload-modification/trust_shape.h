@@ -0,0 +1,35 @@
+// trust_shape.h - trust-weighted admission shares per upstream signer
+//
+// The plugin is given a processing capacity in messages per second. Every
+// upstream signer (the last signer on a token, i.e. the neighbour bridge that
+// forwarded it) gets a share of that capacity proportional to its weight, the
+// trust this broker currently holds in its link. A message within its signer's
+// share is always admitted. A message beyond it is admitted only while there
+// is spare capacity, so when the broker is saturated the excess of low-trust
+// signers is shed first and no single signer can crowd out the others.
+//
+// Shares are recomputed over the recently active signers by shape_rebalance(),
+// which also drops signers that have gone idle. At most SHAPE_MAX_SIGNERS
+// signers hold a share; past that, new signers only get spare capacity. A
+// capacity of 0 disables shaping.
+//
+// Shares are charged before the token's MAC is checked, so shape_refund()
+// hands the token back when it then fails verification. All calls are safe
+// from any thread.
+
+#ifndef TRUST_SHAPE_H
+#define TRUST_SHAPE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SHAPE_MAX_SIGNERS 256
+
+void shape_configure(double capacity);
+bool shape_enabled(void);
+bool shape_take(const char *signer, size_t signer_len, double weight);
+void shape_refund(const char *signer, size_t signer_len);
+void shape_rebalance(void);
+void shape_cleanup(void);
+
+#endif // TRUST_SHAPE_H
@@ -0,0 +1,363 @@
+// trust_shm.c - trust graph shared between brokers on one host (see trust_shm.h)
+//
+// Everything after the header is laid out from the capacities fixed at
+// creation, so every process computes the same section offsets. Fields that
+// change after creation are only touched with __atomic builtins or inside a
+// sequence lock section, since the other side may be another process.
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "trust_shm.h"
+
+#define SHM_MAGIC 0x4d485354u           // "TSHM"
+#define SHM_VERSION 1
+#define SHM_ALIGN 64
+#define SEQ_SPIN_LIMIT 1000
+
+typedef struct {
+    uint32_t magic;                     // stored last when the segment is created
+    uint32_t version;
+    uint32_t node_capacity;
+    uint32_t link_capacity;
+    uint32_t layout_seq;                // odd while the topology is rewritten
+    int32_t node_count;
+    int32_t link_count;
+    uint32_t reserved;
+    uint64_t source_tag;                // map the topology was built from
+    uint64_t generation;                // bumped after every counter publish
+} shm_header_t;
+
+static int shm_fd = -1;
+static void *shm_base = NULL;
+static size_t shm_size = 0;
+static shm_header_t *head = NULL;
+static char (*names)[TRUST_SHM_ID_LEN] = NULL;
+static uint32_t *node_seq = NULL;       // per target node, odd while its counters are written
+static int32_t *link_offset = NULL;
+static int32_t *link_target = NULL;
+static trust_shm_counts_t *counts = NULL;
+
+static size_t align_up(size_t n) {
+    return (n + SHM_ALIGN - 1) & ~(size_t)(SHM_ALIGN - 1);
+}
+
+/**
+ * Points the section pointers into the mapping at `base` and returns the
+ * segment size for the given capacities.
+ */
+static size_t shm_layout_sections(char *base, uint32_t node_capacity, uint32_t link_capacity) {
+    size_t offset = align_up(sizeof(shm_header_t));
+    size_t names_at = offset;
+    offset = align_up(offset + node_capacity * sizeof(*names));
+    size_t seq_at = offset;
+    offset = align_up(offset + node_capacity * sizeof(*node_seq));
+    size_t link_offset_at = offset;
+    offset = align_up(offset + (node_capacity + 1) * sizeof(*link_offset));
+    size_t link_target_at = offset;
+    offset = align_up(offset + link_capacity * sizeof(*link_target));
+    size_t counts_at = offset;
+    offset = align_up(offset + link_capacity * sizeof(*counts));
+    if (base) {
+        head = (shm_header_t *)base;
+        names = (void *)(base + names_at);
+        node_seq = (uint32_t *)(base + seq_at);
+        link_offset = (int32_t *)(base + link_offset_at);
+        link_target = (int32_t *)(base + link_target_at);
+        counts = (trust_shm_counts_t *)(base + counts_at);
+    }
+    return offset;
+}
+
+// ---- Sequence Locks ----
+// A writer leaves a crashed predecessor's odd value odd rather than making it
+// even, and always ends on an even value. Readers give up after
+// SEQ_SPIN_LIMIT attempts instead of waiting on a writer that died.
+
+static bool seq_read_begin(const uint32_t *seq, uint32_t *start) {
+    for (int spin = 0; spin < SEQ_SPIN_LIMIT; spin++) {
+        uint32_t s = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+        if ((s & 1) == 0) {
+            *start = s;
+            return true;
+        }
+        sched_yield();
+    }
+    return false;
+}
+
+static bool seq_read_valid(const uint32_t *seq, uint32_t start) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(seq, __ATOMIC_RELAXED) == start;
+}
+
+static void seq_write_begin(uint32_t *seq) {
+    uint32_t s = __atomic_load_n(seq, __ATOMIC_RELAXED);
+    __atomic_store_n(seq, (s + 1) | 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void seq_write_end(uint32_t *seq) {
+    uint32_t s = __atomic_load_n(seq, __ATOMIC_RELAXED);
+    __atomic_store_n(seq, (s | 1) + 1, __ATOMIC_RELEASE);
+}
+
+// ---- Attach ----
+
+static bool shm_map(size_t size) {
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (base == MAP_FAILED) return false;
+    shm_base = base;
+    shm_size = size;
+    return true;
+}
+
+bool trust_shm_attach(const char *path, int node_capacity, int link_capacity) {
+    trust_shm_detach();
+    if (node_capacity <= 0 || link_capacity <= 0) return false;
+    shm_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0660);
+    if (shm_fd < 0) return false;
+    if (flock(shm_fd, LOCK_EX) != 0) {
+        trust_shm_detach();
+        return false;
+    }
+
+    bool ok = false;
+    struct stat st;
+    shm_header_t existing;
+    if (fstat(shm_fd, &st) != 0) {
+        // fall through with ok = false
+    } else if (st.st_size == 0) {
+        // New segment: size it and fill in the header, magic last.
+        size_t size = shm_layout_sections(NULL, (uint32_t)node_capacity, (uint32_t)link_capacity);
+        if (ftruncate(shm_fd, (off_t)size) == 0 && shm_map(size)) {
+            shm_layout_sections(shm_base, (uint32_t)node_capacity, (uint32_t)link_capacity);
+            head->version = SHM_VERSION;
+            head->node_capacity = (uint32_t)node_capacity;
+            head->link_capacity = (uint32_t)link_capacity;
+            __atomic_store_n(&head->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+            ok = true;
+        }
+    } else if (pread(shm_fd, &existing, sizeof(existing), 0) == (ssize_t)sizeof(existing)
+               && existing.magic == SHM_MAGIC && existing.version == SHM_VERSION) {
+        size_t size = shm_layout_sections(NULL, existing.node_capacity, existing.link_capacity);
+        if ((size_t)st.st_size >= size && shm_map(size)) {
+            shm_layout_sections(shm_base, existing.node_capacity, existing.link_capacity);
+            ok = true;
+        }
+    }
+    flock(shm_fd, LOCK_UN);
+    if (!ok) trust_shm_detach();
+    return ok;
+}
+
+void trust_shm_detach(void) {
+    if (shm_base) munmap(shm_base, shm_size);
+    if (shm_fd >= 0) close(shm_fd);
+    shm_fd = -1;
+    shm_base = NULL;
+    shm_size = 0;
+    head = NULL;
+    names = NULL;
+    node_seq = NULL;
+    link_offset = link_target = NULL;
+    counts = NULL;
+}
+
+bool trust_shm_attached(void) {
+    return head != NULL;
+}
+
+// ---- Topology ----
+
+uint32_t trust_shm_layout(void) {
+    return head ? __atomic_load_n(&head->layout_seq, __ATOMIC_ACQUIRE) : 0;
+}
+
+static int find_name(const char (*table)[TRUST_SHM_ID_LEN], int count, const char *name) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(table[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+/**
+ * True if the segment holds exactly the brokers and links of `topo`, in the
+ * same order. Called with the exclusive lock held.
+ */
+static bool same_topology(const trust_shm_topology_t *topo) {
+    int node_count = head->node_count, link_count = head->link_count;
+    if (node_count != topo->node_count || link_count != topo->link_count) return false;
+    for (int i = 0; i < node_count; i++) {
+        if (strcmp(names[i], topo->names[i]) != 0) return false;
+    }
+    return memcmp(link_offset, topo->link_offset, (size_t)(node_count + 1) * sizeof(*link_offset)) == 0
+        && memcmp(link_target, topo->link_target, (size_t)link_count * sizeof(*link_target)) == 0;
+}
+
+/**
+ * Fills `carried` with the segment's current counters for the links of
+ * `topo` it already holds, and topo->counts for the rest. Lookups are by
+ * name, so this is quadratic in the broker count; it only runs when the
+ * map's links change.
+ */
+static void carry_counts(const trust_shm_topology_t *topo, trust_shm_counts_t *carried) {
+    int old_node_count = head->node_count;
+    for (int u = 0; u < topo->node_count; u++) {
+        int old_u = find_name(names, old_node_count, topo->names[u]);
+        for (int k = topo->link_offset[u]; k < topo->link_offset[u + 1]; k++) {
+            carried[k] = topo->counts[k];
+            int old_v = find_name(names, old_node_count, topo->names[topo->link_target[k]]);
+            if (old_u == -1 || old_v == -1) continue;
+            for (int j = link_offset[old_u]; j < link_offset[old_u + 1]; j++) {
+                if (link_target[j] == old_v) {
+                    carried[k] = counts[j];
+                    break;
+                }
+            }
+        }
+    }
+}
+
+bool trust_shm_write_topology(const trust_shm_topology_t *topo, uint64_t source_tag) {
+    if (!head || topo->node_count <= 0 || topo->link_count <= 0
+            || (uint32_t)topo->node_count > head->node_capacity
+            || (uint32_t)topo->link_count > head->link_capacity) return false;
+    for (int i = 0; i < topo->node_count; i++) {
+        if (memchr(topo->names[i], '\0', TRUST_SHM_ID_LEN) == NULL) return false;
+    }
+    trust_shm_counts_t *carried = malloc((size_t)topo->link_count * sizeof(*carried));
+    if (!carried || flock(shm_fd, LOCK_EX) != 0) {
+        free(carried);
+        return false;
+    }
+
+    // Another broker may have shared this map already.
+    if (head->node_count > 0 && (head->source_tag == source_tag || same_topology(topo))) {
+        head->source_tag = source_tag;
+        flock(shm_fd, LOCK_UN);
+        free(carried);
+        return true;
+    }
+
+    carry_counts(topo, carried);
+    seq_write_begin(&head->layout_seq);
+    memcpy(names, topo->names, (size_t)topo->node_count * sizeof(*names));
+    memcpy(link_offset, topo->link_offset, (size_t)(topo->node_count + 1) * sizeof(*link_offset));
+    memcpy(link_target, topo->link_target, (size_t)topo->link_count * sizeof(*link_target));
+    memcpy(counts, carried, (size_t)topo->link_count * sizeof(*counts));
+    __atomic_store_n(&head->node_count, topo->node_count, __ATOMIC_RELAXED);
+    __atomic_store_n(&head->link_count, topo->link_count, __ATOMIC_RELAXED);
+    head->source_tag = source_tag;
+    seq_write_end(&head->layout_seq);
+    __atomic_add_fetch(&head->generation, 1, __ATOMIC_RELEASE);
+    flock(shm_fd, LOCK_UN);
+    free(carried);
+    return true;
+}
+
+void trust_shm_topology_free(trust_shm_topology_t *topo) {
+    free(topo->names);
+    free(topo->link_offset);
+    free(topo->link_target);
+    free(topo->counts);
+    memset(topo, 0, sizeof(*topo));
+}
+
+/**
+ * Checks a copied topology for indices that would run off its arrays.
+ */
+static bool topology_valid(const trust_shm_topology_t *topo) {
+    if (topo->link_offset[0] != 0 || topo->link_offset[topo->node_count] != topo->link_count) return false;
+    for (int u = 0; u < topo->node_count; u++) {
+        if (topo->link_offset[u] > topo->link_offset[u + 1]) return false;
+        if (memchr(topo->names[u], '\0', TRUST_SHM_ID_LEN) == NULL) return false;
+    }
+    for (int k = 0; k < topo->link_count; k++) {
+        if (topo->link_target[k] < 0 || topo->link_target[k] >= topo->node_count) return false;
+    }
+    return true;
+}
+
+bool trust_shm_read_topology(trust_shm_topology_t *topo) {
+    memset(topo, 0, sizeof(*topo));
+    if (!head) return false;
+    for (int attempt = 0; attempt < SEQ_SPIN_LIMIT; attempt++) {
+        uint32_t start;
+        if (!seq_read_begin(&head->layout_seq, &start)) break;
+        int node_count = __atomic_load_n(&head->node_count, __ATOMIC_RELAXED);
+        int link_count = __atomic_load_n(&head->link_count, __ATOMIC_RELAXED);
+        if (node_count <= 0 || link_count <= 0) break;
+        if ((uint32_t)node_count > head->node_capacity || (uint32_t)link_count > head->link_capacity) continue;
+
+        trust_shm_topology_free(topo);
+        topo->names = malloc((size_t)node_count * sizeof(*topo->names));
+        topo->link_offset = malloc((size_t)(node_count + 1) * sizeof(*topo->link_offset));
+        topo->link_target = malloc((size_t)link_count * sizeof(*topo->link_target));
+        topo->counts = malloc((size_t)link_count * sizeof(*topo->counts));
+        if (!topo->names || !topo->link_offset || !topo->link_target || !topo->counts) break;
+        memcpy(topo->names, names, (size_t)node_count * sizeof(*names));
+        memcpy(topo->link_offset, link_offset, (size_t)(node_count + 1) * sizeof(*link_offset));
+        memcpy(topo->link_target, link_target, (size_t)link_count * sizeof(*link_target));
+        if (!seq_read_valid(&head->layout_seq, start)) continue;
+
+        topo->layout = start;
+        topo->node_count = node_count;
+        topo->link_count = link_count;
+        if (!topology_valid(topo)) break;
+        bool read = true;
+        for (int k = 0; k < link_count && read; k++) read = trust_shm_read_link(k, &topo->counts[k]);
+        if (read && seq_read_valid(&head->layout_seq, start)) return true;
+    }
+    trust_shm_topology_free(topo);
+    return false;
+}
+
+// ---- Counters ----
+
+bool trust_shm_publish_begin(uint32_t layout, int target) {
+    if (!head || target < 0 || (uint32_t)target >= head->node_capacity) return false;
+    if (flock(shm_fd, LOCK_SH) != 0) return false;
+    if (__atomic_load_n(&head->layout_seq, __ATOMIC_ACQUIRE) != layout) {
+        flock(shm_fd, LOCK_UN);
+        return false;
+    }
+    seq_write_begin(&node_seq[target]);
+    return true;
+}
+
+void trust_shm_publish_link(int link, int r, int s) {
+    if (link < 0 || (uint32_t)link >= head->link_capacity) return;
+    __atomic_store_n(&counts[link].r, r, __ATOMIC_RELAXED);
+    __atomic_store_n(&counts[link].s, s, __ATOMIC_RELAXED);
+}
+
+void trust_shm_publish_end(int target) {
+    seq_write_end(&node_seq[target]);
+    __atomic_add_fetch(&head->generation, 1, __ATOMIC_RELEASE);
+    flock(shm_fd, LOCK_UN);
+}
+
+uint64_t trust_shm_generation(void) {
+    return head ? __atomic_load_n(&head->generation, __ATOMIC_ACQUIRE) : 0;
+}
+
+bool trust_shm_read_link(int link, trust_shm_counts_t *out) {
+    if (!head || link < 0 || (uint32_t)link >= head->link_capacity) return false;
+    int target = __atomic_load_n(&link_target[link], __ATOMIC_RELAXED);
+    if (target < 0 || (uint32_t)target >= head->node_capacity) return false;
+    for (int attempt = 0; attempt < SEQ_SPIN_LIMIT; attempt++) {
+        uint32_t start;
+        if (!seq_read_begin(&node_seq[target], &start)) return false;
+        out->r = __atomic_load_n(&counts[link].r, __ATOMIC_RELAXED);
+        out->s = __atomic_load_n(&counts[link].s, __ATOMIC_RELAXED);
+        if (seq_read_valid(&node_seq[target], start)) return true;
+    }
+    return false;
+}
@@ -0,0 +1,62 @@
+// trust_shm.h - trust graph shared between brokers on one host
+//
+// A fixed-layout file mapped by every broker: a header, the broker ID table,
+// the links in compressed sparse row form (as in network_graph_t) and one
+// (r, s) counter pair per link. Node and link indices mean the same thing in
+// every process that loaded its graph from the segment.
+//
+// Each broker is the only writer of the counters on links into it, and
+// publishes them under that node's sequence lock, so readers never block and
+// never see a half-updated node. The topology is rewritten under an exclusive
+// flock() on the file and its own sequence lock; counter writers hold a
+// shared flock() so the two never overlap.
+
+#ifndef TRUST_SHM_H
+#define TRUST_SHM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TRUST_SHM_ID_LEN 32
+
+typedef struct { int32_t r; int32_t s; } trust_shm_counts_t;
+
+typedef struct {
+    uint32_t layout;                        // segment layout this copy was read at
+    int node_count;
+    int link_count;
+    char (*names)[TRUST_SHM_ID_LEN];        // node_count entries, by node index
+    int32_t *link_offset;                   // node_count + 1 entries
+    int32_t *link_target;                   // link_count entries
+    trust_shm_counts_t *counts;             // link_count entries
+} trust_shm_topology_t;
+
+// Maps `path`, creating it with room for the given number of brokers and
+// links if it does not exist yet. An existing segment keeps its own sizes.
+bool trust_shm_attach(const char *path, int node_capacity, int link_capacity);
+void trust_shm_detach(void);
+bool trust_shm_attached(void);
+
+// Replaces the segment's topology unless it was already built from the same
+// map (`source_tag`) or has exactly these links. Counters of links that
+// survive the rewrite are kept; new links start at topo->counts.
+bool trust_shm_write_topology(const trust_shm_topology_t *topo, uint64_t source_tag);
+// Copies the topology and all counters into malloc()ed arrays.
+bool trust_shm_read_topology(trust_shm_topology_t *topo);
+void trust_shm_topology_free(trust_shm_topology_t *topo);
+// Changes (to another even value) whenever the topology is rewritten.
+uint32_t trust_shm_layout(void);
+
+// Counter updates for the links into `target`: begin, one call per link,
+// end. Begin fails if the segment no longer has layout `layout`.
+bool trust_shm_publish_begin(uint32_t layout, int target);
+void trust_shm_publish_link(int link, int r, int s);
+void trust_shm_publish_end(int target);
+
+// Goes up after every publish, by any broker.
+uint64_t trust_shm_generation(void);
+// Reads one link's counters. Only meaningful if trust_shm_layout() still
+// matches the layout the caller's indices came from afterwards.
+bool trust_shm_read_link(int link, trust_shm_counts_t *counts);
+
+#endif // TRUST_SHM_H
@@ -0,0 +1,160 @@
+// trust_topics.c - which topics go through trust evaluation (see trust_topics.h)
+//
+// Include and exclude filters share one trie with a node per topic level, as
+// in trust_acl.c; each node records which kinds of filter end at it. A lookup
+// walks the topic's levels once, branching only where a '+' filter sits next
+// to a literal one.
+
+#include <stdlib.h>
+#include <string.h>
+#include <uthash.h>
+
+#include "trust_topics.h"
+
+enum { TOPIC_INCLUDE = 1, TOPIC_EXCLUDE = 2 };
+
+typedef struct topic_node {
+    char *level;                        // this level's name; NULL for the root and '+'
+    struct topic_node *children;        // literal child levels, hashed by name
+    struct topic_node *plus;            // '+' child level
+    unsigned char here;                 // kinds of filter ending exactly at this level
+    unsigned char hash;                 // kinds of filter ending with '#' directly below
+    UT_hash_handle hh;
+} topic_node_t;
+
+// Left behind by brokers that still rewrite feedback for their subscribers.
+static const char *const builtin_excludes[] = { "internal/feedback/processed" };
+
+static topic_node_t *topic_root = NULL;
+static bool topic_includes = false;     // an include filter was given
+
+static void topic_node_free(topic_node_t *node) {
+    if (!node) return;
+    topic_node_t *child, *tmp;
+    HASH_ITER(hh, node->children, child, tmp) {
+        HASH_DEL(node->children, child);
+        topic_node_free(child);
+    }
+    topic_node_free(node->plus);
+    free(node->level);
+    free(node);
+}
+
+static topic_node_t *topic_node_child(topic_node_t *node, const char *level, size_t len) {
+    if (len == 1 && level[0] == '+') {
+        if (!node->plus) node->plus = calloc(1, sizeof(topic_node_t));
+        return node->plus;
+    }
+    topic_node_t *child = NULL;
+    HASH_FIND(hh, node->children, level, len, child);
+    if (child) return child;
+
+    child = calloc(1, sizeof(topic_node_t));
+    if (!child) return NULL;
+    child->level = strndup(level, len);
+    if (!child->level) { free(child); return NULL; }
+    HASH_ADD_KEYPTR(hh, node->children, child->level, len, child);
+    return child;
+}
+
+/**
+ * Adds one filter of the given kind. Returns false if it is malformed ('+' or
+ * '#' sharing a level, '#' before the last level) or memory runs out.
+ */
+static bool topic_add(topic_node_t *root, const char *filter, unsigned char kind) {
+    topic_node_t *node = root;
+    const char *level = filter;
+    while (node) {
+        const char *slash = strchr(level, '/');
+        size_t len = slash ? (size_t)(slash - level) : strlen(level);
+        const char *wildcard = memchr(level, '#', len);
+        if (!wildcard) wildcard = memchr(level, '+', len);
+        if (wildcard && len != 1) return false;
+        if (len == 1 && level[0] == '#') {
+            if (slash) return false;
+            node->hash |= kind;
+            return true;
+        }
+        node = topic_node_child(node, level, len);
+        if (!slash) break;
+        level = slash + 1;
+    }
+    if (!node) return false;
+    node->here |= kind;
+    return true;
+}
+
+/**
+ * Returns the kinds of filter matching the remaining topic levels (`level`,
+ * NULL once exhausted) below `node`, stopping early once an exclude matched.
+ */
+static unsigned topic_match(const topic_node_t *node, const char *level) {
+    if (!level) return node->here | node->hash;
+
+    unsigned found = node->hash;
+    if (found & TOPIC_EXCLUDE) return found;
+    const char *slash = strchr(level, '/');
+    size_t len = slash ? (size_t)(slash - level) : strlen(level);
+    const char *next = slash ? slash + 1 : NULL;
+
+    topic_node_t *child = NULL;
+    HASH_FIND(hh, node->children, level, len, child);
+    if (child) found |= topic_match(child, next);
+    if (!(found & TOPIC_EXCLUDE) && node->plus) found |= topic_match(node->plus, next);
+    return found;
+}
+
+int topics_configure(const char *filters) {
+    topics_cleanup();
+    topic_node_t *root = calloc(1, sizeof(topic_node_t));
+    char *list = strdup(filters);
+    if (!root || !list) {
+        free(root);
+        free(list);
+        return -1;
+    }
+    for (size_t i = 0; i < sizeof(builtin_excludes) / sizeof(builtin_excludes[0]); i++) {
+        topic_add(root, builtin_excludes[i], TOPIC_EXCLUDE);
+    }
+
+    int filter_count = 0;
+    bool includes = false, ok = true;
+    char *saveptr = NULL;
+    for (char *filter = strtok_r(list, ",", &saveptr); ok && filter; filter = strtok_r(NULL, ",", &saveptr)) {
+        while (*filter == ' ') filter++;
+        unsigned char kind = TOPIC_INCLUDE;
+        if (*filter == '!') {
+            kind = TOPIC_EXCLUDE;
+            filter++;
+        }
+        if (*filter == '\0') continue;
+        ok = topic_add(root, filter, kind);
+        if (kind == TOPIC_INCLUDE) includes = true;
+        filter_count++;
+    }
+    free(list);
+
+    if (!ok) {
+        // Keep only the built-in bypasses.
+        topic_node_free(root);
+        topics_configure("");
+        return -1;
+    }
+    topic_root = root;
+    topic_includes = includes;
+    return filter_count;
+}
+
+bool topics_evaluated(const char *topic) {
+    if (topic[0] == '$') return false;
+    if (!topic_root) return true;
+    unsigned found = topic_match(topic_root, topic);
+    if (found & TOPIC_EXCLUDE) return false;
+    return !topic_includes || (found & TOPIC_INCLUDE);
+}
+
+void topics_cleanup(void) {
+    topic_node_free(topic_root);
+    topic_root = NULL;
+    topic_includes = false;
+}
@@ -0,0 +1,20 @@
+// trust_topics.h - which topics go through trust evaluation
+//
+// Filters come from a comma-separated list of MQTT topic filters, e.g.
+// "groundfloor/#,firstfloor/#,!groundfloor/+/telemetry". A topic is evaluated
+// if it matches an include filter (or none are given) and no exclude filter
+// (prefixed with '!'). Topics starting with '$' and internal/feedback/processed
+// are never evaluated.
+
+#ifndef TRUST_TOPICS_H
+#define TRUST_TOPICS_H
+
+#include <stdbool.h>
+
+// Returns the number of filters compiled, or -1 if one is malformed, in
+// which case every topic but the built-in bypasses stays evaluated.
+int topics_configure(const char *filters);
+bool topics_evaluated(const char *topic);
+void topics_cleanup(void);
+
+#endif // TRUST_TOPICS_H
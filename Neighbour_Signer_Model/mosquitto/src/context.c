@@ -140,6 +140,7 @@ void context__cleanup(struct mosquitto *context, bool force_free)
 
 	alias__free_all(context);
 	keepalive__remove(context);
+	plugin__pending_drop_context(context);
 	context__cleanup_out_packets(context);
 
 	mosquitto__free(context->auth_method);
@@ -219,6 +220,7 @@ void context__disconnect(struct mosquitto *context)
 		return;
 	}
 
+	plugin__pending_drop_context(context);
 	plugin__handle_disconnect(context, -1);
 
 	context__send_will(context);
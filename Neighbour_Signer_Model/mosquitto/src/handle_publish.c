@@ -37,11 +37,10 @@ int handle__publish(struct mosquitto *context)
 {
 	uint8_t dup;
 	int rc = 0;
-	int rc2;
 	uint8_t header = context->in_packet.command;
-	int res = 0;
-	struct mosquitto_msg_store *msg, *stored = NULL;
-	struct mosquitto_client_msg *cmsg_stored = NULL;
+	struct mosquitto_msg_store *msg;
+	struct mosquitto__callback *resume = NULL;
+	uint64_t ticket;
 	size_t len;
 	uint16_t slen;
 	char *topic_mount;
@@ -271,8 +270,10 @@ int handle__publish(struct mosquitto *context)
 	}
 
 	{
-		rc = plugin__handle_message(context, msg);
-		if(rc == MOSQ_ERR_ACL_DENIED){
+		rc = plugin__handle_message(context, msg, &resume, &ticket);
+		if(rc == MOSQ_ERR_MESSAGE_PENDING){
+			return plugin__pending_add(context, msg, message_expiry_interval, resume, ticket);
+		}else if(rc == MOSQ_ERR_ACL_DENIED){
 			log__printf(NULL, MOSQ_LOG_DEBUG,
 					"Denied PUBLISH from %s (d%d, q%d, r%d, m%d, '%s', ... (%ld bytes))",
 					context->id, dup, msg->qos, msg->retain, msg->source_mid, msg->topic,
@@ -286,6 +287,33 @@ int handle__publish(struct mosquitto *context)
 		}
 	}
 
+	/* Earlier messages from this client are still waiting on a plugin, so
+	 * this one has to wait its turn. */
+	if(context->pending_msgs){
+		return plugin__pending_add_ready(context, msg, message_expiry_interval, 0);
+	}
+	return handle__publish_accepted(context, msg, message_expiry_interval);
+
+process_bad_message:
+	if(context->pending_msgs){
+		return plugin__pending_add_ready(context, msg, message_expiry_interval, reason_code);
+	}
+	return handle__publish_denied(context, msg, reason_code);
+}
+
+
+/* Stores and queues a PUBLISH that has passed all checks, and acknowledges
+ * it. Takes ownership of msg. */
+int handle__publish_accepted(struct mosquitto *context, struct mosquitto_msg_store *msg, uint32_t message_expiry_interval)
+{
+	struct mosquitto_msg_store *stored = NULL;
+	struct mosquitto_client_msg *cmsg_stored = NULL;
+	uint16_t mid = msg->source_mid;
+	uint8_t dup;
+	int rc = 0;
+	int rc2;
+	int res = 0;
+
 	if(msg->qos > 0){
 		db__message_store_find(context, msg->source_mid, &cmsg_stored);
 	}
@@ -306,13 +334,11 @@ int handle__publish(struct mosquitto *context)
 				|| db__ready_for_flight(context, mosq_md_in, msg->qos)
 				){
 
-			dup = 0;
 			rc = db__message_store(context, msg, message_expiry_interval, 0, mosq_mo_client);
 			if(rc) return rc;
 		}else{
 			/* Client isn't allowed any more incoming messages, so fail early */
-			reason_code = MQTT_RC_QUOTA_EXCEEDED;
-			goto process_bad_message;
+			return handle__publish_denied(context, msg, MQTT_RC_QUOTA_EXCEEDED);
 		}
 		stored = msg;
 		msg = NULL;
@@ -367,8 +393,15 @@ int handle__publish(struct mosquitto *context)
 
 	db__message_write_queued_in(context);
 	return rc;
-process_bad_message:
-	rc = 1;
+}
+
+
+/* Refuses a PUBLISH with reason_code, acknowledging it where the QoS calls
+ * for it. Takes ownership of msg. */
+int handle__publish_denied(struct mosquitto *context, struct mosquitto_msg_store *msg, uint8_t reason_code)
+{
+	int rc = 1;
+
 	if(msg){
 		switch(msg->qos){
 			case 0:
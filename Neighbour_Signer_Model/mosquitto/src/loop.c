@@ -204,6 +204,7 @@ int mosquitto_main_loop(struct mosquitto__listener_sock *listensock, int listens
 
 		rc = mux__handle(listensock, listensock_count);
 		if(rc) return rc;
+		plugin__pending_process();
 
 		session_expiry__check();
 		will_delay__check();
@@ -272,6 +273,7 @@ int mosquitto_main_loop(struct mosquitto__listener_sock *listensock, int listens
 		plugin__handle_tick();
 	}
 
+	plugin__pending_cleanup();
 	mux__cleanup();
 
 	return MOSQ_ERR_SUCCESS;
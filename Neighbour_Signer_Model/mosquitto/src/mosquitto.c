@@ -572,6 +572,9 @@ int main(int argc, char *argv[])
 	rc = mux__init(listensock, listensock_count);
 	if(rc) return rc;
 
+	rc = plugin__pending_init();
+	if(rc) return rc;
+
 	signal__setup();
 
 #ifdef WITH_BRIDGE
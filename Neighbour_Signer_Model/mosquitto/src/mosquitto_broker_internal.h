@@ -163,6 +163,28 @@ struct plugin__callbacks{
 	struct mosquitto__callback *reload;
 };
 
+/* A message whose plugin verdict is still outstanding, or one that has been
+ * decided but is queued behind such a message from the same client. */
+enum mosquitto__pending_state{
+	mps_pending = 0,
+	mps_accepted = 1,
+	mps_denied = 2,
+	mps_running = 3, /* Back in the message callbacks after its verdict */
+};
+
+struct mosquitto__pending_msg{
+	UT_hash_handle hh; /* By ticket, while state is mps_pending */
+	struct mosquitto__pending_msg *next, *prev; /* Per client, in arrival order */
+	uint64_t ticket;
+	struct mosquitto *context;
+	struct mosquitto_msg_store *msg;
+	struct mosquitto__callback *deferred_by;
+	time_t deadline;
+	uint32_t message_expiry_interval;
+	enum mosquitto__pending_state state;
+	uint8_t reason_code;
+};
+
 struct mosquitto__security_options {
 	/* Any options that get added here also need considering
 	 * in config__read() with regards whether allow_anonymous
@@ -191,6 +213,7 @@ enum struct_ident{
 	id_listener = 1,
 	id_client = 2,
 	id_listener_ws = 3,
+	id_wakeup = 4,
 };
 #endif
 
@@ -629,6 +652,8 @@ int handle__connack(struct mosquitto *context);
 int handle__connect(struct mosquitto *context);
 int handle__disconnect(struct mosquitto *context);
 int handle__publish(struct mosquitto *context);
+int handle__publish_accepted(struct mosquitto *context, struct mosquitto_msg_store *msg, uint32_t message_expiry_interval);
+int handle__publish_denied(struct mosquitto *context, struct mosquitto_msg_store *msg, uint8_t reason_code);
 int handle__subscribe(struct mosquitto *context);
 int handle__unsubscribe(struct mosquitto *context);
 int handle__auth(struct mosquitto *context);
@@ -749,6 +774,7 @@ int mux__add_in(struct mosquitto *context);
 int mux__delete(struct mosquitto *context);
 int mux__wait(void);
 int mux__handle(struct mosquitto__listener_sock *listensock, int listensock_count);
+int mux__add_wakeup(mosq_sock_t sock);
 int mux__cleanup(void);
 
 /* ============================================================
@@ -765,9 +791,16 @@ void listeners__add_websockets(struct lws_context *ws_context, mosq_sock_t fd);
  * ============================================================ */
 int plugin__load_v5(struct mosquitto__listener *listener, struct mosquitto__auth_plugin *plugin, struct mosquitto_opt *auth_options, int auth_option_count, void *lib);
 void plugin__handle_disconnect(struct mosquitto *context, int reason);
-int plugin__handle_message(struct mosquitto *context, struct mosquitto_msg_store *stored);
+int plugin__handle_message(struct mosquitto *context, struct mosquitto_msg_store *stored, struct mosquitto__callback **resume, uint64_t *ticket);
+uint64_t plugin__message_defer(const struct mosquitto_evt_message *event_data);
 void LIB_ERROR(void);
 void plugin__handle_tick(void);
+int plugin__pending_init(void);
+void plugin__pending_cleanup(void);
+int plugin__pending_add(struct mosquitto *context, struct mosquitto_msg_store *msg, uint32_t message_expiry_interval, struct mosquitto__callback *deferred_by, uint64_t ticket);
+int plugin__pending_add_ready(struct mosquitto *context, struct mosquitto_msg_store *msg, uint32_t message_expiry_interval, uint8_t reason_code);
+void plugin__pending_process(void);
+void plugin__pending_drop_context(struct mosquitto *context);
 
 /* ============================================================
  * Property related functions
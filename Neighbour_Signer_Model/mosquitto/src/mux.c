@@ -80,6 +80,16 @@ int mux__handle(struct mosquitto__listener_sock *listensock, int listensock_coun
 }
 
 
+int mux__add_wakeup(mosq_sock_t sock)
+{
+#ifdef WITH_EPOLL
+	return mux_epoll__add_wakeup(sock);
+#else
+	return mux_poll__add_wakeup(sock);
+#endif
+}
+
+
 int mux__cleanup(void)
 {
 #ifdef WITH_EPOLL
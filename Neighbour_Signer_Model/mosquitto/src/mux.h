@@ -27,6 +27,7 @@ int mux_epoll__remove_out(struct mosquitto *context);
 int mux_epoll__add_in(struct mosquitto *context);
 int mux_epoll__delete(struct mosquitto *context);
 int mux_epoll__handle(void);
+int mux_epoll__add_wakeup(mosq_sock_t sock);
 int mux_epoll__cleanup(void);
 
 int mux_poll__init(struct mosquitto__listener_sock *listensock, int listensock_count);
@@ -35,6 +36,7 @@ int mux_poll__remove_out(struct mosquitto *context);
 int mux_poll__add_in(struct mosquitto *context);
 int mux_poll__delete(struct mosquitto *context);
 int mux_poll__handle(struct mosquitto__listener_sock *listensock, int listensock_count);
+int mux_poll__add_wakeup(mosq_sock_t sock);
 int mux_poll__cleanup(void);
 
 #endif
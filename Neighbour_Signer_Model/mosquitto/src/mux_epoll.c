@@ -68,6 +68,8 @@ static void loop_handle_reads_writes(struct mosquitto *context, uint32_t events)
 
 static sigset_t my_sigblock;
 static struct epoll_event ep_events[MAX_EVENTS];
+/* Stands in for a context, so the ident check in mux_epoll__handle() works. */
+static int wakeup_ident = id_wakeup;
 
 int mux_epoll__init(struct mosquitto__listener_sock *listensock, int listensock_count)
 {
@@ -174,6 +176,21 @@ int mux_epoll__delete(struct mosquitto *context)
 }
 
 
+int mux_epoll__add_wakeup(mosq_sock_t sock)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(struct epoll_event));
+	ev.data.ptr = &wakeup_ident;
+	ev.events = EPOLLIN;
+	if(epoll_ctl(db.epollfd, EPOLL_CTL_ADD, sock, &ev) == -1){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error in epoll registering wakeup: %s", strerror(errno));
+		return MOSQ_ERR_UNKNOWN;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
 int mux_epoll__handle(void)
 {
 	int i;
@@ -218,6 +235,9 @@ int mux_epoll__handle(void)
 				/* Nothing needs to happen here, because we always call lws_service in the loop.
 				 * The important point is we've been woken up for this listener. */
 #endif
+			}else if(context->ident == id_wakeup){
+				/* A plugin has posted a message verdict. The pipe is
+				 * drained by plugin__pending_process(). */
 			}
 		}
 	}
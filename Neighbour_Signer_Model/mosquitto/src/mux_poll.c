@@ -187,6 +187,27 @@ int mux_poll__delete(struct mosquitto *context)
 
 
 
+/* The wakeup fd only needs to interrupt poll(). It is drained by
+ * plugin__pending_process(), so its revents are never looked at. */
+int mux_poll__add_wakeup(mosq_sock_t sock)
+{
+	size_t i;
+
+	for(i=0; i<pollfd_max; i++){
+		if(pollfds[i].fd == INVALID_SOCKET){
+			pollfds[i].fd = sock;
+			pollfds[i].events = POLLIN;
+			pollfds[i].revents = 0;
+			if(i > pollfd_current_max){
+				pollfd_current_max = i;
+			}
+			return MOSQ_ERR_SUCCESS;
+		}
+	}
+	return MOSQ_ERR_NOMEM;
+}
+
+
 int mux_poll__handle(struct mosquitto__listener_sock *listensock, int listensock_count)
 {
 	struct mosquitto *context;
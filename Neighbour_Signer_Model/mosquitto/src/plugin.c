@@ -127,13 +127,38 @@ void plugin__handle_disconnect(struct mosquitto *context, int reason)
 }
 
 
-int plugin__handle_message(struct mosquitto *context, struct mosquitto_msg_store *stored)
+/* Set while a message callback runs, so mosquitto_message_defer() can tell
+ * that it was called from the right place. */
+static const struct mosquitto_evt_message *message_in_progress = NULL;
+static uint64_t message_ticket = 0;
+static uint64_t last_ticket = 0;
+
+
+uint64_t plugin__message_defer(const struct mosquitto_evt_message *event_data)
+{
+	if(event_data == NULL || event_data != message_in_progress || message_ticket != 0){
+		return 0;
+	}
+	message_ticket = ++last_ticket;
+	return message_ticket;
+}
+
+
+/* Runs the message callbacks for a message.
+ *
+ * If *resume is not NULL, only the callbacks registered after *resume are
+ * run, which is how a deferred message picks up where it left off. If a
+ * callback defers the message, MOSQ_ERR_MESSAGE_PENDING is returned with
+ * *resume set to that callback and *ticket to the ticket it was given.
+ */
+int plugin__handle_message(struct mosquitto *context, struct mosquitto_msg_store *stored, struct mosquitto__callback **resume, uint64_t *ticket)
 {
 	struct mosquitto_evt_message event_data;
 	struct mosquitto__callback *cb_base;
 	struct mosquitto__security_options *opts;
 	int rc = MOSQ_ERR_SUCCESS;
 
+	*ticket = 0;
 	if(db.config->per_listener_settings){
 		if(context->listener == NULL){
 			return MOSQ_ERR_SUCCESS;
@@ -142,7 +167,19 @@ int plugin__handle_message(struct mosquitto *context, struct mosquitto_msg_store
 	}else{
 		opts = &db.config->security_options;
 	}
-	if(opts->plugin_callbacks.message == NULL){
+	cb_base = opts->plugin_callbacks.message;
+	if(*resume){
+		/* If the plugin that deferred has since been unloaded, there is
+		 * nothing left to resume. */
+		while(cb_base && cb_base != *resume){
+			cb_base = cb_base->next;
+		}
+		if(cb_base){
+			cb_base = cb_base->next;
+		}
+	}
+	*resume = NULL;
+	if(cb_base == NULL){
 		return MOSQ_ERR_SUCCESS;
 	}
 	memset(&event_data, 0, sizeof(event_data));
@@ -155,8 +192,11 @@ int plugin__handle_message(struct mosquitto *context, struct mosquitto_msg_store
 	event_data.retain = stored->retain;
 	event_data.properties = stored->properties;
 
-	DL_FOREACH(opts->plugin_callbacks.message, cb_base){
+	for(; cb_base; cb_base = cb_base->next){
+		message_in_progress = &event_data;
+		message_ticket = 0;
 		rc = cb_base->cb(MOSQ_EVT_MESSAGE, &event_data, cb_base->userdata);
+		message_in_progress = NULL;
 
 		if(stored->topic != event_data.topic){
 			mosquitto__free(stored->topic);
@@ -174,10 +214,21 @@ int plugin__handle_message(struct mosquitto *context, struct mosquitto_msg_store
 			stored->properties = event_data.properties;
 		}
 
+		if(rc == MOSQ_ERR_MESSAGE_PENDING){
+			if(message_ticket == 0){
+				/* Pending without a ticket can never complete. */
+				rc = MOSQ_ERR_ACL_DENIED;
+			}else{
+				*resume = cb_base;
+				*ticket = message_ticket;
+			}
+			break;
+		}
 		if(rc != MOSQ_ERR_SUCCESS){
 			break;
 		}
 	}
+	message_ticket = 0;
 
 	stored->retain = event_data.retain;
 
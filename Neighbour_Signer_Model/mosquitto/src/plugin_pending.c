@@ -0,0 +1,447 @@
+/*
+All rights reserved. This program and the accompanying materials
+are made available under the terms of the Eclipse Public License 2.0
+and Eclipse Distribution License v1.0 which accompany this distribution.
+
+The Eclipse Public License is available at
+   https://www.eclipse.org/legal/epl-2.0/
+and the Eclipse Distribution License is available at
+  http://www.eclipse.org/org/documents/edl-v10.php.
+
+SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+
+Contributors:
+   Trust_MQTT - deferred message verdicts.
+*/
+
+/* Messages whose MOSQ_EVT_MESSAGE verdict a plugin is deciding off the main
+ * thread.
+ *
+ * A deferred message is parked on its client's pending list. Any later
+ * PUBLISH from that client is parked behind it, already decided, so that
+ * messages are still routed and acknowledged in the order they arrived. When
+ * a plugin posts a verdict with mosquitto_message_complete() it is queued
+ * under a mutex and a byte is written to a pipe that the mux watches, which
+ * wakes the main loop. plugin__pending_process() then resumes the remaining
+ * message callbacks and releases the decided messages at the head of each
+ * list.
+ */
+
+#include "config.h"
+
+#ifndef WIN32
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <pthread.h>
+#  include <unistd.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#include "mosquitto_broker_internal.h"
+#include "memory_mosq.h"
+#include "mqtt_protocol.h"
+#include "uthash.h"
+#include "utlist.h"
+
+/* A deferred message is denied if no verdict arrives within this time. */
+#define PENDING_TIMEOUT 10
+/* Upper limit on messages held for all clients. */
+#define PENDING_MAX 10000
+
+struct pending_completion{
+	struct pending_completion *next;
+	uint64_t ticket;
+	void *payload;
+	uint32_t payloadlen;
+	int result;
+	bool has_payload;
+};
+
+static struct mosquitto__pending_msg *pending_by_ticket = NULL;
+static unsigned int pending_count = 0;
+static time_t last_expiry_check = 0;
+
+#ifndef WIN32
+/* Everything below is shared with plugin threads. */
+static pthread_mutex_t completion_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct pending_completion *completions = NULL;
+static struct pending_completion *completions_last = NULL;
+static int wakeup_pipe[2] = {-1, -1};
+#endif
+
+
+int plugin__pending_init(void)
+{
+#ifndef WIN32
+	int i;
+	int flags;
+
+	if(pipe(wakeup_pipe)){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error creating plugin wakeup pipe: %s.", strerror(errno));
+		return MOSQ_ERR_ERRNO;
+	}
+	for(i=0; i<2; i++){
+		flags = fcntl(wakeup_pipe[i], F_GETFL, 0);
+		if(flags == -1 || fcntl(wakeup_pipe[i], F_SETFL, flags | O_NONBLOCK) == -1){
+			log__printf(NULL, MOSQ_LOG_ERR, "Error creating plugin wakeup pipe: %s.", strerror(errno));
+			plugin__pending_cleanup();
+			return MOSQ_ERR_ERRNO;
+		}
+		(void)fcntl(wakeup_pipe[i], F_SETFD, FD_CLOEXEC);
+	}
+	if(mux__add_wakeup(wakeup_pipe[0])){
+		plugin__pending_cleanup();
+		return MOSQ_ERR_UNKNOWN;
+	}
+#endif
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+void plugin__pending_cleanup(void)
+{
+#ifndef WIN32
+	struct pending_completion *c, *next;
+
+	pthread_mutex_lock(&completion_mutex);
+	if(wakeup_pipe[0] != -1) (void)close(wakeup_pipe[0]);
+	if(wakeup_pipe[1] != -1) (void)close(wakeup_pipe[1]);
+	wakeup_pipe[0] = -1;
+	wakeup_pipe[1] = -1;
+	c = completions;
+	completions = NULL;
+	completions_last = NULL;
+	pthread_mutex_unlock(&completion_mutex);
+
+	while(c){
+		next = c->next;
+		free(c->payload);
+		free(c);
+		c = next;
+	}
+#endif
+}
+
+
+uint64_t mosquitto_message_defer(const struct mosquitto_evt_message *event_data)
+{
+#ifdef WIN32
+	UNUSED(event_data);
+	return 0;
+#else
+	if(wakeup_pipe[1] == -1 || pending_count >= PENDING_MAX){
+		return 0;
+	}
+	return plugin__message_defer(event_data);
+#endif
+}
+
+
+int mosquitto_message_complete(uint64_t ticket, int result, const void *payload, uint32_t payloadlen)
+{
+#ifdef WIN32
+	UNUSED(ticket);
+	UNUSED(result);
+	UNUSED(payload);
+	UNUSED(payloadlen);
+	return MOSQ_ERR_NOT_SUPPORTED;
+#else
+	struct pending_completion *c;
+	bool wake;
+	char b = 0;
+
+	if(ticket == 0 || (payloadlen > 0 && payload == NULL)){
+		return MOSQ_ERR_INVAL;
+	}
+
+	/* Called from plugin threads, so plain malloc() rather than the
+	 * broker's tracked allocator. */
+	c = calloc(1, sizeof(struct pending_completion));
+	if(c == NULL){
+		return MOSQ_ERR_NOMEM;
+	}
+	c->ticket = ticket;
+	c->result = result;
+	c->has_payload = (payload != NULL);
+	c->payloadlen = payloadlen;
+	if(payloadlen > 0){
+		c->payload = malloc(payloadlen);
+		if(c->payload == NULL){
+			free(c);
+			return MOSQ_ERR_NOMEM;
+		}
+		memcpy(c->payload, payload, payloadlen);
+	}
+
+	pthread_mutex_lock(&completion_mutex);
+	if(wakeup_pipe[1] == -1){
+		pthread_mutex_unlock(&completion_mutex);
+		free(c->payload);
+		free(c);
+		return MOSQ_ERR_NOT_SUPPORTED;
+	}
+	wake = (completions == NULL);
+	if(completions_last){
+		completions_last->next = c;
+	}else{
+		completions = c;
+	}
+	completions_last = c;
+	if(wake){
+		/* One byte per batch is enough to end the wait. */
+		if(write(wakeup_pipe[1], &b, 1) < 0){
+			/* A full pipe will wake the loop anyway. */
+		}
+	}
+	pthread_mutex_unlock(&completion_mutex);
+
+	return MOSQ_ERR_SUCCESS;
+#endif
+}
+
+
+static struct mosquitto__pending_msg *pending__new(struct mosquitto *context, struct mosquitto_msg_store *msg, uint32_t message_expiry_interval)
+{
+	struct mosquitto__pending_msg *entry;
+
+	entry = mosquitto__calloc(1, sizeof(struct mosquitto__pending_msg));
+	if(entry == NULL){
+		db__msg_store_free(msg);
+		return NULL;
+	}
+	entry->context = context;
+	entry->msg = msg;
+	entry->message_expiry_interval = message_expiry_interval;
+	DL_APPEND(context->pending_msgs, entry);
+	pending_count++;
+	return entry;
+}
+
+
+int plugin__pending_add(struct mosquitto *context, struct mosquitto_msg_store *msg, uint32_t message_expiry_interval, struct mosquitto__callback *deferred_by, uint64_t ticket)
+{
+	struct mosquitto__pending_msg *entry;
+
+	entry = pending__new(context, msg, message_expiry_interval);
+	if(entry == NULL){
+		return MOSQ_ERR_NOMEM;
+	}
+	entry->state = mps_pending;
+	entry->ticket = ticket;
+	entry->deferred_by = deferred_by;
+	entry->deadline = db.now_s + PENDING_TIMEOUT;
+	HASH_ADD(hh, pending_by_ticket, ticket, sizeof(entry->ticket), entry);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int plugin__pending_add_ready(struct mosquitto *context, struct mosquitto_msg_store *msg, uint32_t message_expiry_interval, uint8_t reason_code)
+{
+	struct mosquitto__pending_msg *entry;
+
+	if(pending_count >= PENDING_MAX && msg->qos == 0){
+		/* Nothing to acknowledge, so shed it rather than grow without
+		 * bound behind a stalled verdict. */
+		db__msg_store_free(msg);
+		return MOSQ_ERR_SUCCESS;
+	}
+	entry = pending__new(context, msg, message_expiry_interval);
+	if(entry == NULL){
+		return MOSQ_ERR_NOMEM;
+	}
+	entry->state = reason_code ? mps_denied : mps_accepted;
+	entry->reason_code = reason_code;
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Releases the decided messages at the head of a client's list. */
+static void pending__flush(struct mosquitto *context)
+{
+	struct mosquitto__pending_msg *entry;
+	int rc;
+
+	while(context->pending_msgs && (context->pending_msgs->state == mps_accepted
+				|| context->pending_msgs->state == mps_denied)){
+
+		entry = context->pending_msgs;
+		DL_DELETE(context->pending_msgs, entry);
+		pending_count--;
+
+		if(entry->state == mps_accepted){
+			rc = handle__publish_accepted(context, entry->msg, entry->message_expiry_interval);
+		}else{
+			rc = handle__publish_denied(context, entry->msg, entry->reason_code);
+		}
+		mosquitto__free(entry);
+		if(rc){
+			do_disconnect(context, rc);
+			return;
+		}
+	}
+}
+
+
+static void pending__deny(struct mosquitto__pending_msg *entry, uint8_t reason_code)
+{
+	struct mosquitto_msg_store *msg = entry->msg;
+
+	log__printf(NULL, MOSQ_LOG_DEBUG,
+			"Denied PUBLISH from %s (q%d, r%d, m%d, '%s', ... (%ld bytes))",
+			entry->context->id, msg->qos, msg->retain, msg->source_mid, msg->topic,
+			(long)msg->payloadlen);
+
+	entry->state = mps_denied;
+	entry->reason_code = reason_code;
+}
+
+
+static void pending__resume(struct mosquitto__pending_msg *entry, struct pending_completion *c)
+{
+	struct mosquitto *context = entry->context;
+	struct mosquitto_msg_store *msg = entry->msg;
+	struct mosquitto__callback *resume;
+	void *payload;
+	uint64_t ticket;
+	int rc;
+
+	HASH_DEL(pending_by_ticket, entry);
+	entry->ticket = 0;
+
+	if(c->result != MOSQ_ERR_SUCCESS){
+		pending__deny(entry, MQTT_RC_NOT_AUTHORIZED);
+		pending__flush(context);
+		return;
+	}
+
+	if(c->has_payload){
+		payload = NULL;
+		if(c->payloadlen > 0){
+			payload = mosquitto__malloc(c->payloadlen+1);
+			if(payload == NULL){
+				pending__deny(entry, MQTT_RC_IMPLEMENTATION_SPECIFIC);
+				pending__flush(context);
+				return;
+			}
+			memcpy(payload, c->payload, c->payloadlen);
+			((uint8_t *)payload)[c->payloadlen] = 0;
+		}
+		mosquitto__free(msg->payload);
+		msg->payload = payload;
+		msg->payloadlen = c->payloadlen;
+	}
+
+	/* A callback could disconnect the client, which would otherwise free
+	 * this entry while it is still in use. */
+	entry->state = mps_running;
+	resume = entry->deferred_by;
+	rc = plugin__handle_message(context, msg, &resume, &ticket);
+	if(entry->context == NULL){
+		db__msg_store_free(msg);
+		mosquitto__free(entry);
+		return;
+	}
+
+	if(rc == MOSQ_ERR_MESSAGE_PENDING){
+		entry->state = mps_pending;
+		entry->ticket = ticket;
+		entry->deferred_by = resume;
+		entry->deadline = db.now_s + PENDING_TIMEOUT;
+		HASH_ADD(hh, pending_by_ticket, ticket, sizeof(entry->ticket), entry);
+		return;
+	}else if(rc == MOSQ_ERR_SUCCESS){
+		entry->state = mps_accepted;
+	}else{
+		pending__deny(entry, MQTT_RC_NOT_AUTHORIZED);
+	}
+	pending__flush(context);
+}
+
+
+static void pending__expire(void)
+{
+	struct mosquitto__pending_msg *entry, *entry_tmp;
+	struct mosquitto *context, *ctxt_tmp;
+	bool expired = false;
+
+	HASH_ITER(hh, pending_by_ticket, entry, entry_tmp){
+		if(entry->deadline <= db.now_s){
+			log__printf(NULL, MOSQ_LOG_WARNING,
+					"Plugin verdict for PUBLISH from %s timed out, denying.",
+					entry->context->id);
+			HASH_DEL(pending_by_ticket, entry);
+			entry->ticket = 0;
+			entry->state = mps_denied;
+			entry->reason_code = MQTT_RC_IMPLEMENTATION_SPECIFIC;
+			expired = true;
+		}
+	}
+	if(!expired) return;
+
+	HASH_ITER(hh_sock, db.contexts_by_sock, context, ctxt_tmp){
+		if(context->pending_msgs){
+			pending__flush(context);
+		}
+	}
+}
+
+
+void plugin__pending_process(void)
+{
+#ifndef WIN32
+	struct pending_completion *c, *next;
+	struct mosquitto__pending_msg *entry;
+	char buf[64];
+
+	if(wakeup_pipe[0] == -1) return;
+
+	while(read(wakeup_pipe[0], buf, sizeof(buf)) > 0){
+	}
+
+	pthread_mutex_lock(&completion_mutex);
+	c = completions;
+	completions = NULL;
+	completions_last = NULL;
+	pthread_mutex_unlock(&completion_mutex);
+
+	while(c){
+		next = c->next;
+		HASH_FIND(hh, pending_by_ticket, &c->ticket, sizeof(c->ticket), entry);
+		if(entry){
+			pending__resume(entry, c);
+		}
+		free(c->payload);
+		free(c);
+		c = next;
+	}
+#endif
+
+	if(pending_by_ticket && last_expiry_check != db.now_s){
+		last_expiry_check = db.now_s;
+		pending__expire();
+	}
+}
+
+
+void plugin__pending_drop_context(struct mosquitto *context)
+{
+	struct mosquitto__pending_msg *entry, *entry_tmp;
+
+	DL_FOREACH_SAFE(context->pending_msgs, entry, entry_tmp){
+		DL_DELETE(context->pending_msgs, entry);
+		pending_count--;
+		if(entry->state == mps_running){
+			/* Freed by pending__resume() once the callbacks return. */
+			entry->context = NULL;
+			continue;
+		}
+		if(entry->state == mps_pending){
+			HASH_DEL(pending_by_ticket, entry);
+		}
+		db__msg_store_free(entry->msg);
+		mosquitto__free(entry);
+	}
+}
@@ -7,6 +7,8 @@ LOG_DIR="/home/dhruv/winshare/Neighbour_Signer_Model/mosquitto/logs"
 AGGREGATOR_SCRIPT="/home/dhruv/winshare/Neighbour_Signer_Model/mosquitto/plugins/payload-modification/aggregator.py"
 AGGREGATOR_LOG="/home/dhruv/winshare/Neighbour_Signer_Model/mosquitto/logs/aggregator.log"
 AGGREGATOR_INTERVAL=15 # Run every 15 seconds
+AGGREGATOR_BIN="/home/dhruv/winshare/Neighbour_Signer_Model/mosquitto/plugins/payload-modification/trust_aggregator"
+AGGREGATOR_WATCH_MS=250 # Store check interval for the compiled aggregator
 
 # --- Broker Setup ---
 BROKERS=("broker0" "broker1" "broker2" "broker3" "broker4" "broker5" "broker6" "broker7")
@@ -43,21 +45,27 @@ echo "All brokers started."
 
 ---
 
-# --- Start Aggregator Loop in the Background ---
-echo "Starting the aggregator script in a background loop (runs every ${AGGREGATOR_INTERVAL}s)..."
-(
-    # This runs in a subshell
-    while true; do
-        # Execute the python script, appending output to its log
-        /usr/bin/python3 "$AGGREGATOR_SCRIPT" >> "$AGGREGATOR_LOG" 2>&1
-        # Wait for the specified interval
-        sleep "$AGGREGATOR_INTERVAL"
-    done
-) &
+# --- Start Aggregator in the Background ---
+if [ -x "$AGGREGATOR_BIN" ]; then
+    # The compiled aggregator stays up and merges stores as soon as they change
+    echo "Starting the trust aggregator (checks stores every ${AGGREGATOR_WATCH_MS}ms)..."
+    "$AGGREGATOR_BIN" -w "$AGGREGATOR_WATCH_MS" >> "$AGGREGATOR_LOG" 2>&1 &
+else
+    echo "Starting the aggregator script in a background loop (runs every ${AGGREGATOR_INTERVAL}s)..."
+    (
+        # This runs in a subshell
+        while true; do
+            # Execute the python script, appending output to its log
+            /usr/bin/python3 "$AGGREGATOR_SCRIPT" >> "$AGGREGATOR_LOG" 2>&1
+            # Wait for the specified interval
+            sleep "$AGGREGATOR_INTERVAL"
+        done
+    ) &
+fi
 
-# Save the Process ID (PID) of the background loop
+# Save the Process ID (PID) of the aggregator
 aggregator_pid=$!
-echo "Aggregator script is running in the background with PID $aggregator_pid."
+echo "Aggregator is running in the background with PID $aggregator_pid."
 echo "Aggregator logs are in $AGGREGATOR_LOG"
 echo "Startup complete. Press Ctrl+C to stop this script and the aggregator."
 